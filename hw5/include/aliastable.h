@@ -0,0 +1,31 @@
+#ifndef DEFINE_ALIASTABLE_H
+#define DEFINE_ALIASTABLE_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// O(1) sampling of discrete distribution (Walker / Vose alias method)
+class AliasTable_t {
+public:
+    AliasTable_t() {};
+    AliasTable_t(const std::vector<float>& weights);
+
+    bool Empty() const;
+    uint32_t Size() const;
+
+    // returns {id, probability of id}
+    std::pair<uint32_t, float> Sample(float u) const;
+    // u picks bin, coin - bin or its alias; float u has no bits left for coin once Size() is large
+    std::pair<uint32_t, float> Sample(float u, float coin) const;
+    float Pmf(uint32_t id) const;
+private:
+    struct BIN_t {
+        float q;        // probability to stay in bin
+        uint32_t alias; // where to go otherwise
+        float pmf;
+    };
+    std::vector<BIN_t> bins_;
+};
+
+#endif // DEFINE_ALIASTABLE_H
@@ -0,0 +1,41 @@
+#ifndef DEFINE_BDPT_H
+#define DEFINE_BDPT_H
+
+#include <glm/vec3.hpp>
+
+// how Scene estimates pixel radiance
+enum class INTEGRATOR {
+    PATH,  // RayTrace, unidirectional
+    BDPT,  // bidirectional, all connections weighted by balance heuristic
+    MLT,   // primary sample space Metropolis over RayTrace
+    GDPT   // RayTrace of base and shifted paths, image from screened Poisson of primal and gradients
+};
+
+enum class VERTEX_TYPE {
+    CAMERA, LIGHT, SURFACE, MEDIUM
+};
+
+/*
+    Vertex of camera or light subpath (Veach 1997, ch. 10).
+    pdf_fwd - density of this vertex when its own subpath is traced,
+    pdf_rev - when the path is traced from the other end; both per unit area.
+    Medium vertices have no cosine in their densities, and no density has sigma_t or
+    transmittance in it (as in pbrt-v3): weights of all strategies of a path still sum to 1.
+*/
+struct BDPT_VERTEX_t {
+    VERTEX_TYPE type = VERTEX_TYPE::SURFACE;
+    glm::vec3 p = {0.f, 0.f, 0.f};
+    // surface - faces the side path arrived from, light - emitter normal, camera - forward, medium - none
+    glm::vec3 n = {0.f, 0.f, 0.f};
+    glm::vec3 beta = {1.f, 1.f, 1.f};
+    int prim_id = -1;
+    // medium - index in Scene::media
+    int medium = -1;
+    bool delta = false;
+    // surface - path arrived from inside of primitive
+    bool interior = false;
+    float pdf_fwd = 0.f;
+    float pdf_rev = 0.f;
+};
+
+#endif // DEFINE_BDPT_H
@@ -5,6 +5,8 @@
 #include <cassert>
 #include <iostream>
 #include <memory>
+#include <vector>
+#include <stdexcept>
 
 constexpr float INF = 1e18;
 
@@ -40,6 +42,8 @@ public:
 
     BVH_t() {};
     BVH_t(std::vector<Primitive>& primitives, uint32_t n);
+    // over primitives[first, last) only, hits carry indices of whole vector
+    BVH_t(std::vector<Primitive>& primitives, uint32_t first, uint32_t last);
     ray_intersection_t Intersect(const std::vector<Primitive>& primitives, const Ray &ray, float closest_dist) const;
 private:
     uint32_t root_;
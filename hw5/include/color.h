@@ -19,6 +19,7 @@ public:
     friend std::istream& operator>>(std::istream &in, Color &color);
 };
 
+float Luminance(const Color &x);
 Color AcesTonemap(const Color &x);
 Color GammaCorrected(const Color &x);
 
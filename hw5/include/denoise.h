@@ -0,0 +1,38 @@
+#ifndef DEFINE_DENOISE_H
+#define DEFINE_DENOISE_H
+
+#include <glm/vec3.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// first-hit buffers of pixel, normal is zero where camera ray escapes
+struct AOV_t {
+    glm::vec3 albedo = {0.f, 0.f, 0.f};
+    glm::vec3 normal = {0.f, 0.f, 0.f};
+    float depth = 0.f;  // along camera forward
+};
+
+/*
+    Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) with variance-guided
+    luminance weights of SVGF (Schied et al. 2017). Colour is divided by albedo first,
+    so texture-free illumination is blurred and albedo edges come back untouched.
+    Iteration i spreads 5x5 B3-spline kernel over step 2^i, taps are stopped by normal,
+    depth (relative to local depth gradient) and luminance difference measured in
+    sigma_luminance standard deviations; variance goes through filter with squared weights.
+    variance[i] - variance of luminance of pixel mean, negative - unknown, taken from 3x3 window
+*/
+std::vector<glm::vec3> DenoiseATrous(const std::vector<glm::vec3>& color, const std::vector<float>& variance,
+    const std::vector<AOV_t>& aovs, unsigned int width, unsigned int height, unsigned int iterations,
+    float sigma_luminance);
+
+/*
+    Joint bilateral upsampling (Kopf et al. 2007): pixels not marked known are filled from known
+    ones within radius, weighted by spatial gaussian and similarity of first hits (normal cosine
+    power, depth relative to pixel's own). Colour is divided by albedo, so texture detail comes
+    from pixel's own albedo; where first hits disagree everywhere, spatial weights alone are used.
+*/
+std::vector<glm::vec3> UpsampleJointBilateral(const std::vector<glm::vec3>& color, const std::vector<uint8_t>& known,
+    const std::vector<AOV_t>& aovs, unsigned int width, unsigned int height, unsigned int radius);
+
+#endif // DEFINE_DENOISE_H
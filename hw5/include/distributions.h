@@ -2,6 +2,12 @@
 #define DEFINE_DISTRIBUTIONS_H
 
 #include "primitives.h"
+#include "lightbvh.h"
+#include "aliastable.h"
+#include "sampler.h"
+#include "guiding.h"
+#include "envmap.h"
+#include "lightcache.h"
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/norm.hpp>
@@ -11,34 +17,61 @@
 #include <memory>
 #include <variant>
 
-static const float kPI = acos(-1);
-
 struct RANDOM_t {
-    std::minstd_rand rnd;
-    std::reference_wrapper<std::uniform_real_distribution<float>> uniform01;
-    std::reference_wrapper<std::normal_distribution<float>> normal01;
+    Sampler_t sampler;
 };
 
+// cosine-weighted direction around unit n for uniform u
+glm::vec3 CosineDirection(glm::vec2 u, glm::vec3 n);
+// orthonormal basis around unit w (Duff et al. 2017)
+void BuildBasis(glm::vec3 w, glm::vec3& u, glm::vec3& v);
+
 enum class DISTRIB_TYPE {
     BOX        = (1<<0),
     ELLIPSOID  = (1<<1),
-    MIX        = (1<<2)
+    MIX        = (1<<2),
+    TRIANGLE   = (1<<3)
+};
+
+// how Mix distribution picks an emitter
+enum class LIGHT_SAMPLING {
+    BVH,   // light hierarchy, by estimated contribution to shading point
+    POWER  // alias table, by area * emission luminance
+};
+
+class Distribution;
+
+struct MIX_t {
+    std::vector<Distribution> distribs;
+    LIGHT_SAMPLING light_sampling = LIGHT_SAMPLING::BVH;
+    LightBVH_t light_bvh;
+    AliasTable_t power_table;
+    // learned incident light, owned by scene; nullptr - no guiding
+    const SDTree_t* guide = nullptr;
+    // environment light, owned by scene; nullptr - constant background
+    const EnvMap_t* envmap = nullptr;
+    // learned emitter selection, owned by scene; nullptr - none
+    const LightCache_t* light_cache = nullptr;
 };
 
 class Distribution {
 private:
     static constexpr float eps = 1e-8;
     static constexpr float eps_big = 1e-3;
+    // share of guided directions in Mix
+    static constexpr float guide_prob = 0.5;
+    // share of emitters picked by light cache where it has learned something
+    static constexpr float learned_prob = 0.8;
     
     // Uniform01
     float SampleUniform01(RANDOM_t& random);
+    glm::vec2 SampleUniform01Vec2(RANDOM_t& random);
     glm::vec3 SampleUniform01Vec(RANDOM_t& random);
     float PdfUniform01() const;
 
-    // Normal01
-    float SampleNormal01(RANDOM_t& random);
-    glm::vec3 SampleNormal01Vec(RANDOM_t& random);
-    float PdfNormal01() const;
+    // UniformSphere
+    glm::vec3 SampleUniformSphere(RANDOM_t& random);
+    float PdfUniformSphere() const;
 
     // HalfSphere
     glm::vec3 SampleHalfSphere(RANDOM_t& random, glm::vec3 x, glm::vec3 n);
@@ -50,14 +83,16 @@ private:
 
     // Box
     glm::vec3 SampleBox(RANDOM_t& random, glm::vec3 x, glm::vec3 n);
-    float PdfPointBox(float dist2, glm::vec3 y, glm::vec3 n, glm::vec3 d) const;
     float PdfBox(glm::vec3 x, glm::vec3 n, glm::vec3 d) const;
 
     // Ellipsoid
     glm::vec3 SampleEllipsoid(RANDOM_t& random, glm::vec3 x, glm::vec3 n);
-    float PdfPointEllipsoid(float dist2, glm::vec3 y, glm::vec3 n, glm::vec3 d) const;
     float PdfEllipsoid(glm::vec3 x, glm::vec3 n, glm::vec3 d) const;
 
+    // Triangle
+    glm::vec3 SampleTriangle(RANDOM_t& random, glm::vec3 x, glm::vec3 n);
+    float PdfTriangle(glm::vec3 x, glm::vec3 n, glm::vec3 d) const;
+
     // Mix
     glm::vec3 SampleMix(RANDOM_t& random, glm::vec3 x, glm::vec3 n);
     float PdfMix(glm::vec3 x, glm::vec3 n, glm::vec3 d) const;
@@ -65,12 +100,14 @@ public:
     enum class DATA_T : std::size_t {
         BOX_           = 0,
         ELLIPSOID_     = 1,
-        DISTRIBS_      = 2
+        TRIANGLE_      = 2,
+        DISTRIBS_      = 3
     };
     std::variant<
         const Primitive*,          // Box
         const Primitive*,          // Ellipsoid
-        std::vector<Distribution>  // Mix
+        const Primitive*,          // Triangle
+        MIX_t                      // Mix
     > data;
 
     DISTRIB_TYPE distrib_type_;
@@ -78,11 +115,11 @@ public:
     // HalfSphere // Cosine
     Distribution(DISTRIB_TYPE distrib_type);
 
-    // Box // Ellipsoid
+    // Box // Ellipsoid // Triangle
     Distribution(DISTRIB_TYPE box_type, const Primitive* prim);
 
     // Mix
-    Distribution(DISTRIB_TYPE mix_type, std::vector<Distribution>&& distribs);
+    Distribution(DISTRIB_TYPE mix_type, std::vector<Distribution>&& distribs, LIGHT_SAMPLING light_sampling = LIGHT_SAMPLING::BVH);
 
     // MAIN METHODS
     Distribution() {};
@@ -91,6 +128,22 @@ public:
 
     glm::vec3 Sample(RANDOM_t& random, glm::vec3 x, glm::vec3 n);
     float Pdf(glm::vec3 x, glm::vec3 n, glm::vec3 d) const;
+
+    // emitter behind Box / Ellipsoid / Triangle distribution
+    const Primitive* GetPrimitive() const;
+
+    // Mix only: directions are also drawn from guide where it has learned something
+    void SetGuide(const SDTree_t* guide);
+    // Mix only: light directions are also drawn from environment map
+    void SetEnvMap(const EnvMap_t* envmap);
+    // Mix only: emitters are also picked by what light cache has learned around x
+    void SetLightCache(const LightCache_t* light_cache);
+
+    // Mix only: emitters and environment without cosine and guide parts,
+    // surfaces that are not diffuse mix it with their own sampling
+    bool HasLights() const;
+    glm::vec3 SampleLight(RANDOM_t& random, glm::vec3 x, glm::vec3 n);
+    float PdfLight(glm::vec3 x, glm::vec3 n, glm::vec3 d) const;
 };
 
 #endif // DEFINE_DISTRIBUTIONS_H
\ No newline at end of file
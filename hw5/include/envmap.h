@@ -0,0 +1,58 @@
+#ifndef DEFINE_ENVMAP_H
+#define DEFINE_ENVMAP_H
+
+#include "aliastable.h"
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+    Environment light from lat-long HDR image: row 0 looks along +y, column u along
+    (cos 2pi u, 0, sin 2pi u). Texels are piecewise constant, weighted by
+    luminance * sin(theta), and sampled through alias tables: one over rows, then
+    one over columns of picked row, so both Sample and Pdf are O(1).
+    File (PFM or Radiance RGBE) is memory-mapped; little-endian RGB PFM is read
+    from the mapping directly, other files are decoded once.
+*/
+class EnvMap_t {
+public:
+    EnvMap_t() {};
+    ~EnvMap_t();
+    EnvMap_t(const EnvMap_t&) = delete;
+    EnvMap_t& operator=(const EnvMap_t&) = delete;
+
+    // false (and map stays empty) when file can not be read or parsed
+    bool Load(const std::string& path, float scale);
+    bool Empty() const;
+
+    glm::vec3 Radiance(glm::vec3 d) const;
+    // u.x picks row and u.y column, their fractions place direction in texel; coin - alias coins
+    glm::vec3 Sample(glm::vec2 u, glm::vec2 coin) const;
+    // per unit solid angle
+    float Pdf(glm::vec3 d) const;
+private:
+    uint32_t width_ = 0, height_ = 0;
+    float scale_ = 1.f;
+
+    void* map_ = nullptr;
+    size_t map_size_ = 0;
+    // texel (x, y) is 3 floats at data_ + y * row_stride_ + 12 * x, rows may go upwards
+    const uint8_t* data_ = nullptr;
+    ptrdiff_t row_stride_ = 0;
+    std::vector<float> decoded_;
+    AliasTable_t rows_;
+    std::vector<AliasTable_t> columns_;  // per row
+
+    bool ParsePFM(const uint8_t* file, size_t size);
+    bool ParseRGBE(const uint8_t* file, size_t size);
+    glm::vec3 Texel(uint32_t x, uint32_t y) const;
+    uint32_t TexelId(glm::vec3 d) const;
+    void Unmap();
+};
+
+#endif // DEFINE_ENVMAP_H
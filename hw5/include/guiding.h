@@ -0,0 +1,98 @@
+#ifndef DEFINE_GUIDING_H
+#define DEFINE_GUIDING_H
+
+#include "bvh.h"
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include <array>
+#include <atomic>
+#include <vector>
+
+// lock-free float addition, std::atomic<float>::fetch_add is C++20
+void AtomicAdd(std::atomic<float>& target, float value);
+
+struct QUAD_NODE_t {
+    std::array<std::atomic<float>, 4> sum;
+    std::array<uint32_t, 4> child;  // 0 - quadrant is a leaf
+
+    QUAD_NODE_t();
+    QUAD_NODE_t(const QUAD_NODE_t& other);
+    QUAD_NODE_t& operator=(const QUAD_NODE_t& other);
+
+    float Total() const;
+};
+
+/*
+    Directional quadtree (Muller et al. 2017) over cylindrical coordinates
+    (cos theta, phi) of the sphere. Mapping preserves area, so
+    pdf on sphere = pdf on unit square / (4 * PI)
+*/
+class DTree_t {
+public:
+    DTree_t();
+
+    float Total() const;
+    // adds value to every quadrant containing d, safe to call from many threads
+    void Record(glm::vec3 d, float value);
+
+    glm::vec3 Sample(glm::vec2 u) const;
+    float Pdf(glm::vec3 d) const;
+
+    // empty tree for next pass: quadrants holding more than rho of energy are split
+    DTree_t Refined(float rho, uint32_t max_depth) const;
+private:
+    std::vector<QUAD_NODE_t> nodes_;
+};
+
+/*
+    Spatial octree, every leaf (region) owns two directional trees:
+    sampling - learned on previous pass, building - collects current pass
+*/
+class SDTree_t {
+public:
+    SDTree_t() {};
+    SDTree_t(const AABB_t& bounds);
+    SDTree_t(const SDTree_t& other) = delete;
+    SDTree_t& operator=(SDTree_t&& other);
+
+    // region around x has learned something to sample from
+    bool CanSample(glm::vec3 x) const;
+    glm::vec3 Sample(glm::vec2 u, glm::vec3 x) const;
+    float Pdf(glm::vec3 x, glm::vec3 d) const;
+
+    // contribution of light arriving at x from d
+    void Record(glm::vec3 x, glm::vec3 d, float value);
+
+    // ends pass number iteration: splits crowded regions, building trees become sampling ones
+    void Refine(uint32_t iteration);
+private:
+    static constexpr float kRho = 0.01f;
+    static constexpr uint32_t kMaxQuadDepth = 20;
+    static constexpr uint32_t kMaxSpatialDepth = 20;
+    static constexpr float kSplitSamples = 12000.f;
+
+    struct OCT_NODE_t {
+        std::array<uint32_t, 8> child = {};  // all 0 - leaf
+        uint32_t region = 0;
+    };
+    struct REGION_t {
+        DTree_t sampling;
+        DTree_t building;
+        std::atomic<uint32_t> n_samples{0};
+
+        REGION_t() {};
+        REGION_t(const REGION_t& other);
+    };
+
+    AABB_t bounds_;
+    std::vector<OCT_NODE_t> nodes_;
+    std::vector<REGION_t> regions_;
+
+    const REGION_t& Lookup(glm::vec3 x) const;
+    REGION_t& Lookup(glm::vec3 x);
+    void Subdivide(uint32_t v, float n_samples, float threshold, uint32_t depth);
+};
+
+#endif // DEFINE_GUIDING_H
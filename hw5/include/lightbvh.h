@@ -0,0 +1,126 @@
+#ifndef DEFINE_LIGHTBVH_H
+#define DEFINE_LIGHTBVH_H
+
+#include "bvh.h"
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/norm.hpp>
+
+#include <vector>
+#include <utility>
+
+/*
+    Bounds of emitted directions:
+    normals of the emitter lie in cone(axis, theta_o),
+    light leaves the surface in at most theta_e around its normal
+*/
+struct CONE_t {
+    glm::vec3 axis = {0.f, 0.f, 1.f};
+    float theta_o = 0.f;
+    float theta_e = 0.f;
+
+    static CONE_t Union(const CONE_t& a, const CONE_t& b);
+};
+
+struct LIGHT_BOUNDS_t {
+    AABB_t aabb;
+    CONE_t cone;
+    float power = 0.f;
+    uint32_t light_id = 0;
+
+    LIGHT_BOUNDS_t() {};
+    LIGHT_BOUNDS_t(const Primitive& prim, uint32_t light_id);
+
+    void Extend(const LIGHT_BOUNDS_t& other);
+    float Importance(glm::vec3 x, glm::vec3 n) const;
+};
+
+struct LIGHT_NODE_t {
+    LIGHT_BOUNDS_t bounds;
+    uint32_t left_child;
+    uint32_t right_child;
+};
+
+class LightBVH_t {
+public:
+    std::vector<LIGHT_NODE_t> nodes;
+
+    LightBVH_t() {};
+    LightBVH_t(std::vector<LIGHT_BOUNDS_t> lights);
+
+    bool Empty() const;
+
+    // chooses emitter by estimated contribution to point x with normal n
+    // returns {light_id, probability}
+    std::pair<uint32_t, float> Sample(float u, glm::vec3 x, glm::vec3 n) const;
+
+    // sum of P(light | x, n) * light_pdf(light_id) over emitters whose bounds are hit by ray
+    template <typename LightPdf>
+    float Pdf(const Ray& ray, glm::vec3 n, LightPdf&& light_pdf) const;
+
+    // calls visit(light_id) for every emitter whose bounds are hit by ray
+    template <typename Visit>
+    void ForEachHit(const Ray& ray, Visit&& visit) const;
+private:
+    static constexpr uint32_t kBuckets = 12;
+
+    uint32_t InitTree(std::vector<LIGHT_BOUNDS_t>& lights, uint32_t first, uint32_t last);
+    float ChildProb(uint32_t v, glm::vec3 x, glm::vec3 n) const;
+
+    template <typename LightPdf>
+    float Pdf_(const Ray& ray, glm::vec3 n, LightPdf& light_pdf, uint32_t v, float prob) const;
+};
+
+template <typename LightPdf>
+float LightBVH_t::Pdf(const Ray& ray, glm::vec3 n, LightPdf&& light_pdf) const {
+    if (Empty()) {
+        return 0.f;
+    }
+    return Pdf_(ray, n, light_pdf, 0, 1.f);
+}
+
+template <typename LightPdf>
+float LightBVH_t::Pdf_(const Ray& ray, glm::vec3 n, LightPdf& light_pdf, uint32_t v, float prob) const {
+    const LIGHT_NODE_t& cur_node = nodes[v];
+    if (!cur_node.bounds.aabb.Intersect(ray).has_value()) {
+        return 0.f;
+    }
+    if (cur_node.left_child == (uint32_t)-1) {
+        return prob * light_pdf(cur_node.bounds.light_id);
+    }
+
+    float p_left = ChildProb(v, ray.o, n);
+    float sum = 0.f;
+    if (p_left > 0.f) {
+        sum += Pdf_(ray, n, light_pdf, cur_node.left_child, prob * p_left);
+    }
+    if (p_left < 1.f) {
+        sum += Pdf_(ray, n, light_pdf, cur_node.right_child, prob * (1.f - p_left));
+    }
+    return sum;
+}
+
+template <typename Visit>
+void LightBVH_t::ForEachHit(const Ray& ray, Visit&& visit) const {
+    if (Empty()) {
+        return;
+    }
+
+    std::vector<uint32_t> stack = {0};
+    while (!stack.empty()) {
+        const LIGHT_NODE_t& cur_node = nodes[stack.back()];
+        stack.pop_back();
+
+        if (!cur_node.bounds.aabb.Intersect(ray).has_value()) {
+            continue;
+        }
+        if (cur_node.left_child == (uint32_t)-1) {
+            visit(cur_node.bounds.light_id);
+            continue;
+        }
+        stack.push_back(cur_node.right_child);
+        stack.push_back(cur_node.left_child);
+    }
+}
+
+#endif // DEFINE_LIGHTBVH_H
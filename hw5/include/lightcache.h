@@ -0,0 +1,46 @@
+#ifndef DEFINE_LIGHTCACHE_H
+#define DEFINE_LIGHTCACHE_H
+
+#include "aliastable.h"
+
+#include <glm/vec3.hpp>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/*
+    Learned emitter selection per region (importance caching, Georgiev et al. 2012).
+    Cells are keyed by CellKey, as in radiance cache. Pre-pass records probes - contributions
+    of uniformly chosen emitters with visibility, 0 when occluded; Build turns mean
+    contribution of every emitter in cell into alias table. Emitters hidden from whole
+    cell get nothing there, so callers mix the table with their own selection.
+    Record is called from many threads, every one keeps its own list of probes.
+*/
+class LightCache_t {
+public:
+    LightCache_t() {};
+    LightCache_t(float cell_size, uint32_t n_lights);
+
+    bool Empty() const;
+
+    void Record(glm::vec3 x, glm::vec3 n, uint32_t light, float contribution);
+    // cells with less than min_probes probes stay unknown, probes are freed
+    void Build(uint32_t min_probes);
+    // learned selection around x, nullptr - cell is unknown
+    const AliasTable_t* Table(glm::vec3 x, glm::vec3 n) const;
+private:
+    struct PROBE_t {
+        uint64_t key;
+        uint32_t light;
+        float contribution;
+    };
+
+    float cell_size_ = 1.f;
+    uint32_t n_lights_ = 0;
+    std::vector<std::vector<PROBE_t>> probes_;  // per thread
+    std::unordered_map<uint64_t, uint32_t> cell_of_;
+    std::vector<AliasTable_t> tables_;
+};
+
+#endif // DEFINE_LIGHTCACHE_H
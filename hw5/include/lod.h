@@ -0,0 +1,49 @@
+#ifndef DEFINE_LOD_H
+#define DEFINE_LOD_H
+
+#include "bvh.h"
+#include "primitives.h"
+
+#include <glm/vec3.hpp>
+
+#include <vector>
+
+// triangle soup, three vertices per triangle
+using SOUP_t = std::vector<glm::vec3>;
+
+/*
+    Quadric error metric simplification (Garland & Heckbert 1997). Vertices at equal positions
+    are welded, edges collapse into point of least summed squared distance to planes of faces
+    around both ends (planes weighted by face area); collapses that flip a face are skipped.
+    Returns mesh snapshot for every target triangle count, targets go down.
+*/
+std::vector<SOUP_t> SimplifyQEM(const SOUP_t& soup, const std::vector<size_t>& targets);
+
+/*
+    Triangle mesh with simplified proxies: level 0 is mesh itself (range of scene primitives),
+    level k keeps about 4^-k of its triangles. Every level has BVH of its own. Proxy triangles
+    are copies of first triangle of mesh with other vertices, their hits carry its id.
+*/
+class LodMesh_t {
+public:
+    LodMesh_t() {};
+    // primitives[first, last) - Triangles of one material, levels - most proxies
+    LodMesh_t(std::vector<Primitive>& primitives, uint32_t first, uint32_t last, unsigned int levels);
+
+    unsigned int Levels() const;
+    // coarsest level whose mean edge is at most width
+    unsigned int Level(float width) const;
+    // from p to bounds of mesh, 0 inside
+    float Distance(glm::vec3 p) const;
+    ray_intersection_t Intersect(const std::vector<Primitive>& primitives, const Ray& ray, float closest_dist,
+        unsigned int level) const;
+private:
+    uint32_t first_ = 0;
+    BVH_t bvh_;
+    std::vector<std::vector<Primitive>> proxies_;
+    std::vector<BVH_t> proxy_bvhs_;
+    std::vector<float> edge_;  // mean edge length, per level
+    AABB_t bounds_;
+};
+
+#endif // DEFINE_LOD_H
@@ -0,0 +1,64 @@
+#ifndef DEFINE_MEDIUM_H
+#define DEFINE_MEDIUM_H
+
+#include "primitives.h"
+#include "sampler.h"
+
+#include <glm/vec3.hpp>
+#include <glm/ext/vector_uint3.hpp>
+
+#include <string>
+#include <vector>
+
+// grid file: "VOL nx ny nz" line, then nx*ny*nz float32 in host byte order, x runs fastest
+bool LoadDensityGrid(const std::string& path, std::vector<float>& density, glm::uvec3& resolution);
+
+/*
+    Heterogeneous medium filling box primitive: sigma_t(x) = sigma_t * density(x), density grid
+    spans the box and is interpolated trilinearly; albedo (COLOR) is scattered share of sigma_t,
+    Henyey-Greenstein phase function with asymmetry g.
+    Majorant grid keeps max of sigma_t over bricks of kBrick^3 voxels. Delta tracking (free-flight
+    sampling) and ratio tracking (transmittance) walk bricks pierced by ray with 3D DDA and take
+    exponential steps against majorant of current brick, so empty bricks cost one step each.
+    Rays need not be normalized, distances are in units of ray parameter.
+*/
+class Medium_t {
+public:
+    Medium_t() {};
+    // empty density - homogeneous medium
+    Medium_t(const Primitive& box, std::vector<float> density, glm::uvec3 resolution);
+
+    // first real collision along ray before t_max, t_max if there is none
+    float SampleDistance(Sampler_t& sampler, const Ray& ray, float t_max) const;
+    // unbiased estimate of exp(-integral of sigma_t) over ray parameter [0, t_max]
+    float Transmittance(Sampler_t& sampler, const Ray& ray, float t_max) const;
+
+    glm::vec3 Albedo() const;
+    // density of scattering into wi for light arriving from wo side, per solid angle
+    float Phase(glm::vec3 wo, glm::vec3 wi) const;
+    // wo - direction towards previous vertex
+    glm::vec3 SamplePhase(glm::vec3 wo, glm::vec2 u) const;
+private:
+    static constexpr uint32_t kBrick = 8;
+
+    Point pos_;
+    Quaternion rotator_ = {1.f, 0.f, 0.f, 0.f};
+    glm::vec3 half_size_ = {0.f, 0.f, 0.f};
+    glm::vec3 albedo_ = {0.f, 0.f, 0.f};
+    float sigma_t_ = 0.f;
+    float g_ = 0.f;
+
+    std::vector<float> density_;
+    glm::uvec3 resolution_ = {1, 1, 1};
+    std::vector<float> majorant_;  // sigma_t, per brick
+    glm::uvec3 bricks_ = {1, 1, 1};
+
+    float SigmaT(glm::vec3 local) const;
+    // ray in box frame and its parameter range inside box, false if box is missed
+    bool Clip(const Ray& ray, float t_max, Ray& local, float& t0, float& t1) const;
+    // calls visit(t_enter, t_exit, majorant) for bricks along local ray in [t0, t1] until it returns false
+    template <class F>
+    void WalkBricks(const Ray& local, float t0, float t1, F visit) const;
+};
+
+#endif // DEFINE_MEDIUM_H
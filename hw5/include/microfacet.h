@@ -0,0 +1,53 @@
+#ifndef DEFINE_MICROFACET_H
+#define DEFINE_MICROFACET_H
+
+#include "primitives.h"
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+/*
+    Rough Metallic / Dielectric surface: GGX (Trowbridge-Reitz) microfacets with
+    isotropic alpha = roughness and height-correlated Smith masking.
+    Directions are drawn from visible normals (Heitz 2018), so Sample never picks
+    facets hidden from wo and its weight f * cos / pdf stays close to G2 / G1.
+    Transmitted radiance is not scaled by eta^2, as in smooth Dielectric, so
+    Eval takes wo on the camera side and wi on the light side whichever way path goes.
+    Metal reflects col as smooth one does, glass is tinted by col when wo is outside.
+*/
+class Microfacet_t {
+public:
+    // n faces the side ray arrived from, interior - ray is inside primitive, col - prim colour at the point
+    Microfacet_t(const Primitive& prim, glm::vec3 col, glm::vec3 n, bool interior);
+
+    // f without cosine, wo towards camera, wi towards light, both unit
+    glm::vec3 Eval(glm::vec3 wo, glm::vec3 wi) const;
+    // u_lobe picks reflection or refraction, u places visible normal; zero vector - no direction
+    glm::vec3 Sample(glm::vec3 wo, float u_lobe, glm::vec2 u) const;
+    // per unit solid angle, density of Sample(wo) returning wi
+    float Pdf(glm::vec3 wo, glm::vec3 wi) const;
+    // continues path that came from w_from: new direction and its f * cos / pdf,
+    // adjoint - path goes from light, so new direction is on camera side; false - path ends
+    bool Scatter(glm::vec3 w_from, bool adjoint, float u_lobe, glm::vec2 u, glm::vec3& dir,
+        glm::vec3& weight, float& pdf) const;
+private:
+    // local frame: z along outward normal of primitive (metal - towards arrival side)
+    glm::vec3 t_, b_, n_;
+    float alpha_;
+    float eta_;  // inside / outside
+    bool dielectric_;
+    glm::vec3 col_;
+
+    glm::vec3 ToLocal(glm::vec3 w) const;
+    glm::vec3 ToWorld(glm::vec3 w) const;
+    float D(glm::vec3 m) const;
+    float Lambda(glm::vec3 w) const;
+    // visible normal seen from wo or from -wo when it is below, always in upper hemisphere
+    glm::vec3 VisibleNormal(glm::vec3 wo, glm::vec2 u) const;
+    // density of visible normal m seen from wo
+    float PdfNormal(glm::vec3 wo, glm::vec3 m) const;
+    // Schlick, as in smooth Dielectric; cos_o - towards wo side, 1 - total internal reflection
+    float Fresnel(float cos_o) const;
+};
+
+#endif // DEFINE_MICROFACET_H
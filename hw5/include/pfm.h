@@ -0,0 +1,16 @@
+#ifndef DEFINE_PFM_H
+#define DEFINE_PFM_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// PFM in host byte order, "PF" for 3 channels, "Pf" for 1, rows go from bottom;
+// data is row-major from top row, false if file can not be written
+bool WritePFM(const std::string& path, const std::vector<float>& data, unsigned int width,
+    unsigned int height, uint8_t channels);
+// either byte order, rows are turned back to top-first
+bool ReadPFM(const std::string& path, std::vector<float>& data, unsigned int& width,
+    unsigned int& height, uint8_t& channels);
+
+#endif // DEFINE_PFM_H
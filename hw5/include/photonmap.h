@@ -0,0 +1,41 @@
+#ifndef DEFINE_PHOTONMAP_H
+#define DEFINE_PHOTONMAP_H
+
+#include <glm/vec3.hpp>
+#include <glm/ext/vector_int3.hpp>
+
+#include <cstdint>
+#include <vector>
+
+struct PHOTON_t {
+    glm::vec3 pos;
+    glm::vec3 dir;    // direction of flight when photon landed
+    glm::vec3 power;  // already divided by number of emitted photons
+};
+
+/*
+    Hash grid over photons, cell size is 2 * radius,
+    so gather visits at most 2x2x2 cells. Built in parallel by counting sort.
+*/
+class PhotonMap_t {
+public:
+    PhotonMap_t() {};
+    PhotonMap_t(std::vector<PHOTON_t>&& photons, float radius);
+
+    bool Empty() const;
+    float Radius() const;
+
+    // sum of power of photons within radius of x that landed on front side of n
+    glm::vec3 Gather(glm::vec3 x, glm::vec3 n) const;
+private:
+    float radius_ = 0.f;
+    float cell_size_ = 1.f;
+    uint32_t table_mask_ = 0;
+    std::vector<PHOTON_t> photons_;     // grouped by cell hash
+    std::vector<uint32_t> cell_start_;  // photons of hash h are [cell_start_[h], cell_start_[h + 1])
+
+    glm::ivec3 Cell(glm::vec3 x) const;
+    uint32_t Hash(glm::ivec3 cell) const;
+};
+
+#endif // DEFINE_PHOTONMAP_H
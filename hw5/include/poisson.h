@@ -0,0 +1,20 @@
+#ifndef DEFINE_POISSON_H
+#define DEFINE_POISSON_H
+
+#include <glm/vec3.hpp>
+
+#include <vector>
+
+/*
+    Screened Poisson reconstruction (Kettunen et al. 2015):
+    image I minimizing alpha^2 |I - primal|^2 + |dx I - dx|^2 + |dy I - dy|^2,
+    found by conjugate gradients per channel starting from primal.
+    Each of l1_passes then reweights terms by their residuals and solves again,
+    moving to L1 norm, which does not smear outliers of gradients over image.
+    dx[i] estimates I[i + 1] - I[i] and is ignored in last column, dy[i] - I[i + width] - I[i], ignored in last row
+*/
+std::vector<glm::vec3> ScreenedPoisson(const std::vector<glm::vec3>& primal, const std::vector<glm::vec3>& dx,
+    const std::vector<glm::vec3>& dy, unsigned int width, unsigned int height, float alpha, unsigned int iterations,
+    unsigned int l1_passes);
+
+#endif // DEFINE_POISSON_H
@@ -5,10 +5,15 @@
 #include "quaternion.h"
 #include "materials.h"
 
+#include <glm/vec2.hpp>
+
 #include <algorithm>
 #include <optional>
 #include <cmath>
 #include <iostream>
+#include <string>
+
+static const float kPI = acos(-1);
 
 enum PRIMITIVE_TYPE {
     PLANE     = (1<<0),
@@ -23,9 +28,17 @@ struct intersection_t {
     bool interior;
 };
 
+struct surface_sample_t {
+    glm::vec3 p;
+    glm::vec3 normal;
+    float pdf;  // per unit area
+};
+
 struct ray_intersection_t {
     intersection_t isec;
     int id;
+    // level of mesh proxy surface belongs to, 0 - full geometry
+    unsigned int lod = 0;
 };
 
 class Primitive {
@@ -44,6 +57,18 @@ public:
     Quaternion rotator = {1.,0.,0.,0.};
     MATERIAL material = MATERIAL::DIFFUSE;
     float ior = 0.;
+    // GGX alpha of Metallic / Dielectric, 0 - perfectly smooth
+    float roughness = 0.;
+    // Box filled with participating medium instead of solid: extinction (0 - solid box),
+    // phase function asymmetry and density grid file (empty - homogeneous), COLOR is albedo
+    float sigma_t = 0.;
+    float phase_g = 0.;
+    std::string density_grid;
+    // image texture replacing col, tiled file of maketx; texture_id is index in scene textures, -1 - none
+    std::string texture;
+    int texture_id = -1;
+    // Triangle - texture coordinates of a, b, c
+    glm::vec2 uv_a = {0.f, 0.f}, uv_b = {1.f, 0.f}, uv_c = {0.f, 1.f};
 
     /*
         Plane     - n
@@ -61,6 +86,17 @@ public:
     Primitive(PRIMITIVE_TYPE primitive_type, const Point& dop_data);
     Primitive(PRIMITIVE_TYPE triangle_type, const Point& a, const Point& b, const Point& c);
     std::optional<intersection_t> Intersect(const Ray &r) const;
+    float Area() const;
+    bool IsEmitter() const;
+    // point on Box / Ellipsoid / Triangle surface, u_face picks box face
+    surface_sample_t SampleSurface(float u_face, glm::vec2 u) const;
+    // area density of SampleSurface at point p of surface
+    float PdfSurface(glm::vec3 p) const;
+    // texture coordinates of surface point p: Triangle - interpolated, Ellipsoid - longitude and
+    // latitude, Box - face plane over [0, 1]^2, Plane - one repeat per unit of length
+    glm::vec2 SurfaceUV(glm::vec3 p) const;
+    // uv units per unit of length on surface, roughly
+    float UVDensity() const;
 };
 
 /*
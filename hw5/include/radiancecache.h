@@ -0,0 +1,54 @@
+#ifndef DEFINE_RADIANCECACHE_H
+#define DEFINE_RADIANCECACHE_H
+
+#include <glm/vec3.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// key of cell around x: position quantized to cell_size, normal rounded to one of 26 directions; never 0
+uint64_t CellKey(glm::vec3 x, glm::vec3 n, float cell_size);
+
+/*
+    World-space hash grid of outgoing diffuse radiance, keyed by
+    position quantized to cell_size and normal rounded to one of 26 directions.
+    Open addressing with linear probing, cells are claimed and updated
+    by atomics only, so any number of threads may record and look up at once;
+    lookups skip cells some record is still adding to.
+*/
+class RadianceCache_t {
+public:
+    RadianceCache_t() {};
+    RadianceCache_t(float cell_size, uint32_t table_bits);
+
+    bool Empty() const;
+
+    // adds one estimate of radiance leaving x, cell is dropped when probing fails
+    void Record(glm::vec3 x, glm::vec3 n, glm::vec3 radiance);
+    // mean of cell around x once it has min_samples estimates
+    bool Lookup(glm::vec3 x, glm::vec3 n, uint32_t min_samples, glm::vec3& radiance) const;
+private:
+    static constexpr uint32_t kMaxProbes = 8;
+
+    struct CELL_t {
+        std::atomic<uint64_t> key{0};  // 0 - free
+        std::array<std::atomic<float>, 3> sum;
+        std::atomic<uint32_t> count{0};    // records done
+        std::atomic<uint32_t> started{0};  // records begun, count once they are done
+
+        CELL_t();
+    };
+
+    float cell_size_ = 1.f;
+    uint64_t table_mask_ = 0;
+    std::vector<CELL_t> cells_;
+
+    // index of cell with key, kNone if not there
+    uint64_t Find(uint64_t key) const;
+    // index of cell with key, free one met first is claimed for it; kNone if neither is met
+    uint64_t Claim(uint64_t key);
+};
+
+#endif // DEFINE_RADIANCECACHE_H
@@ -0,0 +1,39 @@
+#ifndef DEFINE_RESTIR_H
+#define DEFINE_RESTIR_H
+
+#include <glm/vec3.hpp>
+
+#include <cstdint>
+
+// point on emitter chosen for direct lighting
+struct LIGHT_SAMPLE_t {
+    glm::vec3 p = {0.f, 0.f, 0.f};
+    glm::vec3 n = {0.f, 0.f, 0.f};
+    int prim_id = -1;
+};
+
+/*
+    Weighted reservoir of resampled importance sampling (Bitterli et al. 2020).
+    Keeps one of the streamed candidates with probability proportional to its weight;
+    W is the unbiased contribution weight of the kept one, valid after Finalize()
+*/
+struct RESERVOIR_t {
+    LIGHT_SAMPLE_t y;
+    float target = 0.f;  // target density of y at owner of reservoir
+    float w_sum = 0.f;
+    float M = 0.f;
+    float W = 0.f;
+
+    bool Update(const LIGHT_SAMPLE_t& x, float w, float x_target, float u);
+    void Finalize();
+};
+
+// reservoir at primary diffuse hit of pixel, neighbours reuse it within one pass
+struct PIXEL_RESERVOIR_t {
+    RESERVOIR_t reservoir;
+    glm::vec3 p, n, albedo;
+    float depth = 0.f;
+    unsigned int pass = -1;  // pass it was made in, -1 - none
+};
+
+#endif // DEFINE_RESTIR_H
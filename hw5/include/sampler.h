@@ -0,0 +1,98 @@
+#ifndef DEFINE_SAMPLER_H
+#define DEFINE_SAMPLER_H
+
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// counter-based generator Philox4x32-10 (Salmon et al. 2011):
+// every (counter, key) gives 4 independent words, no state to carry between calls
+glm::uvec4 Philox4x32(glm::uvec4 counter, glm::uvec2 key);
+
+enum class SAMPLER_TYPE {
+    RANDOM,      // independent values, Philox keyed by (pixel, sample, dimension)
+    SOBOL,       // Owen-scrambled Sobol, padded by shuffled 2D blocks
+    HALTON,      // Halton with per-pixel random digit scrambling
+    BLUE_NOISE,  // one Owen-scrambled Sobol for all pixels, rotated by blue-noise mask
+    MARKOV       // current state of MLT chain, not selectable in scene
+};
+
+/*
+    Point of primary sample space of one Metropolis chain (Kelemen et al. 2002).
+    Coordinates are created and mutated lazily when the integrator asks for them:
+    large step - all values are drawn anew, small step - gaussian offset with wrap-around.
+    Rejected iteration restores every coordinate it touched.
+*/
+class MLTChain_t {
+public:
+    MLTChain_t(uint32_t chain_id, float sigma, float large_step_prob);
+
+    // starts over from fresh point, same seed gives same first point
+    void Seed(uint32_t seed);
+    void StartIteration();
+    void Accept();
+    void Reject();
+
+    float Get(uint32_t dim);
+    // chain's own stream for acceptance decisions
+    float Uniform();
+private:
+    struct PRIMARY_SAMPLE_t {
+        float value = 0.f, value_backup = 0.f;
+        uint64_t modified = 0, modified_backup = 0;
+    };
+
+    uint32_t chain_id_;
+    float sigma_;
+    float large_step_prob_;
+    uint32_t seed_ = 0;
+    uint32_t primary_counter_ = 0;
+    uint32_t chain_counter_ = 0;
+
+    std::vector<PRIMARY_SAMPLE_t> x_;
+    uint64_t iteration_ = 0;
+    uint64_t last_large_step_ = 0;
+    bool large_step_ = true;
+
+    float PrimaryUniform();
+};
+
+/*
+    Source of sample values for one pixel sample.
+    Every consumer draws next dimension by Get1D / Get2D,
+    StartPixelSample resets dimension counter.
+*/
+class Sampler_t {
+public:
+    Sampler_t() {};
+    Sampler_t(SAMPLER_TYPE sampler_type);
+    Sampler_t(MLTChain_t* chain);
+
+    void StartPixelSample(uint32_t x, uint32_t y, uint32_t sample_id);
+    float Get1D();
+    glm::vec2 Get2D();
+
+    static uint32_t Hash(uint32_t x);
+    static uint32_t HashCombine(uint32_t seed, uint32_t v);
+private:
+    static constexpr uint32_t kBlueNoiseSize = 64;
+
+    SAMPLER_TYPE sampler_type_ = SAMPLER_TYPE::RANDOM;
+    uint32_t x_ = 0, y_ = 0;
+    uint32_t pixel_seed_ = 0;
+    uint32_t sample_id_ = 0;
+    uint32_t dim_ = 0;
+    MLTChain_t* chain_ = nullptr;
+
+    glm::uvec4 Random(uint32_t dim) const;
+    float SobolOwen1D(uint32_t dim, uint32_t seed) const;
+    glm::vec2 SobolOwen2D(uint32_t dim, uint32_t seed) const;
+    float Halton(uint32_t dim) const;
+    float BlueNoise(uint32_t dim) const;
+
+    static const std::vector<uint16_t>& BlueNoiseMask();
+};
+
+#endif // DEFINE_SAMPLER_H
@@ -3,17 +3,29 @@
 
 #include "distributions.h"
 #include "bvh.h"
+#include "photonmap.h"
+#include "radiancecache.h"
+#include "restir.h"
+#include "bdpt.h"
+#include "poisson.h"
+#include "microfacet.h"
+#include "denoise.h"
+#include "medium.h"
+#include "texture.h"
+#include "lod.h"
 
 #include <cmath>
 #include <cassert>
 #include <iostream>
 #include <fstream>
+#include <functional>
 #include <sstream>
 #include <string>
 #include <vector>
 #include <memory>
 #include <random>
 #include <thread>
+#include <atomic>
 
 #define COMMAND_EMPTY              0
 #define COMMAND_DIMENSIONS         1
@@ -37,7 +49,40 @@
 #define COMMAND_SAMPLES            19
 #define COMMAND_EMISSION           20
 #define COMMAND_TRIANGLE           21
+#define COMMAND_LIGHT_SAMPLING     22
+#define COMMAND_SAMPLER            23
+#define COMMAND_ADAPTIVE_SAMPLING  24
+#define COMMAND_PATH_GUIDING       25
+#define COMMAND_CAUSTICS           26
+#define COMMAND_INTEGRATOR         27
+#define COMMAND_RADIANCE_CACHE     28
+#define COMMAND_MLT                29
+#define COMMAND_RESTIR             30
+#define COMMAND_ADRRS              31
+#define COMMAND_GDPT               32
+#define COMMAND_ENVMAP             33
+#define COMMAND_ROUGHNESS          34
+#define COMMAND_LIGHT_CACHE        35
+#define COMMAND_DENOISE            36
+#define COMMAND_AOV                37
+#define COMMAND_LIGHT_BUFFERS      38
+#define COMMAND_MEDIUM             39
+#define COMMAND_TEXTURE            40
+#define COMMAND_UV                 41
+#define COMMAND_TEXTURE_CACHE      42
+#define COMMAND_ANIMATION          43
+#define COMMAND_CAMERA_KEY         44
+#define COMMAND_INDIRECT_RES       45
+#define COMMAND_RASTER             46
+#define COMMAND_LOD                47
 
+// pixels indirect light is traced at, the rest is upsampled from them
+enum class INDIRECT_RES {
+    FULL,
+    HALF,          // one pixel of every 2x2 block
+    QUARTER,       // one pixel of every 4x4 block
+    CHECKERBOARD,  // every other pixel
+};
 
 struct Camera {
     Point pos;
@@ -49,24 +94,304 @@ struct Camera {
     Camera(float fov_x0);
 
     Ray GetToRay(float x, float y) const;
+    // spread - angle between ray and rays of neighbouring pixels, from derivatives of direction
+    Ray GetToRay(float x, float y, float& spread) const;
+    // image point (in pixels) where q is seen, false if q is not in view
+    bool Project(glm::vec3 q, glm::vec2& pixel) const;
+    // area of image rectangle at unit distance along forward
+    float ImagePlaneArea() const;
+};
+
+// running mean of pixel samples, variance is tracked on luminance (Welford)
+struct PIXEL_STATS_t {
+    glm::vec3 mean = {0.f, 0.f, 0.f};
+    float lum_mean = 0.f;
+    float lum_m2 = 0.f;
+    // of linear luminance, its mean is luminance of mean
+    float radiance_m2 = 0.f;
+    uint32_t n = 0;
+
+    void Add(const Color& color);
+    // standard error of the mean divided by the mean
+    float RelativeError() const;
+    // variance of luminance of mean, as denoiser wants it
+    float MeanVariance() const;
+};
+
+// entry of visibility buffer: primitive seen at subsample (-1 - none), Triangle - weights of b and c
+struct VISIBILITY_t {
+    int id = -1;
+    glm::vec2 bary = {0.f, 0.f};
+};
+
+// state of camera path passed down RayTrace
+struct PATH_t {
+    bool after_diffuse = false;  // path has a diffuse vertex
+    bool caustic = false;        // specular vertices only since last diffuse one
+    bool fills_cache = false;    // traced in full to feed radiance cache, never reads it
+    bool after_direct = false;   // last diffuse vertex has sampled emitters, their emission is counted
+    // direct lighting of primary diffuse vertex, already resampled with neighbours
+    const RESERVOIR_t* reservoir = nullptr;
+    // weight of path up to this vertex, roulette and splitting factors included
+    glm::vec3 throughput = {1.f, 1.f, 1.f};
+    // pixel luminance estimated at first diffuse vertex, 0 - no roulette and splitting
+    float pixel_estimate = 0.f;
+    // light buffers of pixel: path weight per unit emission of every emitter, background radiance last
+    glm::vec3* light_sums = nullptr;
+    // ray cone for texture filtering: width at ray origin, angle it grows by (primary rays' one all the way)
+    float cone_width = 0.f;
+    float cone_spread = 0.f;
+    // preview split at first diffuse vertex: direct pass takes light its continuation finds at the next
+    // vertex (and everything before it), indirect pass only light that bounces further
+    bool direct_only = false;
+    bool indirect_only = false;
+    // first intersection of ray, known from visibility buffer; nullptr - ray is traced
+    const ray_intersection_t* hit = nullptr;
+    // angle cones of diffuse rays grow by, picks mesh proxies; 0 - full meshes (camera and specular rays)
+    float lod_spread = 0.f;
+    // level of proxy this vertex lies on, rays leaving it see meshes no finer (finer surface may be just above)
+    unsigned int lod_min = 0;
 };
 
 class Scene {
 private:
     static constexpr float eps = 1e-4;
+    static constexpr uint32_t cache_min_samples = 16;
+    // every cache_fill_period-th sample of pixel feeds radiance cache
+    static constexpr uint32_t cache_fill_period = 4;
     BVH_t scene_bvh;
+    SDTree_t guide;
+    bool guide_training = false;
+
+    // emitters by power, photons start from them
+    std::vector<uint32_t> emitters;
+    AliasTable_t emitter_table;
+    // caustic paths (diffuse - specular+ - emitter) are taken from map when it is in use
+    PhotonMap_t caustic_map;
+    bool use_caustic_map = false;
+    float photon_radius2 = 0.f;
+
+    // diffuse vertices at bounce cache_bounces end path with cached radiance once cell is filled
+    // (entry is tail of fixed remaining depth, deeper vertices would count some bounces twice)
+    RadianceCache_t radiance_cache;
+
+    // index in emitters by primitive id, -1 for the rest
+    std::vector<int> emitter_of;
+    // contributions that land on arbitrary pixel (BDPT light tracing, MLT), rgb per pixel
+    std::vector<std::atomic<float>> splats;
+    void Splat(glm::vec2 pixel, glm::vec3 value);
+
+    // triangle meshes with simplified proxies, they are kept out of scene_bvh
+    std::vector<LodMesh_t> lod_meshes;
+    // lod_spread > 0: every mesh is seen at proxy its triangles' size fits cone width at, lod_min at least
+    ray_intersection_t RayIntersection(const Ray& ray, float lod_spread = 0.f, unsigned int lod_min = 0) const;
+
+    // image textures by texture_id of primitives, tiles of all of them share one cache
+    std::vector<std::unique_ptr<Texture_t>> textures;
+    std::unique_ptr<TextureCache_t> texture_cache;
+    void InitTextures();
+    // col of primitive at p, footprint - width of lookup area on surface
+    glm::vec3 Albedo(size_t id, glm::vec3 p, float footprint) const;
+    // width on surface of cone that travelled t along ray
+    float ConeFootprint(const Ray& ray, float t, glm::vec3 normal, float cone_width, float cone_spread) const;
+    // radiance of rays leaving scene
+    glm::vec3 Background(glm::vec3 d) const;
+    std::vector<uint32_t> samples_used;
 
-    ray_intersection_t RayIntersection(const Ray& ray) const;
-    Color Sample(RANDOM_t& random, unsigned int x, unsigned int y);
-    Color RayTrace(RANDOM_t& random, const Ray& ray, size_t ost_raydepth);
+    // primary visibility rasterized at raster_subsamples^2 points per pixel, row-major over subsamples
+    std::vector<VISIBILITY_t> visibility;
+    void RasterizeVisibility();
+    // camera ray through image point, sets cone of path; with visibility buffer point moves to centre
+    // of its subsample and path takes hit stored there
+    Ray PrimaryRay(glm::vec2 pixel, PATH_t& path, ray_intersection_t& hit) const;
+
+    // image point of pixel sample, starts sample's sequence
+    glm::vec2 PixelSample(RANDOM_t& random, unsigned int x, unsigned int y, unsigned int sample_id);
+    Color Sample(RANDOM_t& random, unsigned int x, unsigned int y, unsigned int sample_id,
+        const RESERVOIR_t* reservoir = nullptr);
+    Color RayTrace(RANDOM_t& random, const Ray& ray, size_t ost_raydepth, PATH_t path = {});
+    // spp samples of every pixel with ids from sample_offset on, per_sample(random, x, y, sample_id) runs in parallel;
+    // pre-passes take offsets apart from each other's and final render's, so none repeats sequence elements of another
+    void PrePass(unsigned int sample_offset, unsigned int spp,
+        const std::function<void(RANDOM_t&, unsigned int, unsigned int, unsigned int)>& per_sample);
 
     void InitDistribution();
     void InitBVH();
+    void TrainGuide();
+    void EmitPhotons(unsigned int pass);
+    void TracePhoton(RANDOM_t& random, std::vector<PHOTON_t>& photons);
+
+    // resampled direct lighting
+    std::vector<PIXEL_RESERVOIR_t> pixel_reservoirs;
+    // unshadowed contribution of y to outgoing light at p: f * Le * G
+    glm::vec3 Unshadowed(const LIGHT_SAMPLE_t& y, glm::vec3 p, glm::vec3 n, glm::vec3 albedo) const;
+    float TargetPdf(const LIGHT_SAMPLE_t& y, glm::vec3 p, glm::vec3 n, glm::vec3 albedo) const;
+    RESERVOIR_t SampleLights(RANDOM_t& random, glm::vec3 p, glm::vec3 n, glm::vec3 albedo);
+    // albedo * Le * weight, weight = G / PI * W * transmittance; shadow ray sees meshes as continuation
+    // of path from p does (lod_spread, lod_min as in RayIntersection)
+    glm::vec3 ShadeReservoir(RANDOM_t& random, const RESERVOIR_t& r, glm::vec3 p, glm::vec3 n, glm::vec3 albedo,
+        float lod_spread, unsigned int lod_min, float& weight) const;
+    void PrepareReservoirs(unsigned int pass, const std::vector<unsigned int>& active,
+        const std::vector<PIXEL_STATS_t>& stats);
+    bool ReuseReservoirs(unsigned int x, unsigned int y, unsigned int pass, unsigned int sample_id, RESERVOIR_t& r) const;
+
+    // emitter selection learned by pre-pass, diffuse vertices probe emitters with shadow rays
+    LightCache_t light_cache;
+    bool light_cache_training = false;
+    void TrainLightCache();
+    void ProbeLights(RANDOM_t& random, glm::vec3 x, glm::vec3 n, float lod_spread, unsigned int lod_min);
+
+    // adjoint-driven roulette and splitting, radiance leaving diffuse vertices is learned by pre-pass
+    RadianceCache_t adjoint_cache;
+    bool adjoint_training = false;
+    void TrainAdjoint();
+    // number of paths continued from diffuse vertex (0 - terminated), scale is weight of each;
+    // first diffuse vertex only sets pixel_estimate for the rest of path
+    unsigned int Continuations(RANDOM_t& random, const PATH_t& path, glm::vec3 p, glm::vec3 n, glm::vec3 emission,
+        float& pixel_estimate, float& scale) const;
+
+    // participating media, taken out of primitives; RayTrace and BDPT subpaths scatter at their real collisions
+    std::vector<Medium_t> media;
+    void InitMedia();
+    // nearest real collision of all media before t_max (delta tracking), -1 if ray passes them
+    int SampleMedia(RANDOM_t& random, const Ray& ray, float t_max, float& t) const;
+    // estimate of light share going from a to b: 0 if surface is in the way, media by ratio tracking
+    float Transmittance(RANDOM_t& random, glm::vec3 a, glm::vec3 b, float lod_spread = 0.f,
+        unsigned int lod_min = 0) const;
+    // collision in medium: one direction from phase function or emitters, weighted as in RoughBounce
+    glm::vec3 MediumBounce(RANDOM_t& random, const Ray& ray, glm::vec3 x, size_t medium, size_t ost_raydepth,
+        const PATH_t& path);
+
+    // rough Metallic / Dielectric vertex: one direction from visible normals or emitters,
+    // weighted by balance heuristic of both densities
+    glm::vec3 RoughBounce(RANDOM_t& random, const Ray& ray, glm::vec3 p, glm::vec3 normal, bool interior, size_t id,
+        glm::vec3 col, size_t ost_raydepth, const PATH_t& path);
+
+    // first-hit albedo, normal and depth averaged over a few points of every pixel
+    std::vector<AOV_t> RenderAOVs() const;
+    void WriteAOVs(const std::vector<AOV_t>& aovs) const;
+
+    // light buffers: emissive primitives, buffer index by primitive id (-1 for the rest),
+    // separated.size() + 1 sums per pixel, divided by samples when written
+    std::vector<uint32_t> separated;
+    std::vector<int> separated_of;
+    std::vector<glm::vec3> light_buffers;
+    void InitLightBuffers();
+    void WriteLightBuffers(const std::vector<PIXEL_STATS_t>& stats) const;
+
+    // temporal accumulation of animation: radiance of last frame, samples behind every pixel
+    // (capped at history_max) and first hits it saw from history_cam
+    std::vector<glm::vec3> history;
+    std::vector<float> history_n;
+    std::vector<AOV_t> history_aovs;
+    Camera history_cam;
+    Camera first_cam;
+    // added to sample ids, frames do not repeat samples of each other
+    unsigned int frame_sample_offset = 0;
+    void SetFrameCamera(unsigned int frame);
+    // reprojects history into current camera by first-hit depth, blends it into image where
+    // the same surface is seen and keeps result as new history; returns share of this frame's
+    // samples in every pixel
+    std::vector<float> AccumulateHistory(std::vector<glm::vec3>& image, const std::vector<PIXEL_STATS_t>& stats,
+        const std::vector<AOV_t>& aovs);
+
+    // pixel samples of main passes trace direct part only, indirect one is left to RenderIndirect
+    bool split_indirect = false;
+    // traces indirect light at pixels of indirect_res, upsamples it guided by first hits and adds to image
+    void RenderIndirect(std::vector<glm::vec3>& image, const std::vector<AOV_t>& aovs);
+
+    // gradient-domain path tracing, fills means of stats with reconstructed image
+    void RenderGDPT(std::vector<PIXEL_STATS_t>& stats);
+
+    // MLT, returns scale of splats
+    float RenderMLT();
+    Color SampleMLT(RANDOM_t& random, glm::vec2& pixel);
+
+    // BDPT
+    Color SampleBDPT(RANDOM_t& random, float fx, float fy);
+    void RandomWalk(RANDOM_t& random, Ray ray, glm::vec3 beta, float pdf_dir, unsigned int max_vertices,
+        std::vector<BDPT_VERTEX_t>& path, glm::vec3& escaped);
+    glm::vec3 ConnectBDPT(RANDOM_t& random, std::vector<BDPT_VERTEX_t>& camera_path,
+        std::vector<BDPT_VERTEX_t>& light_path, unsigned int s, unsigned int t);
+    float MISWeight(const std::vector<BDPT_VERTEX_t>& camera_path, const std::vector<BDPT_VERTEX_t>& light_path,
+        const BDPT_VERTEX_t& sampled, unsigned int s, unsigned int t) const;
+    BDPT_VERTEX_t SampleLightVertex(RANDOM_t& random) const;
+    // w_camera / w_light - towards neighbours on camera / light side, whichever subpath v belongs to
+    glm::vec3 VertexBsdf(const BDPT_VERTEX_t& v, glm::vec3 w_camera, glm::vec3 w_light) const;
+    glm::vec3 VertexEmission(const BDPT_VERTEX_t& v, glm::vec3 w) const;
+    float VertexPdf(const BDPT_VERTEX_t* prev, const BDPT_VERTEX_t& v, const BDPT_VERTEX_t& next) const;
+    float PdfLightOrigin(const BDPT_VERTEX_t& v) const;
+    float PdfLightDir(const BDPT_VERTEX_t& v, const BDPT_VERTEX_t& next) const;
+    // mesh proxies are picked as in RayIntersection
+    bool Visible(glm::vec3 a, glm::vec3 b, float lod_spread = 0.f, unsigned int lod_min = 0) const;
 public:
     unsigned int ray_depth;
     unsigned int samples;
+    // adaptive sampling: every pixel gets min_samples, then refined by batches
+    // of min_samples while relative error > adaptive_threshold (0 - disabled)
+    unsigned int min_samples = 0;
+    float adaptive_threshold = 0.f;
+    // training passes of path guiding before render, pass k traces 2^k samples per pixel
+    unsigned int guiding_passes = 0;
+    // photon mapped caustics: photons per pass, initial gather radius, passes over SAMPLES
+    unsigned int caustic_photons = 0;
+    float caustic_radius = 0.f;
+    unsigned int caustic_passes = 1;
+    // radiance cache: cell size (0 - disabled), bounces traced before lookups start
+    float cache_cell = 0.f;
+    unsigned int cache_bounces = 2;
+    // PSSMLT: paths of normalization pass, Markov chains, probability of large step
+    unsigned int mlt_bootstrap = 100000;
+    unsigned int mlt_chains = 1000;
+    float mlt_large_step = 0.3f;
+    // resampled direct lighting at diffuse vertices: candidates per vertex (0 - disabled),
+    // neighbours of primary hit to reuse (forces one sample per pass) and their radius in pixels
+    unsigned int restir_candidates = 0;
+    unsigned int restir_neighbours = 0;
+    float restir_radius = 10.f;
+    // adjoint-driven roulette and splitting: pre-pass samples per pixel (0 - disabled),
+    // cell of its radiance estimate, most paths one diffuse vertex is split into
+    unsigned int adrrs_samples = 0;
+    float adrrs_cell = 0.f;
+    unsigned int adrrs_max_split = 4;
+    // gradient-domain reconstruction: weight of primal image, conjugate gradient iterations per solve,
+    // reweighted solves towards L1 (0 - plain L2)
+    float gdpt_alpha = 0.2f;
+    unsigned int gdpt_iterations = 50;
+    unsigned int gdpt_l1_passes = 5;
+    // light cache: cell size (0 - disabled), pre-pass samples per pixel, emitters probed per diffuse vertex
+    float light_cache_cell = 0.f;
+    unsigned int light_cache_samples = 4;
+    unsigned int light_cache_probes = 8;
+    // a-trous denoiser guided by first-hit buffers: iterations (0 - disabled), luminance tolerance in deviations
+    unsigned int denoise_iterations = 0;
+    float denoise_sigma = 4.f;
+    // first-hit buffers are written to <aov_prefix>albedo.pfm, normal.pfm and depth.pfm; empty - not written
+    std::string aov_prefix;
+    // buffers of every emitter and background are written to <light_buffer_prefix>light<k>.pfm,
+    // background.pfm and listed in lights.txt; empty - not separated
+    std::string light_buffer_prefix;
+    // memory of texture tiles, megabytes
+    float texture_cache_mb = 256.f;
+    // animation: frames (0 - single image), most samples history of pixel may stand for (0 - 8 * samples);
+    // camera moves through keys (position, forward) evenly, starting from camera of scene
+    unsigned int animation_frames = 0;
+    unsigned int history_max = 0;
+    std::vector<std::pair<Point, Point>> camera_keys;
+    // preview: indirect light of first diffuse vertex at fewer pixels (paths only, no caustics and radiance cache)
+    INDIRECT_RES indirect_res = INDIRECT_RES::FULL;
+    // mesh proxies: most per mesh (0 - disabled), cone angle diffuse rays add per bounce
+    unsigned int lod_levels = 0;
+    float lod_angle = 0.1f;
+    // primary hits of path samples from rasterized visibility buffer: subsamples per pixel side (0 - rays are traced)
+    unsigned int raster_subsamples = 0;
+    LIGHT_SAMPLING light_sampling = LIGHT_SAMPLING::BVH;
+    SAMPLER_TYPE sampler_type = SAMPLER_TYPE::RANDOM;
+    INTEGRATOR integrator = INTEGRATOR::PATH;
 
     Color background;
+    // replaces background when loaded
+    EnvMap_t envmap;
     Camera cam;
     Distribution mix_distrib;
     std::vector<Primitive> primitives;
@@ -77,6 +402,10 @@ public:
     // have to be called after Load()
     void InitScene();
     void Render(std::ostream &out);
+    // frames go to <prefix>0000.ppm, <prefix>0001.ppm, ...
+    void RenderAnimation(const std::string& prefix);
+    // grayscale map of samples spent per pixel, valid after Render()
+    void WriteSamplesMap(std::ostream &out) const;
 };
 
 #endif // DEFINE_SCENE_H
\ No newline at end of file
@@ -0,0 +1,85 @@
+#ifndef DEFINE_TEXTURE_H
+#define DEFINE_TEXTURE_H
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// texels of one tile, row-major
+using TILE_t = std::vector<glm::vec3>;
+
+/*
+    Tiles of all textures of scene in at most max_bytes (besides tiles callers still hold).
+    Keys are spread over shards, every shard has its own mutex, LRU list and share of budget,
+    so render threads rarely wait for each other; least recently used tile of shard is evicted
+    first, newest one stays even over its share (budgets below kShards tiles hold kShards).
+    Tiles are shared_ptr, so eviction never frees tile some thread reads. Disk reads happen
+    outside locks, two threads missing the same tile may both read it, first inserted copy wins.
+*/
+class TextureCache_t {
+public:
+    TextureCache_t(size_t max_bytes);
+
+    std::shared_ptr<const TILE_t> Tile(uint64_t key, const std::function<TILE_t()>& load);
+    uint64_t Misses() const;
+    uint64_t Lookups() const;
+private:
+    static constexpr size_t kShards = 16;
+
+    struct ENTRY_t {
+        std::shared_ptr<const TILE_t> tile;
+        std::list<uint64_t>::iterator lru;
+    };
+    // own cache line, neighbouring shards' locks do not share it
+    struct alignas(64) SHARD_t {
+        mutable std::mutex mutex;
+        size_t bytes = 0;
+        std::unordered_map<uint64_t, ENTRY_t> entries;
+        std::list<uint64_t> lru;  // most recent first
+        uint64_t misses = 0, lookups = 0;
+    };
+
+    size_t shard_bytes_;
+    SHARD_t shards_[kShards];
+};
+
+/*
+    Tiled mip-mapped texture, only header is read on Open, tiles come through cache.
+    File is opened again for every tile read, so scenes with many textures keep no
+    descriptors open.
+    File (written by maketx): "TX width height tile levels" line, then tiles of level 0,
+    1, ... row by row, every tile is tile^2 RGB float32 texels in host byte order, padded
+    at right and bottom borders; level l is max(1, size >> l).
+    Lookups wrap around (repeat) and blend two levels around footprint (trilinear).
+*/
+class Texture_t {
+public:
+    Texture_t() {};
+
+    // id makes tile keys of this texture, false if file can not be read
+    bool Open(const std::string& path, uint16_t id);
+    // footprint - width of lookup area in uv units, 0 - finest level
+    glm::vec3 Sample(TextureCache_t& cache, glm::vec2 uv, float footprint) const;
+private:
+    std::string path_;
+    uint16_t id_ = 0;
+    uint32_t width_ = 0, height_ = 0;
+    uint32_t tile_ = 0, levels_ = 0;
+    // per level: file offset of first tile, size in texels and tiles per row
+    std::vector<uint64_t> offset_;
+    std::vector<uint32_t> level_width_, level_height_, tiles_x_;
+
+    TILE_t LoadTile(uint32_t level, uint32_t tx, uint32_t ty) const;
+    glm::vec3 Bilinear(TextureCache_t& cache, uint32_t level, glm::vec2 uv) const;
+};
+
+#endif // DEFINE_TEXTURE_H
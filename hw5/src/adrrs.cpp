@@ -0,0 +1,67 @@
+#include "scene.h"
+
+#include <algorithm>
+#include <cmath>
+
+void Scene::TrainAdjoint() {
+    if (adrrs_samples == 0 || adrrs_cell <= 0.f || integrator != INTEGRATOR::PATH) {
+        return;
+    }
+
+    static constexpr uint32_t adjoint_table_bits = 20;
+    static constexpr unsigned int sample_offset = 1U << 25;
+
+    adjoint_cache = RadianceCache_t(adrrs_cell, adjoint_table_bits);
+
+    // full paths, every diffuse vertex records what leaves it
+    adjoint_training = true;
+    PrePass(sample_offset, adrrs_samples,
+        [this](RANDOM_t& random, unsigned int x, unsigned int y, unsigned int sample_id) {
+            Sample(random, x, y, sample_id);
+        });
+    adjoint_training = false;
+    std::cout << "ADRRS: pre-pass done\n";
+}
+
+unsigned int Scene::Continuations(RANDOM_t& random, const PATH_t& path, glm::vec3 p, glm::vec3 n, glm::vec3 emission,
+        float& pixel_estimate, float& scale) const {
+    // weight window around expected contribution equal to pixel estimate,
+    // upper bound is window times lower one (Vorba & Krivanek 2016)
+    static constexpr float window = 5.f;
+    static constexpr float min_survival = 0.05f;
+    static constexpr uint32_t adjoint_min_samples = 4;
+
+    scale = 1.f;
+    glm::vec3 radiance;
+    if (adjoint_cache.Empty() || adjoint_training || !adjoint_cache.Lookup(p, n, adjoint_min_samples, radiance)) {
+        return 1;
+    }
+    if (!path.after_diffuse) {
+        // pixel value is taken from the same cache as vertex estimates below,
+        // so their ratio does not carry noise of a separate pixel estimate
+        pixel_estimate = Luminance(Color{path.throughput * (emission + radiance)});
+        return 1;
+    }
+    if (pixel_estimate <= 0.f) {
+        return 1;
+    }
+
+    float ratio = Luminance(Color{path.throughput * radiance}) / pixel_estimate;
+    float lower = 2.f / (1.f + window);
+    float upper = window * lower;
+    if (ratio < lower) {
+        // window center is 1, survivors are brought back to it
+        float survival = std::max(ratio, min_survival);
+        if (random.sampler.Get1D() >= survival) {
+            return 0;
+        }
+        scale = 1.f / survival;
+        return 1;
+    }
+    if (ratio > upper) {
+        unsigned int n_split = std::min<unsigned int>(std::ceil(ratio / upper), adrrs_max_split);
+        scale = 1.f / n_split;
+        return n_split;
+    }
+    return 1;
+}
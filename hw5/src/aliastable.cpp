@@ -0,0 +1,87 @@
+#include "aliastable.h"
+
+#include <algorithm>
+#include <cassert>
+
+AliasTable_t::AliasTable_t(const std::vector<float>& weights) {
+    uint32_t n = weights.size();
+    if (n == 0) {
+        return;
+    }
+
+    double sum = 0.;
+    for (float w : weights) {
+        assert(w >= 0.f);
+        sum += w;
+    }
+
+    bins_.resize(n);
+    std::vector<double> scaled(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        // all-zero weights => uniform
+        bins_[i].pmf = (sum > 0. ? weights[i] / sum : 1. / n);
+        scaled[i] = (double)bins_[i].pmf * n;
+    }
+
+    std::vector<uint32_t> small, large;
+    for (uint32_t i = 0; i < n; ++i) {
+        (scaled[i] < 1. ? small : large).push_back(i);
+    }
+
+    while (!small.empty() && !large.empty()) {
+        uint32_t s = small.back(); small.pop_back();
+        uint32_t l = large.back(); large.pop_back();
+
+        bins_[s].q = scaled[s];
+        bins_[s].alias = l;
+
+        scaled[l] -= 1. - scaled[s];
+        (scaled[l] < 1. ? small : large).push_back(l);
+    }
+    // leftovers are 1 up to rounding
+    for (uint32_t i : small) {
+        bins_[i].q = 1.f;
+        bins_[i].alias = i;
+    }
+    for (uint32_t i : large) {
+        bins_[i].q = 1.f;
+        bins_[i].alias = i;
+    }
+}
+
+bool AliasTable_t::Empty() const {
+    return bins_.empty();
+}
+
+uint32_t AliasTable_t::Size() const {
+    return bins_.size();
+}
+
+std::pair<uint32_t, float> AliasTable_t::Sample(float u) const {
+    assert(!Empty());
+
+    uint32_t n = bins_.size();
+    double scaled = (double)u * n;
+    uint32_t id = std::min((uint32_t)scaled, n - 1);
+    float up = std::min((float)(scaled - id), 0.99999994f);
+
+    if (up >= bins_[id].q) {
+        id = bins_[id].alias;
+    }
+    return {id, bins_[id].pmf};
+}
+
+std::pair<uint32_t, float> AliasTable_t::Sample(float u, float coin) const {
+    assert(!Empty());
+
+    uint32_t n = bins_.size();
+    uint32_t id = std::min((uint32_t)((double)u * n), n - 1);
+    if (coin >= bins_[id].q) {
+        id = bins_[id].alias;
+    }
+    return {id, bins_[id].pmf};
+}
+
+float AliasTable_t::Pmf(uint32_t id) const {
+    return bins_[id].pmf;
+}
@@ -0,0 +1,120 @@
+#include "scene.h"
+#include "pfm.h"
+
+#include <glm/geometric.hpp>
+
+
+std::vector<AOV_t> Scene::RenderAOVs() const {
+    // fixed 2x2 grid of points per pixel, buffers must not be noisy themselves
+    static constexpr uint8_t grid = 2;
+
+    unsigned int n_pixels = cam.width * cam.height;
+    std::vector<AOV_t> aovs(n_pixels);
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (unsigned int i = 0; i < n_pixels; ++i) {
+        unsigned int x = i % cam.width, y = i / cam.width;
+        AOV_t& aov = aovs[i];
+        for (uint8_t k = 0; k < grid * grid; ++k) {
+            float spread;
+            Ray ray = cam.GetToRay(x + (k % grid + 0.5f) / grid, y + (k / grid + 0.5f) / grid, spread);
+            auto raytrace = RayIntersection(ray);
+            if (raytrace.id == -1) {
+                continue;
+            }
+            auto [t, normal, _] = raytrace.isec;
+            aov.albedo += Albedo(raytrace.id, ray.o + t * ray.d, ConeFootprint(ray, t, normal, 0.f, spread));
+            aov.normal += normal;
+            aov.depth += t * glm::dot(ray.d, cam.forward);
+        }
+        aov.albedo /= (float)(grid * grid);
+        aov.depth /= (float)(grid * grid);
+        if (glm::dot(aov.normal, aov.normal) > 0.f) {
+            aov.normal = glm::normalize(aov.normal);
+        }
+    }
+    return aovs;
+}
+
+void Scene::WriteAOVs(const std::vector<AOV_t>& aovs) const {
+    std::vector<float> albedo, normal, depth;
+    albedo.reserve(3 * aovs.size());
+    normal.reserve(3 * aovs.size());
+    depth.reserve(aovs.size());
+    for (const AOV_t& aov : aovs) {
+        for (uint8_t c = 0; c < 3; ++c) {
+            albedo.push_back(aov.albedo[c]);
+            normal.push_back(aov.normal[c]);
+        }
+        depth.push_back(aov.depth);
+    }
+    bool written = WritePFM(aov_prefix + "albedo.pfm", albedo, cam.width, cam.height, 3) &&
+                   WritePFM(aov_prefix + "normal.pfm", normal, cam.width, cam.height, 3) &&
+                   WritePFM(aov_prefix + "depth.pfm", depth, cam.width, cam.height, 1);
+    if (!written) {
+        std::cerr << "unexpected aov files(" << aov_prefix << ")" << std::endl;
+    }
+}
+
+static const char* PrimitiveName(PRIMITIVE_TYPE type) {
+    switch (type) {
+    case PRIMITIVE_TYPE::PLANE:     return "PLANE";
+    case PRIMITIVE_TYPE::BOX:       return "BOX";
+    case PRIMITIVE_TYPE::ELLIPSOID: return "ELLIPSOID";
+    case PRIMITIVE_TYPE::TRIANGLE:  return "TRIANGLE";
+    }
+    return "UNKNOWN";
+}
+
+void Scene::InitLightBuffers() {
+    separated.clear();
+    separated_of.assign(primitives.size(), -1);
+    light_buffers.clear();
+    if (light_buffer_prefix.empty()) {
+        return;
+    }
+    // emissive planes are not in emitters, yet camera paths see them
+    for (uint32_t id = 0; id < primitives.size(); ++id) {
+        if (primitives[id].IsEmitter()) {
+            separated_of[id] = separated.size();
+            separated.push_back(id);
+        }
+    }
+    light_buffers.assign((size_t)cam.width * cam.height * (separated.size() + 1), glm::vec3(0.f));
+}
+
+void Scene::WriteLightBuffers(const std::vector<PIXEL_STATS_t>& stats) const {
+    std::ofstream manifest(light_buffer_prefix + "lights.txt");
+    if (!manifest) {
+        std::cerr << "unexpected light buffers file(" << light_buffer_prefix << "lights.txt)" << std::endl;
+        return;
+    }
+    manifest << "# " << cam.width << "x" << cam.height << " image = sum of buffer * emission, "
+             << "background buffer holds radiance and is scaled\n";
+
+    size_t n_buffers = separated.size() + 1;
+    unsigned int n_pixels = cam.width * cam.height;
+    std::vector<float> data(3 * n_pixels);
+    for (size_t k = 0; k < n_buffers; ++k) {
+        for (unsigned int i = 0; i < n_pixels; ++i) {
+            glm::vec3 value = light_buffers[i * n_buffers + k] / (float)std::max(stats[i].n, 1U);
+            for (uint8_t c = 0; c < 3; ++c) {
+                data[3 * i + c] = value[c];
+            }
+        }
+        std::string name = (k < separated.size() ? "light" + std::to_string(k) + ".pfm" : "background.pfm");
+        if (!WritePFM(light_buffer_prefix + name, data, cam.width, cam.height, 3)) {
+            std::cerr << "unexpected light buffers file(" << light_buffer_prefix + name << ")" << std::endl;
+            return;
+        }
+
+        // primitives are reordered by InitScene, type and position tell which one it is
+        if (k < separated.size()) {
+            const Primitive& prim = primitives[separated[k]];
+            glm::vec3 e = prim.emission.rgb;
+            manifest << name << " " << e.x << " " << e.y << " " << e.z << " "
+                     << PrimitiveName(prim.primitive_type) << " " << prim.pos.x << " " << prim.pos.y << " " << prim.pos.z << "\n";
+        } else {
+            manifest << name << " 1 1 1\n";
+        }
+    }
+}
@@ -0,0 +1,482 @@
+#include "scene.h"
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/norm.hpp>
+
+#include <algorithm>
+
+// pdf per unit solid angle at v -> per unit area at next
+static float ConvertDensity(float pdf_dir, const BDPT_VERTEX_t& v, const BDPT_VERTEX_t& next) {
+    glm::vec3 w = next.p - v.p;
+    float dist2 = glm::length2(w);
+    if (dist2 == 0.f) {
+        return 0.f;
+    }
+    if (next.type != VERTEX_TYPE::CAMERA && next.type != VERTEX_TYPE::MEDIUM) {
+        pdf_dir *= std::abs(glm::dot(next.n, w)) / std::sqrt(dist2);
+    }
+    return pdf_dir / dist2;
+}
+
+// cosine of geometry term at v, medium vertices have none
+static float AbsCos(const BDPT_VERTEX_t& v, glm::vec3 w) {
+    return (v.type == VERTEX_TYPE::MEDIUM ? 1.f : std::abs(glm::dot(v.n, w)));
+}
+
+static float Remap0(float x) {
+    return (x != 0.f ? x : 1.f);
+}
+
+//////////////
+// VERTICES //
+//////////////
+
+BDPT_VERTEX_t Scene::SampleLightVertex(RANDOM_t& random) const {
+    auto [light, pmf] = emitter_table.Sample(random.sampler.Get1D());
+    uint32_t id = emitters[light];
+    float u_face = random.sampler.Get1D();
+    surface_sample_t point = primitives[id].SampleSurface(u_face, random.sampler.Get2D());
+
+    BDPT_VERTEX_t v;
+    v.type = VERTEX_TYPE::LIGHT;
+    v.p = point.p;
+    v.n = point.normal;
+    v.prim_id = id;
+    v.pdf_fwd = pmf * point.pdf;
+    // emission itself is applied by VertexEmission
+    v.beta = glm::vec3(1.f / v.pdf_fwd);
+    return v;
+}
+
+glm::vec3 Scene::VertexBsdf(const BDPT_VERTEX_t& v, glm::vec3 w_camera, glm::vec3 w_light) const {
+    if (v.type == VERTEX_TYPE::MEDIUM) {
+        // delta tracking reached v with weight 1, so scattered share comes here
+        const Medium_t& m = media[v.medium];
+        return m.Albedo() * m.Phase(glm::normalize(w_camera), glm::normalize(w_light));
+    }
+    if (v.type != VERTEX_TYPE::SURFACE || v.delta) {
+        return {0.f, 0.f, 0.f};
+    }
+    const Primitive& prim = primitives[v.prim_id];
+    if (prim.material != MATERIAL::DIFFUSE) {
+        // smooth ones are delta, so this one is rough
+        return Microfacet_t(prim, Albedo(v.prim_id, v.p, 0.f), v.n, v.interior).Eval(glm::normalize(w_camera),
+            glm::normalize(w_light));
+    }
+    // diffuse surfaces do not transmit
+    if (glm::dot(v.n, w_camera) <= 0.f || glm::dot(v.n, w_light) <= 0.f) {
+        return {0.f, 0.f, 0.f};
+    }
+    return Albedo(v.prim_id, v.p, 0.f) / kPI;
+}
+
+glm::vec3 Scene::VertexEmission(const BDPT_VERTEX_t& v, glm::vec3 w) const {
+    if (v.prim_id == -1 || emitter_of[v.prim_id] == -1) {
+        return {0.f, 0.f, 0.f};
+    }
+    // triangles shine on both sides
+    const Primitive& prim = primitives[v.prim_id];
+    if (prim.primitive_type != PRIMITIVE_TYPE::TRIANGLE && glm::dot(v.n, w) <= 0.f) {
+        return {0.f, 0.f, 0.f};
+    }
+    return prim.emission.rgb;
+}
+
+float Scene::PdfLightOrigin(const BDPT_VERTEX_t& v) const {
+    if (v.prim_id == -1 || emitter_of[v.prim_id] == -1) {
+        return 0.f;
+    }
+    return emitter_table.Pmf(emitter_of[v.prim_id]) * primitives[v.prim_id].PdfSurface(v.p);
+}
+
+float Scene::PdfLightDir(const BDPT_VERTEX_t& v, const BDPT_VERTEX_t& next) const {
+    if (v.prim_id == -1 || emitter_of[v.prim_id] == -1) {
+        return 0.f;
+    }
+    float cos = glm::dot(v.n, glm::normalize(next.p - v.p));
+    float pdf_dir;
+    if (primitives[v.prim_id].primitive_type == PRIMITIVE_TYPE::TRIANGLE) {
+        pdf_dir = 0.5f * std::abs(cos) / kPI;
+    } else {
+        pdf_dir = std::max(cos, 0.f) / kPI;
+    }
+    return ConvertDensity(pdf_dir, v, next);
+}
+
+float Scene::VertexPdf(const BDPT_VERTEX_t* prev, const BDPT_VERTEX_t& v, const BDPT_VERTEX_t& next) const {
+    if (v.type == VERTEX_TYPE::LIGHT) {
+        return PdfLightDir(v, next);
+    }
+
+    glm::vec3 w_next = glm::normalize(next.p - v.p);
+    if (v.type == VERTEX_TYPE::CAMERA) {
+        glm::vec2 pixel;
+        float cos = glm::dot(w_next, cam.forward);
+        if (cos <= 0.f || !cam.Project(next.p, pixel)) {
+            return 0.f;
+        }
+        return ConvertDensity(1.f / (cam.ImagePlaneArea() * cos * cos * cos), v, next);
+    }
+
+    glm::vec3 w_prev = glm::normalize(prev->p - v.p);
+    if (v.type == VERTEX_TYPE::MEDIUM) {
+        return ConvertDensity(media[v.medium].Phase(w_prev, w_next), v, next);
+    }
+    const Primitive& prim = primitives[v.prim_id];
+    if (prim.material != MATERIAL::DIFFUSE) {
+        if (prim.roughness == 0.f) {
+            return 0.f;
+        }
+        // density does not depend on colour
+        return ConvertDensity(Microfacet_t(prim, prim.col.rgb, v.n, v.interior).Pdf(w_prev, w_next), v, next);
+    }
+    float cos = glm::dot(v.n, w_next);
+    if (glm::dot(v.n, w_prev) <= 0.f || cos <= 0.f) {
+        return 0.f;
+    }
+    return ConvertDensity(cos / kPI, v, next);
+}
+
+bool Scene::Visible(glm::vec3 a, glm::vec3 b, float lod_spread, unsigned int lod_min) const {
+    glm::vec3 d = b - a;
+    float dist = glm::length(d);
+    d /= dist;
+    auto raytrace = RayIntersection(Ray(a + eps * d, d), lod_spread, lod_min);
+    return raytrace.id == -1 || raytrace.isec.t >= dist - 10 * eps;
+}
+
+///////////////
+// SUBPATHS  //
+///////////////
+
+void Scene::RandomWalk(RANDOM_t& random, Ray ray, glm::vec3 beta, float pdf_dir, unsigned int max_vertices,
+        std::vector<BDPT_VERTEX_t>& path, glm::vec3& escaped) {
+    escaped = {0.f, 0.f, 0.f};
+    while (path.size() < max_vertices) {
+        auto raytrace = RayIntersection(ray);
+        int medium = -1;
+        float t_medium = 0.f;
+        if (!media.empty()) {
+            medium = SampleMedia(random, ray, (raytrace.id == -1 ? INF : raytrace.isec.t), t_medium);
+        }
+        if (medium != -1) {
+            // real collision of delta tracking, phase function is sampled exactly
+            const Medium_t& m = media[medium];
+            glm::vec3 wo = -1.f * glm::normalize(ray.d);
+            BDPT_VERTEX_t v;
+            v.type = VERTEX_TYPE::MEDIUM;
+            v.p = ray.o + t_medium * ray.d;
+            v.beta = beta;
+            v.medium = medium;
+            v.pdf_fwd = ConvertDensity(pdf_dir, path.back(), v);
+            path.push_back(v);
+            if (path.size() == max_vertices) {
+                return;
+            }
+
+            glm::vec3 dir = m.SamplePhase(wo, random.sampler.Get2D());
+            pdf_dir = m.Phase(wo, dir);
+            if (pdf_dir <= 0.f) {
+                return;
+            }
+            beta *= m.Albedo();
+            BDPT_VERTEX_t& prev = path[path.size() - 2];
+            prev.pdf_rev = ConvertDensity(m.Phase(dir, wo), path.back(), prev);
+            ray = Ray(path.back().p, dir);
+            continue;
+        }
+        if (raytrace.id == -1) {
+            escaped = beta * Background(ray.d);
+            return;
+        }
+        auto [t, normal, interior] = raytrace.isec;
+        const Primitive& hit = primitives[raytrace.id];
+        glm::vec3 d = glm::normalize(ray.d);
+
+        BDPT_VERTEX_t v;
+        v.p = ray.o + t * ray.d;
+        v.n = normal;
+        v.beta = beta;
+        v.prim_id = raytrace.id;
+        v.interior = interior;
+        v.pdf_fwd = ConvertDensity(pdf_dir, path.back(), v);
+        path.push_back(v);
+        if (path.size() == max_vertices) {
+            return;
+        }
+
+        // same choices as in RayTrace
+        float pdf_rev = 0.f;
+        glm::vec3 col = Albedo(raytrace.id, v.p, 0.f);
+        glm::vec3 dir;
+        if (hit.material != MATERIAL::DIFFUSE && hit.roughness > 0.f) {
+            // light subpath goes to camera side of bsdf
+            Microfacet_t bsdf(hit, col, normal, interior);
+            bool adjoint = (path.front().type == VERTEX_TYPE::LIGHT);
+            float u_lobe = random.sampler.Get1D();
+            glm::vec3 weight;
+            if (!bsdf.Scatter(-1.f * d, adjoint, u_lobe, random.sampler.Get2D(), dir, weight, pdf_dir)) {
+                return;
+            }
+            pdf_rev = bsdf.Pdf(dir, -1.f * d);
+            beta *= weight;
+        } else {
+            switch (hit.material) {
+                case MATERIAL::DIFFUSE: {
+                    dir = CosineDirection(random.sampler.Get2D(), normal);
+                    pdf_dir = glm::dot(dir, normal) / kPI;
+                    pdf_rev = glm::dot(-1.f * d, normal) / kPI;
+                    beta *= col;
+                    break;
+                }
+                case MATERIAL::METALLIC: {
+                    dir = glm::reflect(d, normal);
+                    pdf_dir = 0.f;
+                    beta *= col;
+                    path.back().delta = true;
+                    break;
+                }
+                case MATERIAL::DIELECTRIC: {
+                    pdf_dir = 0.f;
+                    path.back().delta = true;
+
+                    float eta1 = 1., eta2 = hit.ior;
+                    if (interior) {
+                        std::swap(eta1, eta2);
+                    }
+                    float dot_normal_dir = glm::dot(normal, -1.f * d);
+                    float sin_theta2 = eta1 / eta2 * sqrt(std::max(0.f, 1 - dot_normal_dir * dot_normal_dir));
+
+                    float r0 = pow((eta1 - eta2) / (eta1 + eta2), 2.);
+                    float r = r0 + (1 - r0) * pow(1 - dot_normal_dir, 5.);
+                    if (fabs(sin_theta2) > 1. || random.sampler.Get1D() < r) {
+                        dir = glm::reflect(d, normal);
+                        break;
+                    }
+
+                    float cos_theta2 = sqrt(1 - sin_theta2 * sin_theta2);
+                    dir = eta1 / eta2 * d + (eta1 / eta2 * dot_normal_dir - cos_theta2) * normal;
+                    if (!interior) {
+                        beta *= col;
+                    }
+                    break;
+                }
+            }
+        }
+
+        if (!path.back().delta && pdf_dir <= 0.f) {
+            return;
+        }
+        BDPT_VERTEX_t& prev = path[path.size() - 2];
+        prev.pdf_rev = ConvertDensity(pdf_rev, path.back(), prev);
+        ray = Ray(path.back().p + eps * dir, dir);
+    }
+}
+
+////////////////
+// CONNECTION //
+////////////////
+
+glm::vec3 Scene::ConnectBDPT(RANDOM_t& random, std::vector<BDPT_VERTEX_t>& camera_path,
+        std::vector<BDPT_VERTEX_t>& light_path, unsigned int s, unsigned int t) {
+    glm::vec3 L = {0.f, 0.f, 0.f};
+    BDPT_VERTEX_t sampled;
+
+    if (s == 0) {
+        // camera path hit emitter by itself
+        const BDPT_VERTEX_t& pt = camera_path[t - 1];
+        if (pt.prim_id != -1 && emitter_of[pt.prim_id] == -1 && primitives[pt.prim_id].IsEmitter()) {
+            // emissive plane: light subpaths never start on it, so this is its only strategy (as in RayTrace)
+            return pt.beta * primitives[pt.prim_id].emission.rgb;
+        }
+        L = pt.beta * VertexEmission(pt, camera_path[t - 2].p - pt.p);
+    } else if (t == 1) {
+        // light vertex is seen by camera: contribution goes to other pixel
+        const BDPT_VERTEX_t& qs = light_path[s - 1];
+        glm::vec2 pixel;
+        if (qs.delta || !cam.Project(qs.p, pixel)) {
+            return L;
+        }
+        sampled = camera_path[0];
+
+        glm::vec3 w = cam.pos - qs.p;
+        float dist2 = glm::length2(w);
+        w /= std::sqrt(dist2);
+        float cos_cam = glm::dot(-1.f * w, cam.forward);
+        // importance of pinhole camera times cosine at it
+        float importance = 1.f / (cam.ImagePlaneArea() * cos_cam * cos_cam * cos_cam);
+
+        glm::vec3 f = (s == 1 ? VertexEmission(qs, w) : VertexBsdf(qs, w, light_path[s - 2].p - qs.p));
+        L = qs.beta * f * (AbsCos(qs, w) * importance / dist2);
+        if (L == glm::vec3(0.f)) {
+            return L;
+        }
+        L *= Transmittance(random, qs.p, cam.pos);
+        if (L == glm::vec3(0.f)) {
+            return L;
+        }
+
+        Splat(pixel, L * MISWeight(camera_path, light_path, sampled, s, t));
+        return {0.f, 0.f, 0.f};
+    } else if (s == 1) {
+        // fresh point on emitter, as next event estimation
+        const BDPT_VERTEX_t& pt = camera_path[t - 1];
+        if (pt.delta) {
+            return L;
+        }
+        sampled = SampleLightVertex(random);
+
+        glm::vec3 w = sampled.p - pt.p;
+        float dist2 = glm::length2(w);
+        w /= std::sqrt(dist2);
+        glm::vec3 f = VertexBsdf(pt, camera_path[t - 2].p - pt.p, w) * VertexEmission(sampled, -1.f * w);
+        float g = AbsCos(pt, w) * AbsCos(sampled, w) / dist2;
+        L = pt.beta * f * sampled.beta * g;
+        if (L != glm::vec3(0.f)) {
+            L *= Transmittance(random, pt.p, sampled.p);
+        }
+    } else {
+        const BDPT_VERTEX_t& qs = light_path[s - 1];
+        const BDPT_VERTEX_t& pt = camera_path[t - 1];
+        if (qs.delta || pt.delta) {
+            return L;
+        }
+
+        glm::vec3 w = qs.p - pt.p;
+        float dist2 = glm::length2(w);
+        w /= std::sqrt(dist2);
+        glm::vec3 f = VertexBsdf(pt, camera_path[t - 2].p - pt.p, w) * VertexBsdf(qs, -1.f * w, light_path[s - 2].p - qs.p);
+        float g = AbsCos(pt, w) * AbsCos(qs, w) / dist2;
+        L = pt.beta * f * qs.beta * g;
+        if (L != glm::vec3(0.f)) {
+            L *= Transmittance(random, pt.p, qs.p);
+        }
+    }
+
+    if (L == glm::vec3(0.f)) {
+        return L;
+    }
+    return L * MISWeight(camera_path, light_path, sampled, s, t);
+}
+
+float Scene::MISWeight(const std::vector<BDPT_VERTEX_t>& camera_path, const std::vector<BDPT_VERTEX_t>& light_path,
+        const BDPT_VERTEX_t& sampled, unsigned int s, unsigned int t) const {
+    // densities of connection vertices change, so they are evaluated on copies
+    std::vector<BDPT_VERTEX_t> c(camera_path.begin(), camera_path.begin() + t);
+    std::vector<BDPT_VERTEX_t> l(light_path.begin(), light_path.begin() + s);
+    if (t == 1) {
+        c[0] = sampled;
+    } else if (s == 1) {
+        l[0] = sampled;
+    }
+
+    BDPT_VERTEX_t* qs = (s > 0 ? &l[s - 1] : nullptr);
+    BDPT_VERTEX_t* pt = &c[t - 1];
+    BDPT_VERTEX_t* qs_minus = (s > 1 ? &l[s - 2] : nullptr);
+    BDPT_VERTEX_t* pt_minus = (t > 1 ? &c[t - 2] : nullptr);
+
+    pt->delta = false;
+    if (qs) {
+        qs->delta = false;
+    }
+    float pt_rev = (s > 0 ? VertexPdf(qs_minus, *qs, *pt) : PdfLightOrigin(*pt));
+    float pt_minus_rev = 0.f, qs_rev = 0.f, qs_minus_rev = 0.f;
+    if (pt_minus) {
+        pt_minus_rev = (s > 0 ? VertexPdf(qs, *pt, *pt_minus) : PdfLightDir(*pt, *pt_minus));
+    }
+    if (qs) {
+        qs_rev = VertexPdf(pt_minus, *pt, *qs);
+    }
+    if (qs_minus) {
+        qs_minus_rev = VertexPdf(pt, *qs, *qs_minus);
+    }
+    pt->pdf_rev = pt_rev;
+    if (pt_minus) {
+        pt_minus->pdf_rev = pt_minus_rev;
+    }
+    if (qs) {
+        qs->pdf_rev = qs_rev;
+    }
+    if (qs_minus) {
+        qs_minus->pdf_rev = qs_minus_rev;
+    }
+
+    // ratios of densities of other strategies to this one, walking both ways (balance heuristic)
+    float sum_ri = 0.f;
+    float ri = 1.f;
+    for (unsigned int i = t - 1; i > 0; --i) {
+        ri *= Remap0(c[i].pdf_rev) / Remap0(c[i].pdf_fwd);
+        if (!c[i].delta && !c[i - 1].delta) {
+            sum_ri += ri;
+        }
+    }
+    ri = 1.f;
+    for (int i = (int)s - 1; i >= 0; --i) {
+        ri *= Remap0(l[i].pdf_rev) / Remap0(l[i].pdf_fwd);
+        bool delta_prev = (i > 0 ? l[i - 1].delta : false);
+        if (!l[i].delta && !delta_prev) {
+            sum_ri += ri;
+        }
+    }
+    return 1.f / (1.f + sum_ri);
+}
+
+////////////
+// SAMPLE //
+////////////
+
+Color Scene::SampleBDPT(RANDOM_t& random, float fx, float fy) {
+    glm::vec3 d = glm::normalize(cam.GetToRay(fx, fy).d);
+    float cos_cam = glm::dot(d, cam.forward);
+
+    std::vector<BDPT_VERTEX_t> camera_path;
+    camera_path.reserve(ray_depth + 1);
+    BDPT_VERTEX_t camera_vertex;
+    camera_vertex.type = VERTEX_TYPE::CAMERA;
+    camera_vertex.p = cam.pos;
+    camera_vertex.n = cam.forward;
+    camera_vertex.pdf_fwd = 1.f;
+    camera_path.push_back(camera_vertex);
+
+    // background is not an emitter, so only camera paths find it
+    glm::vec3 L;
+    float pdf_dir = 1.f / (cam.ImagePlaneArea() * cos_cam * cos_cam * cos_cam);
+    RandomWalk(random, Ray(cam.pos, d), {1.f, 1.f, 1.f}, pdf_dir, ray_depth + 1, camera_path, L);
+
+    std::vector<BDPT_VERTEX_t> light_path;
+    if (!emitter_table.Empty()) {
+        light_path.reserve(ray_depth);
+        light_path.push_back(SampleLightVertex(random));
+        const BDPT_VERTEX_t& light_vertex = light_path[0];
+        const Primitive& prim = primitives[light_vertex.prim_id];
+
+        glm::vec3 n = light_vertex.n;
+        float sides = 1.f;
+        if (prim.primitive_type == PRIMITIVE_TYPE::TRIANGLE) {
+            sides = 2.f;
+            if (random.sampler.Get1D() < 0.5f) {
+                n = -1.f * n;
+            }
+        }
+        glm::vec3 dir = CosineDirection(random.sampler.Get2D(), n);
+        float pdf_light_dir = glm::dot(dir, n) / (kPI * sides);
+        // Le * cos / (pdf_area * pmf * pdf_dir)
+        glm::vec3 beta = prim.emission.rgb * light_vertex.beta * (kPI * sides);
+        if (pdf_light_dir > 0.f) {
+            // light leaving scene reaches nothing
+            glm::vec3 escaped;
+            RandomWalk(random, Ray(light_vertex.p + eps * dir, dir), beta, pdf_light_dir, ray_depth, light_path, escaped);
+        }
+    }
+
+    for (unsigned int t = 1; t <= camera_path.size(); ++t) {
+        for (unsigned int s = 0; s <= light_path.size(); ++s) {
+            // path of s + t vertices has s + t - 2 bounces
+            if (s + t < 2 || s + t > ray_depth + 1 || (s == 0 && t == 1)) {
+                continue;
+            }
+            L += ConnectBDPT(random, camera_path, light_path, s, t);
+        }
+    }
+    return {L};
+}
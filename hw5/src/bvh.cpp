@@ -96,10 +96,12 @@ std::optional<intersection_t> AABB_t::Intersect(const Ray &ray) const {
 // BVH //
 /////////
 
-BVH_t::BVH_t(std::vector<Primitive>& primitives, uint32_t n) {
-    cut_qual.resize(n);
-    nodes.reserve(n);
-    root_ = InitTree(primitives, 0, n);
+BVH_t::BVH_t(std::vector<Primitive>& primitives, uint32_t n) : BVH_t(primitives, 0, n) {}
+
+BVH_t::BVH_t(std::vector<Primitive>& primitives, uint32_t first, uint32_t last) {
+    cut_qual.resize(last);
+    nodes.reserve(last - first);
+    root_ = InitTree(primitives, first, last);
 }
 
 uint32_t BVH_t::InitTree(std::vector<Primitive>& primitives, uint32_t first, uint32_t last) {
@@ -23,6 +23,10 @@ static Color saturate(const Color &color) {
     return {r, g, b};
 }
 
+float Luminance(const Color &col) {
+    return 0.2126f * col.r() + 0.7152f * col.g() + 0.0722f * col.b();
+}
+
 Color AcesTonemap(const Color &col) {
     auto x = col.rgb;
 
@@ -0,0 +1,195 @@
+#include "denoise.h"
+#include "color.h"
+
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+static float Lum(glm::vec3 c) {
+    return Luminance(Color{c});
+}
+
+// albedo channels close to black (emitters, background) are left as they are
+static glm::vec3 Demodulation(glm::vec3 albedo) {
+    static constexpr float min_albedo = 1e-3;
+    return {albedo.x > min_albedo ? albedo.x : 1.f,
+            albedo.y > min_albedo ? albedo.y : 1.f,
+            albedo.z > min_albedo ? albedo.z : 1.f};
+}
+
+// 3x3 gaussian of variance, luminance weights of one iteration use it
+static std::vector<float> BlurVariance(const std::vector<float>& variance, int width, int height) {
+    static constexpr float kernel[2] = {0.25f, 0.125f};
+    std::vector<float> out(variance.size());
+    #pragma omp parallel for
+    for (int i = 0; i < width * height; ++i) {
+        int x = i % width, y = i / width;
+        float sum = 0.f, w_sum = 0.f;
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                int qx = x + dx, qy = y + dy;
+                if (qx < 0 || qx >= width || qy < 0 || qy >= height) {
+                    continue;
+                }
+                float w = kernel[std::abs(dx)] * kernel[std::abs(dy)] * 4.f;
+                sum += w * variance[qx + qy * width];
+                w_sum += w;
+            }
+        }
+        out[i] = sum / w_sum;
+    }
+    return out;
+}
+
+std::vector<glm::vec3> DenoiseATrous(const std::vector<glm::vec3>& color, const std::vector<float>& variance,
+        const std::vector<AOV_t>& aovs, unsigned int width, unsigned int height, unsigned int iterations,
+        float sigma_luminance) {
+    static constexpr float kernel[3] = {3.f / 8, 1.f / 4, 1.f / 16};
+    // normal weight is cos^sigma_normal, depth difference is measured in local gradients
+    static constexpr float sigma_normal = 128.f;
+    static constexpr float sigma_depth = 1.f;
+    static constexpr float eps = 1e-6;
+
+    int w = width, h = height, n = w * h;
+    std::vector<glm::vec3> demod(n), irradiance(n);
+    std::vector<float> var(n), depth_grad(n);
+    #pragma omp parallel for
+    for (int i = 0; i < n; ++i) {
+        int x = i % w, y = i / w;
+        demod[i] = Demodulation(aovs[i].albedo);
+        irradiance[i] = color[i] / demod[i];
+
+        float scale = Lum(demod[i]);
+        if (variance[i] >= 0.f) {
+            var[i] = variance[i] / (scale * scale);
+        } else {
+            // spatial estimate where samples of pixel do not tell it
+            float sum = 0.f, sum2 = 0.f;
+            int count = 0;
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    int qx = x + dx, qy = y + dy;
+                    if (qx < 0 || qx >= w || qy < 0 || qy >= h) {
+                        continue;
+                    }
+                    int q = qx + qy * w;
+                    float l = Lum(color[q] / Demodulation(aovs[q].albedo));
+                    sum += l;
+                    sum2 += l * l;
+                    ++count;
+                }
+            }
+            float mean = sum / count;
+            var[i] = std::max(0.f, sum2 / count - mean * mean);
+        }
+
+        // depth change per pixel, one-sided where neighbour is missing
+        int x0 = std::max(x - 1, 0), x1 = std::min(x + 1, w - 1);
+        int y0 = std::max(y - 1, 0), y1 = std::min(y + 1, h - 1);
+        float gx = 0.f, gy = 0.f;
+        if (x1 > x0) {
+            gx = std::abs(aovs[x1 + y * w].depth - aovs[x0 + y * w].depth) / (x1 - x0);
+        }
+        if (y1 > y0) {
+            gy = std::abs(aovs[x + y1 * w].depth - aovs[x + y0 * w].depth) / (y1 - y0);
+        }
+        depth_grad[i] = std::max(gx, gy);
+    }
+
+    std::vector<glm::vec3> next(n);
+    std::vector<float> next_var(n);
+    for (unsigned int iteration = 0; iteration < iterations; ++iteration) {
+        int step = 1 << iteration;
+        std::vector<float> blurred = BlurVariance(var, w, h);
+
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (int i = 0; i < n; ++i) {
+            int x = i % w, y = i / w;
+            const AOV_t& p = aovs[i];
+            float l_p = Lum(irradiance[i]);
+            float sigma_l = sigma_luminance * std::sqrt(blurred[i]) + eps;
+
+            glm::vec3 sum = {0.f, 0.f, 0.f};
+            float w_sum = 0.f, var_sum = 0.f;
+            for (int dy = -2; dy <= 2; ++dy) {
+                for (int dx = -2; dx <= 2; ++dx) {
+                    int qx = x + dx * step, qy = y + dy * step;
+                    if (qx < 0 || qx >= w || qy < 0 || qy >= h) {
+                        continue;
+                    }
+                    int q = qx + qy * w;
+                    float weight = kernel[std::abs(dx)] * kernel[std::abs(dy)];
+                    if (q != i) {
+                        const AOV_t& a = aovs[q];
+                        float cos = glm::dot(p.normal, a.normal);
+                        float w_normal = (cos > 0.f ? std::pow(cos, sigma_normal) : 0.f);
+                        float tap_dist = step * std::sqrt((float)(dx * dx + dy * dy));
+                        float w_depth = std::exp(-std::abs(p.depth - a.depth) / (sigma_depth * depth_grad[i] * tap_dist + eps));
+                        float w_lum = std::exp(-std::abs(l_p - Lum(irradiance[q])) / sigma_l);
+                        weight *= w_normal * w_depth * w_lum;
+                    }
+                    sum += weight * irradiance[q];
+                    var_sum += weight * weight * var[q];
+                    w_sum += weight;
+                }
+            }
+            next[i] = sum / w_sum;
+            next_var[i] = var_sum / (w_sum * w_sum);
+        }
+        irradiance.swap(next);
+        var.swap(next_var);
+    }
+
+    std::vector<glm::vec3> out(n);
+    for (int i = 0; i < n; ++i) {
+        out[i] = irradiance[i] * demod[i];
+    }
+    return out;
+}
+
+std::vector<glm::vec3> UpsampleJointBilateral(const std::vector<glm::vec3>& color, const std::vector<uint8_t>& known,
+        const std::vector<AOV_t>& aovs, unsigned int width, unsigned int height, unsigned int radius) {
+    static constexpr float sigma_normal = 32.f;
+    // depth difference as share of pixel depth
+    static constexpr float sigma_depth = 0.02f;
+    static constexpr float min_weight = 1e-4;
+
+    int w = width, h = height, r = radius;
+    std::vector<glm::vec3> out(color);
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < w * h; ++i) {
+        const AOV_t& p = aovs[i];
+        if (known[i] || p.depth <= 0.f) {
+            // camera ray escaped, there is nothing to be lit
+            continue;
+        }
+        int x = i % w, y = i / w;
+        glm::vec3 sum = {0.f, 0.f, 0.f}, spatial_sum = {0.f, 0.f, 0.f};
+        float w_sum = 0.f, spatial_w_sum = 0.f;
+        for (int dy = -r; dy <= r; ++dy) {
+            for (int dx = -r; dx <= r; ++dx) {
+                int qx = x + dx, qy = y + dy;
+                if (qx < 0 || qx >= w || qy < 0 || qy >= h || !known[qx + qy * w]) {
+                    continue;
+                }
+                int q = qx + qy * w;
+                const AOV_t& a = aovs[q];
+                glm::vec3 irradiance = color[q] / Demodulation(a.albedo);
+                float w_spatial = std::exp(-(float)(dx * dx + dy * dy) / (r * r));
+                float cos = glm::dot(p.normal, a.normal);
+                float w_normal = (cos > 0.f ? std::pow(cos, sigma_normal) : 0.f);
+                float w_depth = std::exp(-std::abs(p.depth - a.depth) / (sigma_depth * p.depth));
+                float weight = w_spatial * w_normal * w_depth;
+                sum += weight * irradiance;
+                w_sum += weight;
+                spatial_sum += w_spatial * irradiance;
+                spatial_w_sum += w_spatial;
+            }
+        }
+        glm::vec3 irradiance = (w_sum > min_weight ? sum / w_sum :
+                                spatial_w_sum > 0.f ? spatial_sum / spatial_w_sum : glm::vec3(0.f));
+        out[i] = irradiance * Demodulation(p.albedo);
+    }
+    return out;
+}
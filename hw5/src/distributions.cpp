@@ -1,5 +1,13 @@
 #include "distributions.h"
 
+void BuildBasis(glm::vec3 w, glm::vec3& u, glm::vec3& v) {
+    float sign = std::copysign(1.f, w.z);
+    float a = -1.f / (sign + w.z);
+    float b = w.x * w.y * a;
+    u = {1.f + sign * w.x * w.x * a, sign * b, -sign * w.x};
+    v = {b, sign + w.y * w.y * a, -w.y};
+}
+
 //////////////////
 // MAIN METHODS //
 //////////////////
@@ -26,6 +34,10 @@ glm::vec3 Distribution::Sample(RANDOM_t& random, glm::vec3 x, glm::vec3 n) {
             ret = SampleEllipsoid(random, x, n);
             break;
         }
+        case DISTRIB_TYPE::TRIANGLE: {
+            ret = SampleTriangle(random, x, n);
+            break;
+        }
         case DISTRIB_TYPE::MIX: {
             ret = SampleMix(random, x, n);
             break;
@@ -52,6 +64,10 @@ float Distribution::Pdf(glm::vec3 x, glm::vec3 n, glm::vec3 d) const {
             ret = PdfEllipsoid(x, n, d);
             break;
         }
+        case DISTRIB_TYPE::TRIANGLE: {
+            ret = PdfTriangle(x, n, d);
+            break;
+        }
         case DISTRIB_TYPE::MIX: {
             ret = PdfMix(x, n, d);
             break;
@@ -71,46 +87,39 @@ float Distribution::Pdf(glm::vec3 x, glm::vec3 n, glm::vec3 d) const {
 ///////////////////
 
 float Distribution::SampleUniform01(RANDOM_t& random) {
-    std::uniform_real_distribution<float>& uniform = random.uniform01.get();
-    auto& rnd = random.rnd;
+    return random.sampler.Get1D();
+}
 
-    return uniform(rnd);
+// one stratified 2D sample, prefer it over two SampleUniform01 for 2D domains
+glm::vec2 Distribution::SampleUniform01Vec2(RANDOM_t& random) {
+    return random.sampler.Get2D();
 }
 
 glm::vec3 Distribution::SampleUniform01Vec(RANDOM_t& random) {
-    std::uniform_real_distribution<float>& uniform = random.uniform01.get();
-    auto& rnd = random.rnd;
-
-    return glm::normalize(glm::vec3{uniform(rnd), uniform(rnd), uniform(rnd)});
+    float u1 = random.sampler.Get1D();
+    float u2 = random.sampler.Get1D();
+    float u3 = random.sampler.Get1D();
+    return glm::normalize(glm::vec3{u1, u2, u3});
 }
 
 float Distribution::PdfUniform01() const {
     return 0.f;
 }
 
-///////////////////
-//   NORMAL01    //
-///////////////////
-
-float Distribution::SampleNormal01(RANDOM_t& random) {
-    std::normal_distribution<float>& normal = random.normal01.get();
-    auto& rnd = random.rnd;
-
-    return normal(rnd);
-}
-
-glm::vec3 Distribution::SampleNormal01Vec(RANDOM_t& random) {
-    std::normal_distribution<float>& normal = random.normal01.get();
-    auto& rnd = random.rnd;
+////////////////////
+// UNIFORM SPHERE //
+////////////////////
 
-    float flip1 = normal(rnd);
-    float flip2 = normal(rnd);
-    float flip3 = normal(rnd);
-    return glm::normalize(glm::vec3{flip1, flip2, flip3});
+glm::vec3 Distribution::SampleUniformSphere(RANDOM_t& random) {
+    glm::vec2 u = SampleUniform01Vec2(random);
+    float z = 1.f - 2.f * u.x;
+    float r = std::sqrt(std::max(0.f, 1.f - z * z));
+    float phi = 2 * kPI * u.y;
+    return {r * cosf(phi), r * sinf(phi), z};
 }
 
-float Distribution::PdfNormal01() const {
-    return 0.f;
+float Distribution::PdfUniformSphere() const {
+    return 1.f / (4 * kPI);
 }
 
 ///////////////////
@@ -120,11 +129,14 @@ float Distribution::PdfNormal01() const {
 glm::vec3 Distribution::SampleHalfSphere(RANDOM_t& random, glm::vec3 x, glm::vec3 n) {
     (void) x;
 
-    glm::vec3 dir = SampleNormal01Vec(random);
-    if (glm::dot(dir, n) < 0) {
-        dir = -1 * dir;
-    }
-    return dir;
+    glm::vec2 u = SampleUniform01Vec2(random);
+    float z = u.x;
+    float r = std::sqrt(std::max(0.f, 1.f - z * z));
+    float phi = 2 * kPI * u.y;
+
+    glm::vec3 t, b;
+    BuildBasis(n, t, b);
+    return r * cosf(phi) * t + r * sinf(phi) * b + z * n;
 }
 
 float Distribution::PdfHalfSphere(glm::vec3 x, glm::vec3 n, glm::vec3 d) const {
@@ -141,21 +153,37 @@ float Distribution::PdfHalfSphere(glm::vec3 x, glm::vec3 n, glm::vec3 d) const {
 //    COSINE     //
 ///////////////////
 
-glm::vec3 Distribution::SampleCosine(RANDOM_t& random, glm::vec3 x, glm::vec3 n) {
-    (void) x;
-
-    glm::vec3 dir = SampleNormal01Vec(random);
-    dir = dir + n;
-
-    if (glm::dot(dir, n) <= eps) {
-        return n;
+// Shirley-Chiu concentric mapping of square to disk
+static glm::vec2 ConcentricDisk(glm::vec2 u) {
+    glm::vec2 offset = 2.f * u - glm::vec2{1.f, 1.f};
+    if (offset.x == 0.f && offset.y == 0.f) {
+        return {0.f, 0.f};
     }
-    if (glm::length(dir) <= 1e-4) {
-        return n; // ?!? ?!?!?! ?!? ?!?!?!?? !?!? ?!? ?!?!??! ?!!?
+
+    float r, theta;
+    if (fabs(offset.x) > fabs(offset.y)) {
+        r = offset.x;
+        theta = kPI / 4 * (offset.y / offset.x);
+    } else {
+        r = offset.y;
+        theta = kPI / 2 - kPI / 4 * (offset.x / offset.y);
     }
-    assert(glm::length(dir) > 1e-4);
+    return {r * cosf(theta), r * sinf(theta)};
+}
 
-    return glm::normalize(dir);
+// Malley's method - disk point lifted to hemisphere
+glm::vec3 CosineDirection(glm::vec2 u, glm::vec3 n) {
+    glm::vec2 d = ConcentricDisk(u);
+    float z = std::sqrt(std::max(0.f, 1.f - d.x * d.x - d.y * d.y));
+
+    glm::vec3 t, b;
+    BuildBasis(n, t, b);
+    return d.x * t + d.y * b + z * n;
+}
+
+glm::vec3 Distribution::SampleCosine(RANDOM_t& random, glm::vec3 x, glm::vec3 n) {
+    (void) x;
+    return CosineDirection(SampleUniform01Vec2(random), n);
 }
 
 float Distribution::PdfCosine(glm::vec3 x, glm::vec3 n, glm::vec3 d) const {
@@ -167,44 +195,28 @@ float Distribution::PdfCosine(glm::vec3 x, glm::vec3 n, glm::vec3 d) const {
 //   PRIMITIVE   //
 ///////////////////
 
-static std::pair<std::optional<intersection_t>, std::optional<intersection_t>> GetPointsForPdf(const Primitive* prim, glm::vec3 x, glm::vec3 d) {
-    auto closestInter = prim->Intersect(Ray(x, d));
-    if (!closestInter.has_value()) {
-        return std::make_pair(std::nullopt, std::nullopt);
-    }
-
-    auto [t, normal1, _] = closestInter.value();
-    // debug
-    if (t <= 1e-8) {
-        std::cerr << "GetPointsForPdf unexpected intersection t(" << t << ")" << std::endl;
-        return std::make_pair(std::nullopt, std::nullopt);
-    }
-    //
-
-    static constexpr float eps = 1e-4;
-    Point innerPoint = x + (t + eps) * d;
+const Primitive* Distribution::GetPrimitive() const {
+    switch (distrib_type_) {
+        case DISTRIB_TYPE::BOX: {
+            return std::get<static_cast<std::size_t>(DATA_T::BOX_)>(data);
+        }
+        case DISTRIB_TYPE::ELLIPSOID: {
+            return std::get<static_cast<std::size_t>(DATA_T::ELLIPSOID_)>(data);
+        }
+        case DISTRIB_TYPE::TRIANGLE: {
+            return std::get<static_cast<std::size_t>(DATA_T::TRIANGLE_)>(data);
+        }
 
-    auto secondInter = prim->Intersect(Ray(innerPoint, d));
-    if (!secondInter.has_value()) {
-        return std::make_pair(intersection_t{closestInter.value()}, std::nullopt);
+        default: {
+            throw std::invalid_argument("Distribution::GetPrimitive: distribution is not an emitter");
+        }
     }
-
-    secondInter.value().t += t + eps;
-    
-    return std::make_pair(
-        intersection_t{closestInter.value()}, 
-        intersection_t{secondInter.value()}
-    );
 }
 
-///////////////////
-//     BOX       //
-///////////////////
-
-// Box or Ellipsoid
+// Box or Ellipsoid or Triangle
 Distribution::Distribution(DISTRIB_TYPE distrib_type, const Primitive* prim) {
     distrib_type_ = distrib_type;
-    assert(distrib_type == DISTRIB_TYPE::BOX || distrib_type == DISTRIB_TYPE::ELLIPSOID);
+    assert(distrib_type == DISTRIB_TYPE::BOX || distrib_type == DISTRIB_TYPE::ELLIPSOID || distrib_type == DISTRIB_TYPE::TRIANGLE);
 
     switch (prim->primitive_type) {
         case PRIMITIVE_TYPE::BOX: {
@@ -217,200 +229,408 @@ Distribution::Distribution(DISTRIB_TYPE distrib_type, const Primitive* prim) {
             assert(distrib_type == DISTRIB_TYPE::ELLIPSOID);
             break;
         }
+        case PRIMITIVE_TYPE::TRIANGLE: {
+            data.emplace<static_cast<std::size_t>(DATA_T::TRIANGLE_)>(prim);
+            assert(distrib_type == DISTRIB_TYPE::TRIANGLE);
+            break;
+        }
         default: {
-            throw std::invalid_argument("Distribution constructor BOX/Ellipsoid: unexpected prim type");
+            throw std::invalid_argument("Distribution constructor BOX/Ellipsoid/Triangle: unexpected prim type");
             break;
         }
     }
 }
 
-glm::vec3 Distribution::SampleBox(RANDOM_t& random, glm::vec3 x, glm::vec3 n) {
-    (void) n;
-    const Primitive* box_ = std::get<static_cast<std::size_t>(DATA_T::BOX_)>(data);
+///////////////////
+//     BOX       //
+///////////////////
 
-    auto s = box_->dop_data;
-    
-    float s_x = s.x;
-    float s_y = s.y;
-    float s_z = s.z;
-
-    float w_x = s_x * s_x;
-    float w_y = s_y * s_y;
-    float w_z = s_z * s_z;
-
-here_we_go_again:
-    float u = SampleUniform01(random);
-    float side = (SampleUniform01(random) <= 0.5 ? 1 : -1);
-    u *= w_x + w_y + w_z;
-
-    float c1 = SampleUniform01(random), c2 = SampleUniform01(random), c3 = SampleUniform01(random);
-    c1 = 2 * c1 - 1;
-    c2 = 2 * c2 - 1;
-    c3 = 2 * c3 - 1;
-    Point pnt = {c1 * s_x, c2 * s_y, c3 * s_z};
-    if (u < w_x) {  // перпенд оси X
-        pnt.x = side * s_x;
-    } else if (u < w_x + w_y) {  // перпенд оси Y
-        pnt.y = side * s_y;
-    } else {  // перпенд оси Z
-        pnt.z = side * s_z;
+/*
+    Spherical rectangle - rectangle (corner s, edges ex, ey) projected on unit sphere around o.
+    Uniform solid angle sampling by Urena, Fajardo, King 2013.
+    Doubles, because solid angle of far faces is a difference of close numbers.
+*/
+struct SPH_RECT_t {
+    glm::dvec3 x, y, z;
+    double x0, y0, z0, x1, y1;
+    double b0, b1, k;
+    double S;  // solid angle
+};
+
+static SPH_RECT_t InitSphericalRect(glm::dvec3 o, glm::dvec3 s, glm::dvec3 ex, glm::dvec3 ey) {
+    SPH_RECT_t rect;
+    double exl = glm::length(ex), eyl = glm::length(ey);
+    rect.x = ex / exl;
+    rect.y = ey / eyl;
+    rect.z = glm::cross(rect.x, rect.y);
+
+    glm::dvec3 d = s - o;
+    rect.z0 = glm::dot(d, rect.z);
+    if (rect.z0 > 0) {
+        rect.z = -rect.z;
+        rect.z0 = -rect.z0;
     }
+    rect.x0 = glm::dot(d, rect.x);
+    rect.y0 = glm::dot(d, rect.y);
+    rect.x1 = rect.x0 + exl;
+    rect.y1 = rect.y0 + eyl;
+
+    glm::dvec3 v00 = {rect.x0, rect.y0, rect.z0};
+    glm::dvec3 v01 = {rect.x0, rect.y1, rect.z0};
+    glm::dvec3 v10 = {rect.x1, rect.y0, rect.z0};
+    glm::dvec3 v11 = {rect.x1, rect.y1, rect.z0};
+
+    glm::dvec3 n0 = glm::normalize(glm::cross(v00, v10));
+    glm::dvec3 n1 = glm::normalize(glm::cross(v10, v11));
+    glm::dvec3 n2 = glm::normalize(glm::cross(v11, v01));
+    glm::dvec3 n3 = glm::normalize(glm::cross(v01, v00));
+
+    double g0 = acos(std::clamp(-glm::dot(n0, n1), -1., 1.));
+    double g1 = acos(std::clamp(-glm::dot(n1, n2), -1., 1.));
+    double g2 = acos(std::clamp(-glm::dot(n2, n3), -1., 1.));
+    double g3 = acos(std::clamp(-glm::dot(n3, n0), -1., 1.));
+
+    rect.b0 = n0.z;
+    rect.b1 = n2.z;
+    rect.k = 2 * M_PI - g2 - g3;
+    rect.S = g0 + g1 - rect.k;
+    return rect;
+}
 
-    Point on_box = rotate(box_->rotator, pnt) + box_->pos;
+// returns direction in the frame o was given in
+static glm::dvec3 SampleSphericalRect(const SPH_RECT_t& rect, double u, double v) {
+    double au = u * rect.S + rect.k;
+    double fu = (cos(au) * rect.b0 - rect.b1) / sin(au);
+    double cu = std::copysign(1., fu) / std::sqrt(fu * fu + rect.b0 * rect.b0);
+    cu = std::clamp(cu, -1., 1.);
 
-    glm::vec3 sample_ = glm::normalize(on_box - x);
-    bool valid_generator = box_->Intersect(Ray{x, sample_}).has_value();
-    if (!valid_generator) {
-        // ?! ?! ?!
-        goto here_we_go_again;
-    }
+    double xu = -(cu * rect.z0) / std::sqrt(std::max(1e-12, 1 - cu * cu));
+    xu = std::clamp(xu, rect.x0, rect.x1);
 
-    return sample_;
-}
+    double d = std::sqrt(xu * xu + rect.z0 * rect.z0);
+    double h0 = rect.y0 / std::sqrt(d * d + rect.y0 * rect.y0);
+    double h1 = rect.y1 / std::sqrt(d * d + rect.y1 * rect.y1);
+    double hv = h0 + v * (h1 - h0);
+    double hv2 = hv * hv;
+    double yv = (hv2 < 1 - 1e-9 ? (hv * d) / std::sqrt(1 - hv2) : rect.y1);
 
-float Distribution::PdfPointBox(float dist2, glm::vec3 y, glm::vec3 n, glm::vec3 d) const {
-    (void) y;
-    const Primitive* box_ = std::get<static_cast<std::size_t>(DATA_T::BOX_)>(data);
-
-    auto s = box_->dop_data;
+    return xu * rect.x + yv * rect.y + rect.z0 * rect.z;
+}
 
-    float s_x = s.x;
-    float s_y = s.y;
-    float s_z = s.z;
+// faces of box (half sizes s, in local frame) visible from xl - at most 3, they don't overlap on sphere
+static uint8_t VisibleFaces(glm::vec3 xl, glm::vec3 s, SPH_RECT_t faces[3]) {
+    uint8_t cnt = 0;
+    for (uint8_t axis = 0; axis < 3; ++axis) {
+        float side = (xl[axis] > s[axis] ? 1.f : (xl[axis] < -s[axis] ? -1.f : 0.f));
+        uint8_t a1 = (axis + 1) % 3, a2 = (axis + 2) % 3;
+        if (side == 0.f || s[a1] <= 0.f || s[a2] <= 0.f) {
+            continue;
+        }
 
-    float w_x = s_x * s_x;
-    float w_y = s_y * s_y;
-    float w_z = s_z * s_z;
+        glm::dvec3 corner{0., 0., 0.}, ex{0., 0., 0.}, ey{0., 0., 0.};
+        corner[axis] = side * s[axis];
+        corner[a1] = -s[a1];
+        corner[a2] = -s[a2];
+        ex[a1] = 2. * s[a1];
+        ey[a2] = 2. * s[a2];
 
-    float p_y = 1. / (2 * 4 * (w_x + w_y + w_z));
-    return p_y * dist2 / fabs(glm::dot(d, n));
+        faces[cnt] = InitSphericalRect(xl, corner, ex, ey);
+        if (faces[cnt].S > 0.) {
+            ++cnt;
+        }
+    }
+    return cnt;
 }
 
-float Distribution::PdfBox(glm::vec3 x, glm::vec3 n, glm::vec3 d) const {
+glm::vec3 Distribution::SampleBox(RANDOM_t& random, glm::vec3 x, glm::vec3 n) {
     (void) n;
     const Primitive* box_ = std::get<static_cast<std::size_t>(DATA_T::BOX_)>(data);
 
-    auto [inter1, inter2] = GetPointsForPdf(box_, x, d);
-    if (!inter1.has_value()) {
-        //std::cerr << "Box pdf no intersection" << std::endl;
-        return 1e-9f;
+    glm::vec3 xl = rotate(glm::conjugate(box_->rotator), x - box_->pos);
+    SPH_RECT_t faces[3];
+    uint8_t cnt = VisibleFaces(xl, box_->dop_data, faces);
+    if (cnt == 0) {
+        // x inside the box - every direction hits it
+        return SampleUniformSphere(random);
     }
 
-    auto [t1, normal1, _] =  inter1.value();
-    Point closestPoint = x + t1 * d;
+    double omega = 0.;
+    for (uint8_t i = 0; i < cnt; ++i) {
+        omega += faces[i].S;
+    }
 
-    float sum = PdfPointBox(glm::distance2(closestPoint, x), closestPoint, normal1, d);
+    // face is chosen proportionally to its solid angle => pdf is 1/omega everywhere
+    double u = SampleUniform01(random) * omega;
+    uint8_t face = 0;
+    while (face + 1 < cnt && u >= faces[face].S) {
+        u -= faces[face].S;
+        ++face;
+    }
+
+    glm::vec2 uv = SampleUniform01Vec2(random);
+    glm::dvec3 dir = SampleSphericalRect(faces[face], uv.x, uv.y);
+    return rotate(box_->rotator, glm::normalize(glm::vec3(dir)));
+}
 
-    if (inter2.has_value()) {
-        auto [t2, normal2, _] = inter2.value();
-        Point otherPoint = x + t2 * d;
+float Distribution::PdfBox(glm::vec3 x, glm::vec3 n, glm::vec3 d) const {
+    (void) n;
+    const Primitive* box_ = std::get<static_cast<std::size_t>(DATA_T::BOX_)>(data);
 
-        sum += PdfPointBox(glm::distance2(otherPoint, x), otherPoint, normal2, d);
+    glm::vec3 xl = rotate(glm::conjugate(box_->rotator), x - box_->pos);
+    SPH_RECT_t faces[3];
+    uint8_t cnt = VisibleFaces(xl, box_->dop_data, faces);
+    if (cnt == 0) {
+        return PdfUniformSphere();
+    }
+    if (!box_->Intersect(Ray(x, d)).has_value()) {
+        return 0.f;
     }
 
-    return sum;
+    double omega = 0.;
+    for (uint8_t i = 0; i < cnt; ++i) {
+        omega += faces[i].S;
+    }
+    return 1.f / omega;
 }
 
 ///////////////////
 //   Ellipsoid   //
 ///////////////////
 
+/*
+    Ellipsoid is the unit sphere transformed by M = R * diag(r).
+    Uniform cone towards the sphere is sampled in sphere space and mapped by M,
+    pdf picks up the jacobian |det M^-1| / |M^-1 d|^3 of direction mapping.
+*/
+
 glm::vec3 Distribution::SampleEllipsoid(RANDOM_t& random, glm::vec3 x, glm::vec3 n) {
     (void) n;
     const Primitive* ellipsoid_ = std::get<static_cast<std::size_t>(DATA_T::ELLIPSOID_)>(data);
     
     glm::vec3 r = ellipsoid_->dop_data;
-here_we_go_again:
-    glm::vec3 k = SampleNormal01Vec(random);
-
-    Point pnt = r * k;
+    glm::vec3 xl = rotate(glm::conjugate(ellipsoid_->rotator), x - ellipsoid_->pos) / r;
+    float dist2 = glm::dot(xl, xl);
+    if (dist2 <= 1.f) {
+        return SampleUniformSphere(random);
+    }
 
-    Point on_ellipsoid = rotate(ellipsoid_->rotator, pnt) + ellipsoid_->pos;
+    // spherical cap seen from xl
+    float sin2_max = 1.f / dist2;
+    float cos_max = std::sqrt(std::max(0.f, 1.f - sin2_max));
+    float one_minus_cos_max = sin2_max / (1.f + cos_max);
 
-    glm::vec3 sample_ = glm::normalize(on_ellipsoid - x);
-    bool valid_generator = ellipsoid_->Intersect(Ray{x, sample_}).has_value();
-    if (!valid_generator) {
-        // ?! ?! ?!
-        goto here_we_go_again;
-    }
-    
-    return sample_;
-}
+    glm::vec2 uv = SampleUniform01Vec2(random);
+    float one_minus_cos = uv.x * one_minus_cos_max;
+    float cos_theta = 1.f - one_minus_cos;
+    float sin_theta = std::sqrt(std::max(0.f, one_minus_cos * (2.f - one_minus_cos)));
+    float phi = 2 * kPI * uv.y;
 
-float Distribution::PdfPointEllipsoid(float dist2, glm::vec3 y, glm::vec3 n_, glm::vec3 d) const {
-    const Primitive* ellipsoid_ = std::get<static_cast<std::size_t>(DATA_T::ELLIPSOID_)>(data);
+    glm::vec3 w = -1.f / std::sqrt(dist2) * xl, u, v;
+    BuildBasis(w, u, v);
+    glm::vec3 dir = sin_theta * cosf(phi) * u + sin_theta * sinf(phi) * v + cos_theta * w;
 
-    glm::vec3 r = ellipsoid_->dop_data;
-    glm::vec3 n = rotate(glm::conjugate(ellipsoid_->rotator), y - ellipsoid_->pos) / r;
-    float p_y = 1. / (4 * kPI * glm::length(glm::vec3{n.x * r.y * r.z, r.x * n.y * r.z, r.x * r.y * n.z}));
-    return p_y * dist2 / fabs(glm::dot(d, n_));
+    return glm::normalize(rotate(ellipsoid_->rotator, r * dir));
 }
 
 float Distribution::PdfEllipsoid(glm::vec3 x, glm::vec3 n, glm::vec3 d) const {
     (void) n;
     const Primitive* ellipsoid_ = std::get<static_cast<std::size_t>(DATA_T::ELLIPSOID_)>(data);
     
-    auto [inter1, inter2] = GetPointsForPdf(ellipsoid_, x, d);
-    if (!inter1.has_value()) {
-        //std::cerr << "Ellipsoid pdf no intersection" << std::endl;
-        return 1e-9f;
+    glm::vec3 r = ellipsoid_->dop_data;
+    glm::vec3 xl = rotate(glm::conjugate(ellipsoid_->rotator), x - ellipsoid_->pos) / r;
+    float dist2 = glm::dot(xl, xl);
+    if (dist2 <= 1.f) {
+        return PdfUniformSphere();
+    }
+
+    float sin2_max = 1.f / dist2;
+    float cos_max = std::sqrt(std::max(0.f, 1.f - sin2_max));
+    float one_minus_cos_max = sin2_max / (1.f + cos_max);
+
+    glm::vec3 dl = rotate(glm::conjugate(ellipsoid_->rotator), d) / r;  // M^-1 d
+    float len = glm::length(dl);
+    float cos_theta = -glm::dot(dl, xl) / (len * std::sqrt(dist2));
+    if (cos_theta < cos_max) {
+        return 0.f;
     }
 
-    auto [t1, normal1, _] =  inter1.value();
-    Point closestPoint = x + t1 * d;
+    float pdf_sphere = 1.f / (2 * kPI * one_minus_cos_max);
+    return pdf_sphere / (r.x * r.y * r.z * len * len * len);
+}
 
-    float sum = PdfPointEllipsoid(glm::distance2(closestPoint, x), closestPoint, normal1, d);
+///////////////////
+//   Triangle    //
+///////////////////
 
-    if (inter2.has_value()) {
-        auto [t2, normal2, _] = inter2.value();
-        Point otherPoint = x + t2 * d;
+glm::vec3 Distribution::SampleTriangle(RANDOM_t& random, glm::vec3 x, glm::vec3 n) {
+    (void) n;
+    const Primitive* triangle_ = std::get<static_cast<std::size_t>(DATA_T::TRIANGLE_)>(data);
 
-        sum += PdfPointEllipsoid(glm::distance2(otherPoint, x), otherPoint, normal2, d);
-    }
+    // uniform point by area
+    glm::vec2 uv = SampleUniform01Vec2(random);
+    float su = std::sqrt(uv.x);
+    float b0 = 1.f - su;
+    float b1 = uv.y * su;
+    Point pnt = b0 * triangle_->dop_data + b1 * triangle_->dop_data1 + (1.f - b0 - b1) * triangle_->dop_data2;
 
-    return sum;
+    Point on_triangle = rotate(triangle_->rotator, pnt) + triangle_->pos;
+    return glm::normalize(on_triangle - x);
+}
+
+float Distribution::PdfTriangle(glm::vec3 x, glm::vec3 n, glm::vec3 d) const {
+    (void) n;
+    const Primitive* triangle_ = std::get<static_cast<std::size_t>(DATA_T::TRIANGLE_)>(data);
+
+    // flat, so one intersection at most
+    auto isec = triangle_->Intersect(Ray(x, d));
+    if (!isec.has_value()) {
+        return 0.f;
+    }
+    auto [t, normal, _] = isec.value();
+    float cos_y = fabs(glm::dot(d, normal));
+    if (cos_y <= eps) {
+        return 0.f;
+    }
+    return t * t / (triangle_->Area() * cos_y);
 }
 
 ///////////////////
 //      MIX      //
 ///////////////////
 
-Distribution::Distribution(DISTRIB_TYPE mix_type, std::vector<Distribution>&& distribs) {
+Distribution::Distribution(DISTRIB_TYPE mix_type, std::vector<Distribution>&& distribs, LIGHT_SAMPLING light_sampling) {
     assert(mix_type == DISTRIB_TYPE::MIX);
     distrib_type_ = DISTRIB_TYPE::MIX;
 
-    data.emplace<static_cast<std::size_t>(DATA_T::DISTRIBS_)>(std::move(distribs));
+    std::vector<LIGHT_BOUNDS_t> lights;
+    std::vector<float> powers;
+    lights.reserve(distribs.size());
+    powers.reserve(distribs.size());
+    for (uint32_t i = 0; i < distribs.size(); ++i) {
+        const Primitive* prim = distribs[i].GetPrimitive();
+        lights.emplace_back(*prim, i);
+        powers.push_back(prim->Area() * Luminance(prim->emission));
+    }
+
+    MIX_t mix;
+    mix.distribs = std::move(distribs);
+    mix.light_sampling = light_sampling;
+    // bvh is also needed by POWER - it finds emitters pierced by direction in pdf
+    mix.light_bvh = LightBVH_t(std::move(lights));
+    mix.power_table = AliasTable_t(powers);
+    data.emplace<static_cast<std::size_t>(DATA_T::DISTRIBS_)>(std::move(mix));
+}
+
+void Distribution::SetGuide(const SDTree_t* guide) {
+    assert(distrib_type_ == DISTRIB_TYPE::MIX);
+    std::get<static_cast<std::size_t>(DATA_T::DISTRIBS_)>(data).guide = guide;
+}
+
+void Distribution::SetEnvMap(const EnvMap_t* envmap) {
+    assert(distrib_type_ == DISTRIB_TYPE::MIX);
+    std::get<static_cast<std::size_t>(DATA_T::DISTRIBS_)>(data).envmap = envmap;
+}
+
+void Distribution::SetLightCache(const LightCache_t* light_cache) {
+    assert(distrib_type_ == DISTRIB_TYPE::MIX);
+    std::get<static_cast<std::size_t>(DATA_T::DISTRIBS_)>(data).light_cache = light_cache;
 }
 
 glm::vec3 Distribution::SampleMix(RANDOM_t& random, glm::vec3 x, glm::vec3 n) {
-    (void) n;
-    std::vector<Distribution>& distribs_ = std::get<static_cast<std::size_t>(DATA_T::DISTRIBS_)>(data);
+    MIX_t& mix_ = std::get<static_cast<std::size_t>(DATA_T::DISTRIBS_)>(data);
 
-    float flip = SampleUniform01(random);
-    if (distribs_.empty() || flip <= 0.5f) {
-        return SampleCosine(random, x, n);
+    if (mix_.guide != nullptr && mix_.guide->CanSample(x) && SampleUniform01(random) < guide_prob) {
+        return mix_.guide->Sample(SampleUniform01Vec2(random), x);
     }
 
-    float fid = SampleUniform01(random);  // float [0,1]
-    size_t id = std::floor(fid * distribs_.size());  // int [0,size-1]
-
-    glm::vec3 sample_ = distribs_[id].Sample(random, x, n);
-    return sample_;
+    if (!HasLights() || SampleUniform01(random) <= 0.5f) {
+        return SampleCosine(random, x, n);
+    }
+    return SampleLight(random, x, n);
 }
 
 float Distribution::PdfMix(glm::vec3 x, glm::vec3 n, glm::vec3 d) const {
-    (void) n;
-    const std::vector<Distribution>& distribs_ = std::get<static_cast<std::size_t>(DATA_T::DISTRIBS_)>(data);
+    const MIX_t& mix_ = std::get<static_cast<std::size_t>(DATA_T::DISTRIBS_)>(data);
     
     float sum = PdfCosine(x, n, d);
-    if (!distribs_.empty()) {
-        float prim_sum = 0.f;
-        for(const auto& distrib : distribs_) {
-            prim_sum += distrib.Pdf(x, n, d);
+    if (HasLights()) {
+        sum = 0.5f * sum + 0.5f * PdfLight(x, n, d);
+    }
+    if (mix_.guide != nullptr && mix_.guide->CanSample(x)) {
+        sum = (1.f - guide_prob) * sum + guide_prob * mix_.guide->Pdf(x, d);
+    }
+    return sum;
+}
+
+bool Distribution::HasLights() const {
+    const MIX_t& mix_ = std::get<static_cast<std::size_t>(DATA_T::DISTRIBS_)>(data);
+    return !mix_.distribs.empty() || mix_.envmap != nullptr;
+}
+
+glm::vec3 Distribution::SampleLight(RANDOM_t& random, glm::vec3 x, glm::vec3 n) {
+    MIX_t& mix_ = std::get<static_cast<std::size_t>(DATA_T::DISTRIBS_)>(data);
+
+    // environment shares light samples with emitters equally
+    if (mix_.envmap != nullptr && (mix_.distribs.empty() || SampleUniform01(random) < 0.5f)) {
+        return mix_.envmap->Sample(SampleUniform01Vec2(random), SampleUniform01Vec2(random));
+    }
+
+    uint32_t id = 0;
+    // learned table knows occlusion, own selection keeps every emitter reachable
+    const AliasTable_t* learned = (mix_.light_cache != nullptr ? mix_.light_cache->Table(x, n) : nullptr);
+    if (learned != nullptr && SampleUniform01(random) < learned_prob) {
+        id = learned->Sample(SampleUniform01(random)).first;
+        return mix_.distribs[id].Sample(random, x, n);
+    }
+    switch (mix_.light_sampling) {
+        case LIGHT_SAMPLING::BVH: {
+            // light hierarchy picks emitter proportionally to its estimated contribution
+            id = mix_.light_bvh.Sample(SampleUniform01(random), x, n).first;
+            break;
+        }
+        case LIGHT_SAMPLING::POWER: {
+            id = mix_.power_table.Sample(SampleUniform01(random)).first;
+            break;
         }
-        prim_sum *= 1.f / distribs_.size();
+    }
 
-        sum = 0.5f * sum + 0.5f * prim_sum;
+    glm::vec3 sample_ = mix_.distribs[id].Sample(random, x, n);
+    return sample_;
+}
+
+float Distribution::PdfLight(glm::vec3 x, glm::vec3 n, glm::vec3 d) const {
+    const MIX_t& mix_ = std::get<static_cast<std::size_t>(DATA_T::DISTRIBS_)>(data);
+
+    // only emitters whose bounds are pierced by (x, d) have non-zero pdf
+    float prim_sum = 0.f;
+    if (!mix_.distribs.empty()) {
+        switch (mix_.light_sampling) {
+            case LIGHT_SAMPLING::BVH: {
+                prim_sum = mix_.light_bvh.Pdf(Ray(x, d), n, [&](uint32_t id) {
+                    return mix_.distribs[id].Pdf(x, n, d);
+                });
+                break;
+            }
+            case LIGHT_SAMPLING::POWER: {
+                mix_.light_bvh.ForEachHit(Ray(x, d), [&](uint32_t id) {
+                    prim_sum += mix_.power_table.Pmf(id) * mix_.distribs[id].Pdf(x, n, d);
+                });
+                break;
+            }
+        }
+
+        const AliasTable_t* learned = (mix_.light_cache != nullptr ? mix_.light_cache->Table(x, n) : nullptr);
+        if (learned != nullptr) {
+            float learned_sum = 0.f;
+            mix_.light_bvh.ForEachHit(Ray(x, d), [&](uint32_t id) {
+                learned_sum += learned->Pmf(id) * mix_.distribs[id].Pdf(x, n, d);
+            });
+            prim_sum = (1.f - learned_prob) * prim_sum + learned_prob * learned_sum;
+        }
     }
-    return sum;
+    if (mix_.envmap == nullptr) {
+        return prim_sum;
+    }
+    float env_share = (mix_.distribs.empty() ? 1.f : 0.5f);
+    return (1.f - env_share) * prim_sum + env_share * mix_.envmap->Pdf(d);
 }
@@ -0,0 +1,260 @@
+#include "envmap.h"
+#include "color.h"
+#include "primitives.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+EnvMap_t::~EnvMap_t() {
+    Unmap();
+}
+
+void EnvMap_t::Unmap() {
+    if (map_ != nullptr) {
+        munmap(map_, map_size_);
+        map_ = nullptr;
+        map_size_ = 0;
+    }
+}
+
+bool EnvMap_t::Empty() const {
+    return data_ == nullptr;
+}
+
+bool EnvMap_t::Load(const std::string& path, float scale) {
+    Unmap();
+    decoded_.clear();
+    data_ = nullptr;
+    scale_ = scale;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    map_size_ = st.st_size;
+    map_ = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map_ == MAP_FAILED) {
+        map_ = nullptr;
+        map_size_ = 0;
+        return false;
+    }
+
+    const uint8_t* file = static_cast<const uint8_t*>(map_);
+    bool parsed = (map_size_ > 2 && file[0] == 'P' && (file[1] == 'F' || file[1] == 'f') ?
+        ParsePFM(file, map_size_) : ParseRGBE(file, map_size_));
+    if (!decoded_.empty() || !parsed) {
+        // texels are not read from the file any more
+        Unmap();
+    }
+    if (!parsed) {
+        data_ = nullptr;
+        return false;
+    }
+
+    std::vector<float> row_weights(height_);
+    std::vector<float> weights(width_);
+    columns_.clear();
+    for (uint32_t y = 0; y < height_; ++y) {
+        float sin_theta = std::sin(kPI * (y + 0.5f) / height_);
+        double sum = 0.;
+        for (uint32_t x = 0; x < width_; ++x) {
+            float lum = Luminance(Color{Texel(x, y)});
+            weights[x] = (std::isfinite(lum) ? std::max(lum, 0.f) * sin_theta : 0.f);
+            sum += weights[x];
+        }
+        row_weights[y] = sum;
+        columns_.emplace_back(weights);
+    }
+    rows_ = AliasTable_t(row_weights);
+    return true;
+}
+
+// PFM: "PF" (rgb) or "Pf" (gray), width, height, scale (< 0 - little-endian), rows from bottom
+bool EnvMap_t::ParsePFM(const uint8_t* file, size_t size) {
+    size_t pos = 2;
+    auto token = [&]() {
+        while (pos < size && std::isspace(file[pos])) {
+            ++pos;
+        }
+        std::string s;
+        while (pos < size && !std::isspace(file[pos])) {
+            s += (char)file[pos++];
+        }
+        return s;
+    };
+    bool gray = (file[1] == 'f');
+    long w = std::atol(token().c_str()), h = std::atol(token().c_str());
+    float endian = std::atof(token().c_str());
+    // exactly one whitespace separates header from data
+    ++pos;
+    uint8_t channels = (gray ? 1 : 3);
+    if (w <= 0 || h <= 0 || endian == 0.f || pos + (size_t)w * h * channels * 4 > size) {
+        return false;
+    }
+    width_ = w;
+    height_ = h;
+
+    uint16_t one = 1;
+    bool host_little = (*reinterpret_cast<uint8_t*>(&one) == 1);
+    bool file_little = (endian < 0.f);
+    size_t file_stride = (size_t)w * channels * 4;
+    if (!gray && host_little == file_little) {
+        data_ = file + pos + (h - 1) * file_stride;
+        row_stride_ = -(ptrdiff_t)file_stride;
+        return true;
+    }
+
+    decoded_.resize((size_t)w * h * 3);
+    for (long y = 0; y < h; ++y) {
+        const uint8_t* row = file + pos + (h - 1 - y) * file_stride;
+        for (long x = 0; x < w; ++x) {
+            for (uint8_t c = 0; c < 3; ++c) {
+                uint8_t bytes[4];
+                std::memcpy(bytes, row + 4 * (x * channels + (gray ? 0 : c)), 4);
+                if (host_little != file_little) {
+                    std::swap(bytes[0], bytes[3]);
+                    std::swap(bytes[1], bytes[2]);
+                }
+                std::memcpy(&decoded_[3 * ((size_t)y * w + x) + c], bytes, 4);
+            }
+        }
+    }
+    data_ = reinterpret_cast<const uint8_t*>(decoded_.data());
+    row_stride_ = 12 * w;
+    return true;
+}
+
+// Radiance .hdr: text header up to empty line, "-Y h +X w", scanlines flat or run-length encoded per channel
+bool EnvMap_t::ParseRGBE(const uint8_t* file, size_t size) {
+    if (size < 2 || file[0] != '#' || file[1] != '?') {
+        return false;
+    }
+    size_t pos = 0;
+    auto line = [&]() {
+        std::string s;
+        while (pos < size && file[pos] != '\n') {
+            s += (char)file[pos++];
+        }
+        ++pos;
+        return s;
+    };
+    while (pos < size && !line().empty()) {
+    }
+    char sign_y, axis_y, sign_x, axis_x;
+    long h = 0, w = 0;
+    if (std::sscanf(line().c_str(), "%c%c %ld %c%c %ld", &sign_y, &axis_y, &h, &sign_x, &axis_x, &w) != 6 ||
+            sign_y != '-' || axis_y != 'Y' || sign_x != '+' || axis_x != 'X' || w <= 0 || h <= 0) {
+        return false;
+    }
+    width_ = w;
+    height_ = h;
+    decoded_.resize((size_t)w * h * 3);
+
+    std::vector<uint8_t> rgbe(4 * w);
+    for (long y = 0; y < h; ++y) {
+        if (pos + 4 > size) {
+            return false;
+        }
+        bool rle = (w >= 8 && w < 0x8000 && file[pos] == 2 && file[pos + 1] == 2 &&
+            ((file[pos + 2] << 8) | file[pos + 3]) == w);
+        if (rle) {
+            pos += 4;
+            for (uint8_t c = 0; c < 4; ++c) {
+                for (long x = 0; x < w;) {
+                    if (pos >= size) {
+                        return false;
+                    }
+                    uint8_t count = file[pos++];
+                    bool run = (count > 128);
+                    if (run) {
+                        count -= 128;
+                    }
+                    if (count == 0 || x + count > w || pos + (run ? 1 : count) > size) {
+                        return false;
+                    }
+                    for (uint8_t k = 0; k < count; ++k, ++x) {
+                        rgbe[4 * x + c] = file[run ? pos : pos + k];
+                    }
+                    pos += (run ? 1 : count);
+                }
+            }
+        } else {
+            if (pos + 4 * w > size) {
+                return false;
+            }
+            std::memcpy(rgbe.data(), file + pos, 4 * w);
+            pos += 4 * w;
+        }
+
+        for (long x = 0; x < w; ++x) {
+            const uint8_t* t = &rgbe[4 * x];
+            float f = (t[3] == 0 ? 0.f : std::ldexp(1.f, (int)t[3] - (128 + 8)));
+            for (uint8_t c = 0; c < 3; ++c) {
+                decoded_[3 * ((size_t)y * w + x) + c] = (t[3] == 0 ? 0.f : (t[c] + 0.5f) * f);
+            }
+        }
+    }
+    data_ = reinterpret_cast<const uint8_t*>(decoded_.data());
+    row_stride_ = 12 * w;
+    return true;
+}
+
+glm::vec3 EnvMap_t::Texel(uint32_t x, uint32_t y) const {
+    float rgb[3];
+    std::memcpy(rgb, data_ + y * row_stride_ + 12 * (ptrdiff_t)x, sizeof(rgb));
+    return {rgb[0], rgb[1], rgb[2]};
+}
+
+uint32_t EnvMap_t::TexelId(glm::vec3 d) const {
+    float theta = std::acos(std::clamp(d.y, -1.f, 1.f));
+    float phi = std::atan2(d.z, d.x);
+    if (phi < 0.f) {
+        phi += 2 * kPI;
+    }
+    uint32_t x = std::min<uint32_t>(phi / (2 * kPI) * width_, width_ - 1);
+    uint32_t y = std::min<uint32_t>(theta / kPI * height_, height_ - 1);
+    return y * width_ + x;
+}
+
+glm::vec3 EnvMap_t::Radiance(glm::vec3 d) const {
+    uint32_t id = TexelId(glm::normalize(d));
+    return scale_ * Texel(id % width_, id / width_);
+}
+
+glm::vec3 EnvMap_t::Sample(glm::vec2 u, glm::vec2 coin) const {
+    uint32_t y = rows_.Sample(u.x, coin.x).first;
+    uint32_t x = columns_[y].Sample(u.y, coin.y).first;
+    // position in bin is uniform whichever way coin sends it
+    double v = (double)u.x * height_, w = (double)u.y * width_;
+    float theta = kPI * (y + (float)(v - std::floor(v))) / height_;
+    float phi = 2 * kPI * (x + (float)(w - std::floor(w))) / width_;
+    float sin_theta = std::sin(theta);
+    return {sin_theta * std::cos(phi), std::cos(theta), sin_theta * std::sin(phi)};
+}
+
+float EnvMap_t::Pdf(glm::vec3 d) const {
+    d = glm::normalize(d);
+    float sin_theta = std::sqrt(std::max(0.f, 1.f - d.y * d.y));
+    if (sin_theta <= 0.f) {
+        return 0.f;
+    }
+    // uniform over texel in (u, v), d omega = 2 pi^2 sin(theta) du dv
+    uint32_t id = TexelId(d);
+    return rows_.Pmf(id / width_) * columns_[id / width_].Pmf(id % width_) * width_ * height_ /
+        (2 * kPI * kPI * sin_theta);
+}
@@ -0,0 +1,78 @@
+#include "scene.h"
+
+#include <algorithm>
+#include <array>
+
+void Scene::RenderGDPT(std::vector<PIXEL_STATS_t>& stats) {
+    // +x, -x, +y, -y
+    static constexpr int shifts[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+
+    unsigned int n_pixels = cam.width * cam.height;
+    int width = cam.width, height = cam.height;
+    std::vector<glm::vec3> base(n_pixels, glm::vec3(0.f));
+    // shifted[k][i] - sums of paths of pixel i moved by shifts[k], they belong to neighbour
+    std::array<std::vector<glm::vec3>, 4> shifted;
+    for (auto& image : shifted) {
+        image.assign(n_pixels, glm::vec3(0.f));
+    }
+
+    unsigned int percent10 = std::max(n_pixels / 10, 1U);
+    #pragma omp parallel for schedule(dynamic)
+    for (unsigned int i = 0; i < n_pixels; i++) {
+        RANDOM_t random{Sampler_t(sampler_type)};
+        int x = i % width, y = i / width;
+        for (unsigned int s = 0; s < samples; ++s) {
+            glm::vec2 pixel = PixelSample(random, x, y, s);
+            PATH_t path;
+            Ray ray = cam.GetToRay(pixel.x, pixel.y, path.cone_spread);
+            base[i] += RayTrace(random, ray, ray_depth, path).rgb;
+
+            // random replay: same sequence as base path, image point moved by one pixel
+            for (uint8_t k = 0; k < 4; ++k) {
+                if (x + shifts[k][0] < 0 || x + shifts[k][0] >= width || y + shifts[k][1] < 0 || y + shifts[k][1] >= height) {
+                    continue;
+                }
+                pixel = PixelSample(random, x, y, s) + glm::vec2(shifts[k][0], shifts[k][1]);
+                ray = cam.GetToRay(pixel.x, pixel.y, path.cone_spread);
+                shifted[k][i] += RayTrace(random, ray, ray_depth, path).rgb;
+            }
+        }
+        stats[i].n = samples;
+
+        if (i && i % percent10 == 0) {
+            std::cout << "GDPT: " << std::min(i / percent10, 10U) * 10 << "%\n";
+        }
+    }
+
+    // every shifted path is also a sample of the pixel it landed on,
+    // every gradient is estimated from both of its pixels
+    float inv_samples = 1.f / samples;
+    std::vector<glm::vec3> primal(n_pixels), dx(n_pixels, glm::vec3(0.f)), dy(n_pixels, glm::vec3(0.f));
+    #pragma omp parallel for
+    for (unsigned int i = 0; i < n_pixels; i++) {
+        int x = i % width, y = i / width;
+        glm::vec3 sum = base[i];
+        unsigned int count = 1;
+        for (uint8_t k = 0; k < 4; ++k) {
+            int sx = x - shifts[k][0], sy = y - shifts[k][1];
+            if (sx >= 0 && sx < width && sy >= 0 && sy < height) {
+                sum += shifted[k][sx + sy * width];
+                ++count;
+            }
+        }
+        primal[i] = sum * inv_samples / (float)count;
+
+        if (x + 1 < width) {
+            dx[i] = 0.5f * inv_samples * ((shifted[0][i] - base[i]) + (base[i + 1] - shifted[1][i + 1]));
+        }
+        if (y + 1 < height) {
+            dy[i] = 0.5f * inv_samples * ((shifted[2][i] - base[i]) + (base[i + width] - shifted[3][i + width]));
+        }
+    }
+
+    std::vector<glm::vec3> image = ScreenedPoisson(primal, dx, dy, width, height,
+        gdpt_alpha, gdpt_iterations, gdpt_l1_passes);
+    for (unsigned int i = 0; i < n_pixels; i++) {
+        stats[i].mean = glm::max(image[i], glm::vec3(0.f));
+    }
+}
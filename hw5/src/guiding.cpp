@@ -0,0 +1,295 @@
+#include "guiding.h"
+
+#include <glm/common.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+void AtomicAdd(std::atomic<float>& target, float value) {
+    float cur = target.load(std::memory_order_relaxed);
+    while (!target.compare_exchange_weak(cur, cur + value, std::memory_order_relaxed)) {}
+}
+
+static glm::vec2 DirToSquare(glm::vec3 d) {
+    float cos_theta = std::clamp(d.z, -1.f, 1.f);
+    float phi = atan2f(d.y, d.x);
+    if (phi < 0.f) {
+        phi += 2 * kPI;
+    }
+    glm::vec2 u = {0.5f * (cos_theta + 1.f), phi / (2 * kPI)};
+    return glm::clamp(u, 0.f, 0.99999994f);
+}
+
+static glm::vec3 SquareToDir(glm::vec2 u) {
+    float cos_theta = 2.f * u.x - 1.f;
+    float sin_theta = std::sqrt(std::max(0.f, 1.f - cos_theta * cos_theta));
+    float phi = 2 * kPI * u.y;
+    return {sin_theta * cosf(phi), sin_theta * sinf(phi), cos_theta};
+}
+
+///////////////
+// QUAD NODE //
+///////////////
+
+QUAD_NODE_t::QUAD_NODE_t() {
+    for (uint8_t i = 0; i < 4; ++i) {
+        sum[i].store(0.f, std::memory_order_relaxed);
+        child[i] = 0;
+    }
+}
+
+QUAD_NODE_t::QUAD_NODE_t(const QUAD_NODE_t& other) {
+    *this = other;
+}
+
+QUAD_NODE_t& QUAD_NODE_t::operator=(const QUAD_NODE_t& other) {
+    for (uint8_t i = 0; i < 4; ++i) {
+        sum[i].store(other.sum[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        child[i] = other.child[i];
+    }
+    return *this;
+}
+
+float QUAD_NODE_t::Total() const {
+    float total = 0.f;
+    for (uint8_t i = 0; i < 4; ++i) {
+        total += sum[i].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+////////////
+// DTREE  //
+////////////
+
+DTree_t::DTree_t() : nodes_(1) {}
+
+float DTree_t::Total() const {
+    return nodes_[0].Total();
+}
+
+void DTree_t::Record(glm::vec3 d, float value) {
+    if (!std::isfinite(value) || value <= 0.f) {
+        return;
+    }
+
+    glm::vec2 u = DirToSquare(d);
+    uint32_t v = 0;
+    while (true) {
+        uint8_t ix = (u.x >= 0.5f), iy = (u.y >= 0.5f);
+        uint8_t i = ix + 2 * iy;
+        AtomicAdd(nodes_[v].sum[i], value);
+        if (nodes_[v].child[i] == 0) {
+            break;
+        }
+        u = 2.f * u - glm::vec2{ix, iy};
+        v = nodes_[v].child[i];
+    }
+}
+
+glm::vec3 DTree_t::Sample(glm::vec2 u) const {
+    glm::vec2 origin = {0.f, 0.f};
+    float size = 1.f;
+    uint32_t v = 0;
+    while (true) {
+        const QUAD_NODE_t& node = nodes_[v];
+        float s[4];
+        for (uint8_t i = 0; i < 4; ++i) {
+            s[i] = node.sum[i].load(std::memory_order_relaxed);
+        }
+
+        // column first, then quadrant inside it; empty nodes are sampled uniformly
+        float total = s[0] + s[1] + s[2] + s[3];
+        float p_left = (total > 0.f ? (s[0] + s[2]) / total : 0.5f);
+        uint8_t ix = (u.x >= p_left);
+        u.x = (ix ? (u.x - p_left) / (1.f - p_left) : u.x / p_left);
+
+        float column = s[ix] + s[ix + 2];
+        float p_low = (column > 0.f ? s[ix] / column : 0.5f);
+        uint8_t iy = (u.y >= p_low);
+        u.y = (iy ? (u.y - p_low) / (1.f - p_low) : u.y / p_low);
+        u = glm::clamp(u, 0.f, 0.99999994f);
+
+        size *= 0.5f;
+        origin += size * glm::vec2{ix, iy};
+        uint8_t i = ix + 2 * iy;
+        if (node.child[i] == 0) {
+            return SquareToDir(origin + size * u);
+        }
+        v = node.child[i];
+    }
+}
+
+float DTree_t::Pdf(glm::vec3 d) const {
+    glm::vec2 u = DirToSquare(d);
+    float pdf = 1.f;
+    uint32_t v = 0;
+    while (true) {
+        const QUAD_NODE_t& node = nodes_[v];
+        uint8_t ix = (u.x >= 0.5f), iy = (u.y >= 0.5f);
+        uint8_t i = ix + 2 * iy;
+
+        float total = node.Total();
+        if (total > 0.f) {
+            pdf *= 4.f * node.sum[i].load(std::memory_order_relaxed) / total;
+        }
+        if (node.child[i] == 0 || pdf == 0.f) {
+            break;
+        }
+        u = 2.f * u - glm::vec2{ix, iy};
+        v = node.child[i];
+    }
+    return pdf / (4 * kPI);
+}
+
+DTree_t DTree_t::Refined(float rho, uint32_t max_depth) const {
+    static constexpr uint32_t kNone = -1;
+
+    DTree_t res;
+    float total = Total();
+    if (total <= 0.f) {
+        return res;
+    }
+
+    // quadrants of kNone node are parts of a leaf, they share its energy equally
+    struct ITEM_t {
+        uint32_t new_id;
+        uint32_t old_id;
+        float leaf_sum;
+        uint32_t depth;
+    };
+    std::vector<ITEM_t> stack = {{0, 0, 0.f, 1}};
+    while (!stack.empty()) {
+        ITEM_t item = stack.back();
+        stack.pop_back();
+        if (item.depth >= max_depth) {
+            continue;
+        }
+
+        for (uint8_t i = 0; i < 4; ++i) {
+            float sum = (item.old_id != kNone ? nodes_[item.old_id].sum[i].load(std::memory_order_relaxed) : 0.25f * item.leaf_sum);
+            if (sum <= rho * total) {
+                continue;
+            }
+
+            uint32_t child = res.nodes_.size();
+            res.nodes_.emplace_back();
+            res.nodes_[item.new_id].child[i] = child;
+
+            uint32_t old_child = (item.old_id != kNone ? nodes_[item.old_id].child[i] : 0);
+            stack.push_back({child, (old_child != 0 ? old_child : kNone), sum, item.depth + 1});
+        }
+    }
+    return res;
+}
+
+/////////////
+// SDTREE  //
+/////////////
+
+SDTree_t::REGION_t::REGION_t(const REGION_t& other) : sampling(other.sampling), building(other.building) {
+    n_samples.store(other.n_samples.load());
+}
+
+SDTree_t::SDTree_t(const AABB_t& bounds) : bounds_(bounds), nodes_(1), regions_(1) {}
+
+SDTree_t& SDTree_t::operator=(SDTree_t&& other) {
+    bounds_ = other.bounds_;
+    nodes_ = std::move(other.nodes_);
+    regions_ = std::move(other.regions_);
+    return *this;
+}
+
+const SDTree_t::REGION_t& SDTree_t::Lookup(glm::vec3 x) const {
+    glm::vec3 lo = bounds_.aabb_min, hi = bounds_.aabb_max;
+    x = glm::clamp(x, lo, hi);
+
+    uint32_t v = 0;
+    while (nodes_[v].child[0] != 0) {
+        glm::vec3 center = 0.5f * (lo + hi);
+        uint8_t octant = 0;
+        for (uint8_t axis = 0; axis < 3; ++axis) {
+            if (x[axis] > center[axis]) {
+                octant |= 1 << axis;
+                lo[axis] = center[axis];
+            } else {
+                hi[axis] = center[axis];
+            }
+        }
+        v = nodes_[v].child[octant];
+    }
+    return regions_[nodes_[v].region];
+}
+
+SDTree_t::REGION_t& SDTree_t::Lookup(glm::vec3 x) {
+    return const_cast<REGION_t&>(static_cast<const SDTree_t&>(*this).Lookup(x));
+}
+
+bool SDTree_t::CanSample(glm::vec3 x) const {
+    return !regions_.empty() && Lookup(x).sampling.Total() > 0.f;
+}
+
+glm::vec3 SDTree_t::Sample(glm::vec2 u, glm::vec3 x) const {
+    return Lookup(x).sampling.Sample(u);
+}
+
+float SDTree_t::Pdf(glm::vec3 x, glm::vec3 d) const {
+    return Lookup(x).sampling.Pdf(d);
+}
+
+void SDTree_t::Record(glm::vec3 x, glm::vec3 d, float value) {
+    REGION_t& region = Lookup(x);
+    region.n_samples.fetch_add(1, std::memory_order_relaxed);
+    region.building.Record(d, value);
+}
+
+void SDTree_t::Subdivide(uint32_t v, float n_samples, float threshold, uint32_t depth) {
+    if (n_samples <= threshold || depth >= kMaxSpatialDepth) {
+        return;
+    }
+
+    // children start with parent's statistics, samples are assumed to spread evenly
+    uint32_t region = nodes_[v].region;
+    for (uint8_t octant = 0; octant < 8; ++octant) {
+        OCT_NODE_t child;
+        if (octant == 0) {
+            child.region = region;
+        } else {
+            child.region = regions_.size();
+            regions_.push_back(regions_[region]);
+        }
+        nodes_[v].child[octant] = nodes_.size();
+        nodes_.push_back(child);
+    }
+    for (uint8_t octant = 0; octant < 8; ++octant) {
+        Subdivide(nodes_[v].child[octant], n_samples / 8, threshold, depth + 1);
+    }
+}
+
+void SDTree_t::Refine(uint32_t iteration) {
+    // pass number iteration traced 2^iteration samples per pixel
+    float threshold = kSplitSamples * std::sqrt((float)(1U << iteration));
+
+    std::vector<std::pair<uint32_t, uint32_t>> leaves;
+    std::vector<std::pair<uint32_t, uint32_t>> stack = {{0, 0}};
+    while (!stack.empty()) {
+        auto [v, depth] = stack.back();
+        stack.pop_back();
+        if (nodes_[v].child[0] == 0) {
+            leaves.emplace_back(v, depth);
+            continue;
+        }
+        for (uint32_t child : nodes_[v].child) {
+            stack.emplace_back(child, depth + 1);
+        }
+    }
+    for (auto [v, depth] : leaves) {
+        Subdivide(v, regions_[nodes_[v].region].n_samples.load(), threshold, depth);
+    }
+
+    for (REGION_t& region : regions_) {
+        region.sampling = region.building;
+        region.building = region.sampling.Refined(kRho, kMaxQuadDepth);
+        region.n_samples.store(0);
+    }
+}
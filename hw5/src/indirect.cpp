@@ -0,0 +1,48 @@
+#include "scene.h"
+
+void Scene::RenderIndirect(std::vector<glm::vec3>& image, const std::vector<AOV_t>& aovs) {
+    unsigned int n_pixels = cam.width * cam.height;
+    unsigned int stride = (indirect_res == INDIRECT_RES::QUARTER ? 4 : indirect_res == INDIRECT_RES::HALF ? 2 : 1);
+    // traced pixels move with frames, temporal accumulation sees all of them
+    unsigned int phase = (samples > 0 ? frame_sample_offset / samples : 0);
+
+    std::vector<uint8_t> known(n_pixels, 0);
+    std::vector<unsigned int> traced;
+    for (unsigned int i = 0; i < n_pixels; ++i) {
+        unsigned int x = i % cam.width, y = i / cam.width;
+        if (indirect_res == INDIRECT_RES::CHECKERBOARD) {
+            known[i] = ((x + y + phase) % 2 == 0);
+        } else {
+            known[i] = (x % stride == phase % stride && y % stride == (phase / stride) % stride);
+        }
+        if (known[i]) {
+            traced.push_back(i);
+        }
+    }
+
+    std::vector<glm::vec3> indirect(n_pixels, glm::vec3(0.f));
+    #pragma omp parallel for schedule(dynamic)
+    for (unsigned int k = 0; k < traced.size(); ++k) {
+        RANDOM_t random{Sampler_t(sampler_type)};
+        unsigned int x = traced[k] % cam.width;
+        unsigned int y = traced[k] / cam.width;
+        glm::vec3 sum = {0.f, 0.f, 0.f};
+        for (unsigned int sample_id = 0; sample_id < samples; ++sample_id) {
+            // sequences of their own, direct pass of this pixel used its ones
+            random.sampler.StartPixelSample(x + cam.width, y, frame_sample_offset + sample_id);
+            glm::vec2 jitter = random.sampler.Get2D();
+            PATH_t path;
+            path.indirect_only = true;
+            ray_intersection_t hit;
+            Ray ray = PrimaryRay({x + jitter.x, y + jitter.y}, path, hit);
+            sum += RayTrace(random, ray, ray_depth, path).rgb;
+        }
+        indirect[traced[k]] = sum / (float)std::max(samples, 1U);
+    }
+
+    // checkerboard pixels have known neighbours one pixel away, blocks up to stride away
+    indirect = UpsampleJointBilateral(indirect, known, aovs, cam.width, cam.height, stride);
+    for (unsigned int i = 0; i < n_pixels; ++i) {
+        image[i] += indirect[i];
+    }
+}
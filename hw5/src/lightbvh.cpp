@@ -0,0 +1,243 @@
+#include "lightbvh.h"
+
+#include <glm/gtc/quaternion.hpp>
+
+//////////
+// CONE //
+//////////
+
+static float AngleBetween(glm::vec3 a, glm::vec3 b) {
+    return acos(std::clamp(glm::dot(a, b), -1.f, 1.f));
+}
+
+CONE_t CONE_t::Union(const CONE_t& a, const CONE_t& b) {
+    float theta_e = std::max(a.theta_e, b.theta_e);
+    float theta_d = AngleBetween(a.axis, b.axis);
+
+    // one cone already contains the other
+    if (std::min(theta_d + b.theta_o, kPI) <= a.theta_o) {
+        return CONE_t{a.axis, a.theta_o, theta_e};
+    }
+    if (std::min(theta_d + a.theta_o, kPI) <= b.theta_o) {
+        return CONE_t{b.axis, b.theta_o, theta_e};
+    }
+
+    float theta_o = 0.5f * (a.theta_o + theta_d + b.theta_o);
+    if (theta_o >= kPI) {
+        return CONE_t{a.axis, kPI, theta_e};
+    }
+
+    // rotating a.axis towards b.axis so new cone touches both
+    float theta_r = theta_o - a.theta_o;
+    glm::vec3 w_r = glm::cross(a.axis, b.axis);
+    if (glm::length(w_r) < 1e-6f) {
+        return CONE_t{a.axis, kPI, theta_e};
+    }
+    glm::vec3 axis = glm::angleAxis(theta_r, glm::normalize(w_r)) * a.axis;
+    return CONE_t{glm::normalize(axis), theta_o, theta_e};
+}
+
+//////////////////
+// LIGHT BOUNDS //
+//////////////////
+
+LIGHT_BOUNDS_t::LIGHT_BOUNDS_t(const Primitive& prim, uint32_t light_id) : aabb(prim), light_id(light_id) {
+    // flat emitters (triangles, thin boxes) must still be hit by ray-AABB test
+    static constexpr float pad = 1e-4;
+    aabb.aabb_min = aabb.aabb_min - glm::vec3{pad, pad, pad};
+    aabb.aabb_max = aabb.aabb_max + glm::vec3{pad, pad, pad};
+
+    // all our emitters are two-sided or closed, so normals cover whole sphere
+    cone = CONE_t{{0.f, 0.f, 1.f}, kPI, 0.5f * kPI};
+    power = kPI * Luminance(prim.emission) * prim.Area();
+}
+
+void LIGHT_BOUNDS_t::Extend(const LIGHT_BOUNDS_t& other) {
+    aabb.Extend(other.aabb);
+    cone = CONE_t::Union(cone, other.cone);
+    power += other.power;
+}
+
+float LIGHT_BOUNDS_t::Importance(glm::vec3 x, glm::vec3 n) const {
+    glm::vec3 center = 0.5f * (aabb.aabb_min + aabb.aabb_max);
+    float radius2 = glm::distance2(aabb.aabb_max, center);
+    float dist2 = glm::distance2(x, center);
+
+    // theta_b - angle of sphere bounding aabb as seen from x
+    float theta_b = kPI;
+    if (dist2 > radius2) {
+        theta_b = asin(std::sqrt(radius2 / dist2));
+    }
+    glm::vec3 wi = (dist2 > 0.f ? (x - center) / std::sqrt(dist2) : n);
+
+    // angle between cone and x, reduced by bounds of normals and of aabb
+    float theta_w = AngleBetween(cone.axis, wi);
+    float theta_p = std::max(0.f, theta_w - cone.theta_o - theta_b);
+    if (theta_p >= cone.theta_e) {
+        return 0.f;
+    }
+
+    // receiver cosine, x only gathers light from hemisphere around n; zero n (media) - whole sphere
+    float cos_ip = 1.f;
+    if (n != glm::vec3(0.f)) {
+        float theta_i = AngleBetween(n, -1.f * wi);
+        float theta_ip = std::max(0.f, theta_i - theta_b);
+        cos_ip = std::max(0.f, cosf(theta_ip));
+    }
+
+    dist2 = std::max(dist2, radius2);
+    return power * std::max(0.f, cosf(theta_p)) * cos_ip / dist2;
+}
+
+///////////////
+// LIGHT BVH //
+///////////////
+
+static float EvaluateCost(const LIGHT_BOUNDS_t& b, const AABB_t& node_aabb, uint8_t axis) {
+    float theta_o = b.cone.theta_o;
+    float theta_w = std::min(theta_o + b.cone.theta_e, kPI);
+    float sin_o = sinf(theta_o), cos_o = cosf(theta_o);
+    float m_omega = 2 * kPI * (1 - cos_o) +
+        kPI / 2 * (2 * theta_w * sin_o - cosf(theta_o - 2 * theta_w) - 2 * theta_o * sin_o + cos_o);
+
+    glm::vec3 diag = node_aabb.aabb_max - node_aabb.aabb_min;
+    float k_r = std::max({diag.x, diag.y, diag.z}) / std::max(diag[axis], 1e-6f);
+
+    AABB_t aabb = b.aabb;
+    return b.power * m_omega * k_r * aabb.CalcS();
+}
+
+LightBVH_t::LightBVH_t(std::vector<LIGHT_BOUNDS_t> lights) {
+    if (lights.empty()) {
+        return;
+    }
+    nodes.reserve(2 * lights.size());
+    InitTree(lights, 0, lights.size());
+}
+
+bool LightBVH_t::Empty() const {
+    return nodes.empty();
+}
+
+uint32_t LightBVH_t::InitTree(std::vector<LIGHT_BOUNDS_t>& lights, uint32_t first, uint32_t last) {
+    LIGHT_NODE_t cur_node;
+    cur_node.bounds = lights[first];
+    AABB_t centroids{};
+    for (uint32_t i = first; i < last; ++i) {
+        if (i != first) {
+            cur_node.bounds.Extend(lights[i]);
+        }
+        centroids.Extend(0.5f * (lights[i].aabb.aabb_min + lights[i].aabb.aabb_max));
+    }
+    cur_node.left_child = -1; // 4294967295U
+    cur_node.right_child = -1; // 4294967295U
+
+    uint32_t cur_pos = nodes.size();
+    nodes.push_back(cur_node);
+
+    if (last - first == 1) {
+        return cur_pos;
+    }
+
+    auto bucket_of = [&centroids](const LIGHT_BOUNDS_t& light, uint8_t axis) {
+        float c = 0.5f * (light.aabb.aabb_min[axis] + light.aabb.aabb_max[axis]);
+        float extent = centroids.aabb_max[axis] - centroids.aabb_min[axis];
+        uint32_t b = kBuckets * ((c - centroids.aabb_min[axis]) / extent);
+        return std::min(b, kBuckets - 1);
+    };
+
+    // binned surface area orientation heuristic
+    float optimum = INF;
+    uint8_t best_axis = 0;
+    uint32_t best_bucket = 0;
+    for (uint8_t axis = 0; axis < 3; ++axis) {
+        if (centroids.aabb_max[axis] <= centroids.aabb_min[axis]) {
+            continue;
+        }
+
+        LIGHT_BOUNDS_t buckets[kBuckets];
+        uint32_t counts[kBuckets] = {};
+        for (uint32_t i = first; i < last; ++i) {
+            uint32_t b = bucket_of(lights[i], axis);
+            if (counts[b]++ == 0) {
+                buckets[b] = lights[i];
+            } else {
+                buckets[b].Extend(lights[i]);
+            }
+        }
+
+        for (uint32_t cut = 1; cut < kBuckets; ++cut) {
+            LIGHT_BOUNDS_t left, right;
+            uint32_t cnt_left = 0, cnt_right = 0;
+            for (uint32_t b = 0; b < kBuckets; ++b) {
+                if (counts[b] == 0) {
+                    continue;
+                }
+                LIGHT_BOUNDS_t& side = (b < cut ? left : right);
+                uint32_t& cnt = (b < cut ? cnt_left : cnt_right);
+                if (cnt == 0) {
+                    side = buckets[b];
+                } else {
+                    side.Extend(buckets[b]);
+                }
+                cnt += counts[b];
+            }
+            if (cnt_left == 0 || cnt_right == 0) {
+                continue;
+            }
+
+            float cost = EvaluateCost(left, cur_node.bounds.aabb, axis) + EvaluateCost(right, cur_node.bounds.aabb, axis);
+            if (cost < optimum) {
+                optimum = cost;
+                best_axis = axis;
+                best_bucket = cut;
+            }
+        }
+    }
+
+    uint32_t cut;
+    if (optimum < INF) {
+        cut = std::partition(lights.begin() + first, lights.begin() + last, [&](const LIGHT_BOUNDS_t& light) {
+            return bucket_of(light, best_axis) < best_bucket;
+        }) - lights.begin();
+    } else {
+        // all centroids coincide - splitting in half
+        cut = (first + last) / 2;
+    }
+
+    uint32_t left_child = InitTree(lights, first, cut);
+    uint32_t right_child = InitTree(lights, cut, last);
+    nodes[cur_pos].left_child = left_child;
+    nodes[cur_pos].right_child = right_child;
+    return cur_pos;
+}
+
+float LightBVH_t::ChildProb(uint32_t v, glm::vec3 x, glm::vec3 n) const {
+    float i_left = nodes[nodes[v].left_child].bounds.Importance(x, n);
+    float i_right = nodes[nodes[v].right_child].bounds.Importance(x, n);
+    if (i_left + i_right <= 0.f) {
+        // keeps sampling and pdf consistent when bounds are too rough
+        return 0.5f;
+    }
+    return i_left / (i_left + i_right);
+}
+
+std::pair<uint32_t, float> LightBVH_t::Sample(float u, glm::vec3 x, glm::vec3 n) const {
+    assert(!Empty());
+
+    uint32_t v = 0;
+    float prob = 1.f;
+    while (nodes[v].left_child != (uint32_t)-1) {
+        float p_left = ChildProb(v, x, n);
+        if (u < p_left) {
+            u = std::min(u / p_left, 0.99999994f);
+            prob *= p_left;
+            v = nodes[v].left_child;
+        } else {
+            u = std::min((u - p_left) / (1.f - p_left), 0.99999994f);
+            prob *= 1.f - p_left;
+            v = nodes[v].right_child;
+        }
+    }
+    return {nodes[v].bounds.light_id, prob};
+}
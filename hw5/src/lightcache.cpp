@@ -0,0 +1,80 @@
+#include "lightcache.h"
+#include "radiancecache.h"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <cmath>
+
+LightCache_t::LightCache_t(float cell_size, uint32_t n_lights)
+    : cell_size_(cell_size), n_lights_(n_lights), probes_(omp_get_max_threads()) {}
+
+bool LightCache_t::Empty() const {
+    return n_lights_ == 0;
+}
+
+void LightCache_t::Record(glm::vec3 x, glm::vec3 n, uint32_t light, float contribution) {
+    if (Empty() || !std::isfinite(contribution)) {
+        return;
+    }
+    probes_[omp_get_thread_num()].push_back({CellKey(x, n, cell_size_), light, contribution});
+}
+
+void LightCache_t::Build(uint32_t min_probes) {
+    std::vector<PROBE_t> probes;
+    for (auto& local : probes_) {
+        probes.insert(probes.end(), local.begin(), local.end());
+        std::vector<PROBE_t>().swap(local);
+    }
+    std::sort(probes.begin(), probes.end(), [](const PROBE_t& a, const PROBE_t& b) {
+        return a.key < b.key;
+    });
+
+    std::vector<float> sum(n_lights_);
+    std::vector<uint32_t> count(n_lights_);
+    for (size_t first = 0; first < probes.size();) {
+        size_t last = first;
+        while (last < probes.size() && probes[last].key == probes[first].key) {
+            ++last;
+        }
+        if (last - first < min_probes) {
+            first = last;
+            continue;
+        }
+
+        std::fill(sum.begin(), sum.end(), 0.f);
+        std::fill(count.begin(), count.end(), 0);
+        for (size_t i = first; i < last; ++i) {
+            sum[probes[i].light] += probes[i].contribution;
+            ++count[probes[i].light];
+        }
+        // emitters never probed in cell get mean of probed ones, not zero
+        float total = 0.f;
+        uint32_t probed = 0;
+        for (uint32_t light = 0; light < n_lights_; ++light) {
+            if (count[light] > 0) {
+                sum[light] /= count[light];
+                total += sum[light];
+                ++probed;
+            }
+        }
+        if (total > 0.f) {
+            for (uint32_t light = 0; light < n_lights_; ++light) {
+                if (count[light] == 0) {
+                    sum[light] = total / probed;
+                }
+            }
+            cell_of_[probes[first].key] = tables_.size();
+            tables_.emplace_back(sum);
+        }
+        first = last;
+    }
+}
+
+const AliasTable_t* LightCache_t::Table(glm::vec3 x, glm::vec3 n) const {
+    if (cell_of_.empty()) {
+        return nullptr;
+    }
+    auto it = cell_of_.find(CellKey(x, n, cell_size_));
+    return (it == cell_of_.end() ? nullptr : &tables_[it->second]);
+}
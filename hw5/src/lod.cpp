@@ -0,0 +1,307 @@
+#include "lod.h"
+
+#include <glm/geometric.hpp>
+#include <glm/matrix.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/mat3x3.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+////////////////////////
+// QEM SIMPLIFICATION //
+////////////////////////
+
+struct QEM_VERTEX_t {
+    glm::dvec3 p;
+    glm::dmat4 q = glm::dmat4(0.0);
+    std::vector<uint32_t> faces;
+    uint32_t version = 0;
+    bool alive = true;
+};
+
+struct QEM_FACE_t {
+    uint32_t v[3];
+    bool alive = true;
+};
+
+// collapse of edge (a, b) into p, stale once version of either end changed
+struct QEM_EDGE_t {
+    double cost;
+    uint32_t a, b;
+    uint32_t version_a, version_b;
+    glm::dvec3 p;
+
+    bool operator>(const QEM_EDGE_t& other) const {
+        return cost > other.cost;
+    }
+};
+
+static double QuadricError(const glm::dmat4& q, glm::dvec3 p) {
+    glm::dvec4 v = {p, 1.0};
+    return glm::dot(v, q * v);
+}
+
+static glm::dvec3 FaceCross(const std::vector<QEM_VERTEX_t>& verts, const QEM_FACE_t& f) {
+    return glm::cross(verts[f.v[1]].p - verts[f.v[0]].p, verts[f.v[2]].p - verts[f.v[0]].p);
+}
+
+std::vector<SOUP_t> SimplifyQEM(const SOUP_t& soup, const std::vector<size_t>& targets) {
+    // determinant below which minimizer is not trusted (flat or line-like neighbourhood)
+    static constexpr double min_det = 1e-12;
+    // collapse may turn face normal by at most this much (cosine)
+    static constexpr double min_normal_cos = 0.2;
+
+    // weld vertices by exact position
+    std::vector<QEM_VERTEX_t> verts;
+    std::vector<QEM_FACE_t> faces;
+    std::unordered_map<std::string, uint32_t> index;
+    for (size_t i = 0; i + 2 < soup.size(); i += 3) {
+        QEM_FACE_t f;
+        for (uint8_t j = 0; j < 3; ++j) {
+            std::string key(reinterpret_cast<const char*>(&soup[i + j]), sizeof(glm::vec3));
+            auto [it, inserted] = index.emplace(key, verts.size());
+            if (inserted) {
+                QEM_VERTEX_t v;
+                v.p = soup[i + j];
+                verts.push_back(v);
+            }
+            f.v[j] = it->second;
+        }
+        if (f.v[0] == f.v[1] || f.v[1] == f.v[2] || f.v[0] == f.v[2]) {
+            continue;
+        }
+        faces.push_back(f);
+    }
+
+    for (uint32_t id = 0; id < faces.size(); ++id) {
+        const QEM_FACE_t& f = faces[id];
+        glm::dvec3 n = FaceCross(verts, f);
+        double area2 = glm::length(n);
+        if (area2 > 0.0) {
+            n /= area2;
+        }
+        // area-weighted plane quadric
+        glm::dvec4 plane = {n, -glm::dot(n, verts[f.v[0]].p)};
+        glm::dmat4 q = glm::outerProduct(plane, plane) * (0.5 * area2);
+        for (uint8_t j = 0; j < 3; ++j) {
+            verts[f.v[j]].q += q;
+            verts[f.v[j]].faces.push_back(id);
+        }
+    }
+
+    auto make_edge = [&](uint32_t a, uint32_t b) {
+        glm::dmat4 q = verts[a].q + verts[b].q;
+        glm::dmat3 m = glm::dmat3(q);
+        glm::dvec3 p;
+        double cost;
+        if (std::abs(glm::determinant(m)) > min_det) {
+            p = glm::inverse(m) * -glm::dvec3(q[3]);
+            cost = QuadricError(q, p);
+        } else {
+            // best of ends and midpoint
+            glm::dvec3 candidates[3] = {verts[a].p, verts[b].p, 0.5 * (verts[a].p + verts[b].p)};
+            p = candidates[0];
+            cost = QuadricError(q, p);
+            for (uint8_t j = 1; j < 3; ++j) {
+                double c = QuadricError(q, candidates[j]);
+                if (c < cost) {
+                    cost = c;
+                    p = candidates[j];
+                }
+            }
+        }
+        return QEM_EDGE_t{cost, a, b, verts[a].version, verts[b].version, p};
+    };
+
+    std::priority_queue<QEM_EDGE_t, std::vector<QEM_EDGE_t>, std::greater<QEM_EDGE_t>> heap;
+    std::unordered_set<uint64_t> seen;
+    for (const QEM_FACE_t& f : faces) {
+        for (uint8_t j = 0; j < 3; ++j) {
+            uint32_t a = std::min(f.v[j], f.v[(j + 1) % 3]), b = std::max(f.v[j], f.v[(j + 1) % 3]);
+            if (seen.insert(((uint64_t)a << 32) | b).second) {
+                heap.push(make_edge(a, b));
+            }
+        }
+    }
+
+    // would moving vertex v to p flip any of its faces, faces with skip are removed by collapse
+    auto flips = [&](uint32_t v, uint32_t skip, glm::dvec3 p) {
+        for (uint32_t id : verts[v].faces) {
+            const QEM_FACE_t& f = faces[id];
+            if (!f.alive || f.v[0] == skip || f.v[1] == skip || f.v[2] == skip) {
+                continue;
+            }
+            glm::dvec3 before = FaceCross(verts, f);
+            glm::dvec3 moved[3];
+            for (uint8_t j = 0; j < 3; ++j) {
+                moved[j] = (f.v[j] == v ? p : verts[f.v[j]].p);
+            }
+            glm::dvec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+            double len = glm::length(before) * glm::length(after);
+            if (len <= 0.0 || glm::dot(before, after) < min_normal_cos * len) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    auto snapshot = [&]() {
+        SOUP_t out;
+        for (const QEM_FACE_t& f : faces) {
+            if (f.alive) {
+                for (uint8_t j = 0; j < 3; ++j) {
+                    out.push_back(glm::vec3(verts[f.v[j]].p));
+                }
+            }
+        }
+        return out;
+    };
+
+    std::vector<SOUP_t> levels;
+    size_t alive_faces = faces.size();
+    for (size_t target : targets) {
+        while (alive_faces > target && !heap.empty()) {
+            QEM_EDGE_t e = heap.top();
+            heap.pop();
+            QEM_VERTEX_t& a = verts[e.a];
+            QEM_VERTEX_t& b = verts[e.b];
+            if (!a.alive || !b.alive || a.version != e.version_a || b.version != e.version_b) {
+                continue;
+            }
+            if (flips(e.a, e.b, e.p) || flips(e.b, e.a, e.p)) {
+                // edge comes back once its neighbourhood changes
+                continue;
+            }
+
+            // b goes into a, faces with both ends degenerate
+            a.p = e.p;
+            a.q += b.q;
+            for (uint32_t id : b.faces) {
+                QEM_FACE_t& f = faces[id];
+                if (!f.alive) {
+                    continue;
+                }
+                bool has_a = (f.v[0] == e.a || f.v[1] == e.a || f.v[2] == e.a);
+                if (has_a) {
+                    f.alive = false;
+                    --alive_faces;
+                    continue;
+                }
+                for (uint8_t j = 0; j < 3; ++j) {
+                    if (f.v[j] == e.b) {
+                        f.v[j] = e.a;
+                    }
+                }
+                a.faces.push_back(id);
+            }
+            b.alive = false;
+            b.faces.clear();
+            a.faces.erase(std::remove_if(a.faces.begin(), a.faces.end(), [&](uint32_t id) {
+                return !faces[id].alive;
+            }), a.faces.end());
+            ++a.version;
+
+            std::vector<uint32_t> neighbours;
+            for (uint32_t id : a.faces) {
+                for (uint32_t v : faces[id].v) {
+                    if (v != e.a) {
+                        neighbours.push_back(v);
+                    }
+                }
+            }
+            std::sort(neighbours.begin(), neighbours.end());
+            neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+            for (uint32_t v : neighbours) {
+                heap.push(make_edge(std::min(e.a, v), std::max(e.a, v)));
+            }
+        }
+        levels.push_back(snapshot());
+    }
+    return levels;
+}
+
+//////////////
+// LOD MESH //
+//////////////
+
+static float MeanEdge(const SOUP_t& soup) {
+    double sum = 0.0;
+    for (size_t i = 0; i + 2 < soup.size(); i += 3) {
+        sum += glm::length(soup[i + 1] - soup[i]) + glm::length(soup[i + 2] - soup[i + 1]) +
+               glm::length(soup[i] - soup[i + 2]);
+    }
+    return (soup.empty() ? 0.f : (float)(sum / soup.size()));
+}
+
+LodMesh_t::LodMesh_t(std::vector<Primitive>& primitives, uint32_t first, uint32_t last, unsigned int levels)
+        : first_(first), bvh_(primitives, first, last) {
+    // proxy with fewer triangles than this is not worth its BVH
+    static constexpr size_t min_triangles = 16;
+
+    SOUP_t soup;
+    for (uint32_t id = first; id < last; ++id) {
+        const Primitive& prim = primitives[id];
+        soup.push_back(prim.dop_data);
+        soup.push_back(prim.dop_data1);
+        soup.push_back(prim.dop_data2);
+        bounds_.Extend(AABB_t{prim});
+    }
+    edge_.push_back(MeanEdge(soup));
+
+    std::vector<size_t> targets;
+    for (size_t n = (last - first) / 4; targets.size() < levels && n >= min_triangles; n /= 4) {
+        targets.push_back(n);
+    }
+    for (const SOUP_t& level : SimplifyQEM(soup, targets)) {
+        if (level.empty()) {
+            break;
+        }
+        std::vector<Primitive> proxy;
+        for (size_t i = 0; i + 2 < level.size(); i += 3) {
+            Primitive prim = primitives[first];
+            prim.dop_data = level[i];
+            prim.dop_data1 = level[i + 1];
+            prim.dop_data2 = level[i + 2];
+            proxy.push_back(prim);
+        }
+        edge_.push_back(MeanEdge(level));
+        proxy_bvhs_.emplace_back(proxy, proxy.size());
+        proxies_.push_back(std::move(proxy));
+    }
+}
+
+unsigned int LodMesh_t::Levels() const {
+    return proxies_.size() + 1;
+}
+
+unsigned int LodMesh_t::Level(float width) const {
+    for (unsigned int level = Levels() - 1; level > 0; --level) {
+        if (edge_[level] <= width) {
+            return level;
+        }
+    }
+    return 0;
+}
+
+float LodMesh_t::Distance(glm::vec3 p) const {
+    glm::vec3 d = glm::max(glm::max(bounds_.aabb_min - p, p - bounds_.aabb_max), glm::vec3(0.f));
+    return glm::length(d);
+}
+
+ray_intersection_t LodMesh_t::Intersect(const std::vector<Primitive>& primitives, const Ray& ray, float closest_dist,
+        unsigned int level) const {
+    if (level == 0) {
+        return bvh_.Intersect(primitives, ray, closest_dist);
+    }
+    ray_intersection_t isec = proxy_bvhs_[level - 1].Intersect(proxies_[level - 1], ray, closest_dist);
+    if (isec.id != -1) {
+        isec.id = first_;
+        isec.lod = level;
+    }
+    return isec;
+}
@@ -4,15 +4,24 @@
 #include <iostream>
 
 int main(int argc, const char *argv[]) {
-    (void) argc;
-
     std::ifstream in(argv[1]);
-    std::ofstream out(argv[2]);
 
     Scene scene;
     scene.Load(in);
     scene.InitScene();
-    scene.Render(out);
+    if (scene.animation_frames > 0) {
+        // second argument is prefix of frame files then
+        scene.RenderAnimation(argv[2]);
+    } else {
+        std::ofstream out(argv[2]);
+        scene.Render(out);
+    }
+
+    // optional third argument - where to put map of samples spent per pixel
+    if (argc > 3) {
+        std::ofstream samples_out(argv[3]);
+        scene.WriteSamplesMap(samples_out);
+    }
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,110 @@
+#include "pfm.h"
+
+#include <glm/vec3.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// 8-bit binary PPM, values are taken as gamma 2.2 as render output writes them
+static bool ReadPPM(const std::string& path, std::vector<glm::vec3>& image, unsigned int& width, unsigned int& height) {
+    std::ifstream in(path, std::ios::binary);
+    std::string magic;
+    unsigned int max_value = 0;
+    if (!(in >> magic >> width >> height >> max_value) || magic != "P6" || max_value == 0 || max_value > 255) {
+        return false;
+    }
+    in.get();
+    std::vector<unsigned char> bytes((size_t)3 * width * height);
+    if (!in.read(reinterpret_cast<char*>(bytes.data()), bytes.size())) {
+        return false;
+    }
+    image.resize((size_t)width * height);
+    for (size_t i = 0; i < image.size(); ++i) {
+        for (uint8_t c = 0; c < 3; ++c) {
+            image[i][c] = std::pow(bytes[3 * i + c] / (float)max_value, 2.2f);
+        }
+    }
+    return true;
+}
+
+// 2x2 box filter, odd border texel is averaged with itself
+static std::vector<glm::vec3> Downsample(const std::vector<glm::vec3>& image, unsigned int width, unsigned int height) {
+    unsigned int w = std::max(1U, width >> 1), h = std::max(1U, height >> 1);
+    std::vector<glm::vec3> out((size_t)w * h);
+    for (unsigned int y = 0; y < h; ++y) {
+        for (unsigned int x = 0; x < w; ++x) {
+            unsigned int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+            unsigned int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+            out[(size_t)y * w + x] = 0.25f * (image[(size_t)y0 * width + x0] + image[(size_t)y0 * width + x1] +
+                                              image[(size_t)y1 * width + x0] + image[(size_t)y1 * width + x1]);
+        }
+    }
+    return out;
+}
+
+/*
+    Converts PPM or PFM image into tiled mip-mapped texture read by Texture_t.
+    maketx <in.ppm|in.pfm> <out.tx> [tile size, 64 by default]
+*/
+int main(int argc, const char *argv[]) {
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0] << " <in.ppm|in.pfm> <out.tx> [tile]" << std::endl;
+        return 1;
+    }
+    unsigned int tile = (argc > 3 ? std::stoul(argv[3]) : 64);
+
+    std::string path = argv[1];
+    std::vector<glm::vec3> image;
+    unsigned int width = 0, height = 0;
+    std::vector<float> data;
+    uint8_t channels = 0;
+    if (ReadPFM(path, data, width, height, channels)) {
+        image.resize((size_t)width * height);
+        for (size_t i = 0; i < image.size(); ++i) {
+            image[i] = (channels == 3 ? glm::vec3(data[3 * i], data[3 * i + 1], data[3 * i + 2]) : glm::vec3(data[i]));
+        }
+    } else if (!ReadPPM(path, image, width, height)) {
+        std::cerr << "unexpected image(" << path << ")" << std::endl;
+        return 1;
+    }
+
+    unsigned int levels = 1;
+    while ((std::max(width, height) >> (levels - 1)) > 1) {
+        ++levels;
+    }
+
+    std::ofstream out(argv[2], std::ios::binary);
+    out << "TX " << width << " " << height << " " << tile << " " << levels << "\n";
+    std::vector<float> buffer((size_t)3 * tile * tile);
+    unsigned int w = width, h = height;
+    for (unsigned int level = 0; level < levels; ++level) {
+        for (unsigned int ty = 0; ty * tile < h; ++ty) {
+            for (unsigned int tx = 0; tx * tile < w; ++tx) {
+                std::fill(buffer.begin(), buffer.end(), 0.f);
+                for (unsigned int y = 0; y < tile && ty * tile + y < h; ++y) {
+                    for (unsigned int x = 0; x < tile && tx * tile + x < w; ++x) {
+                        glm::vec3 texel = image[(size_t)(ty * tile + y) * w + tx * tile + x];
+                        for (uint8_t c = 0; c < 3; ++c) {
+                            buffer[3 * (y * tile + x) + c] = texel[c];
+                        }
+                    }
+                }
+                out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(float));
+            }
+        }
+        if (level + 1 < levels) {
+            image = Downsample(image, w, h);
+            w = std::max(1U, w >> 1);
+            h = std::max(1U, h >> 1);
+        }
+    }
+    if (!out) {
+        std::cerr << "unexpected texture file(" << argv[2] << ")" << std::endl;
+        return 1;
+    }
+    return 0;
+}
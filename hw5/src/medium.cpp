@@ -0,0 +1,227 @@
+#include "medium.h"
+#include "distributions.h"
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/ext/vector_int3.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+bool LoadDensityGrid(const std::string& path, std::vector<float>& density, glm::uvec3& resolution) {
+    std::ifstream in(path, std::ios::binary);
+    std::string magic;
+    if (!(in >> magic >> resolution.x >> resolution.y >> resolution.z) || magic != "VOL" ||
+            resolution.x == 0 || resolution.y == 0 || resolution.z == 0) {
+        return false;
+    }
+    // single whitespace ends header
+    in.get();
+    density.resize((size_t)resolution.x * resolution.y * resolution.z);
+    in.read(reinterpret_cast<char*>(density.data()), density.size() * sizeof(float));
+    return (bool)in;
+}
+
+Medium_t::Medium_t(const Primitive& box, std::vector<float> density, glm::uvec3 resolution)
+    : pos_(box.pos), rotator_(box.rotator), half_size_(box.dop_data), albedo_(box.col.rgb),
+      sigma_t_(box.sigma_t), g_(std::clamp(box.phase_g, -0.99f, 0.99f)), density_(std::move(density)) {
+    if (density_.empty()) {
+        majorant_ = {sigma_t_};
+        return;
+    }
+    resolution_ = resolution;
+    bricks_ = (resolution_ + kBrick - 1U) / kBrick;
+    majorant_.assign((size_t)bricks_.x * bricks_.y * bricks_.z, 0.f);
+
+    // trilinear lookups inside brick reach one voxel past its border
+    for (uint32_t bz = 0; bz < bricks_.z; ++bz) {
+        for (uint32_t by = 0; by < bricks_.y; ++by) {
+            for (uint32_t bx = 0; bx < bricks_.x; ++bx) {
+                glm::uvec3 b = {bx, by, bz};
+                glm::ivec3 lo = glm::max(glm::ivec3(b * kBrick) - 1, 0);
+                glm::ivec3 hi = glm::min(glm::ivec3((b + 1U) * kBrick), glm::ivec3(resolution_) - 1);
+                float max_density = 0.f;
+                for (int z = lo.z; z <= hi.z; ++z) {
+                    for (int y = lo.y; y <= hi.y; ++y) {
+                        for (int x = lo.x; x <= hi.x; ++x) {
+                            max_density = std::max(max_density, density_[x + resolution_.x * (y + (size_t)resolution_.y * z)]);
+                        }
+                    }
+                }
+                majorant_[bx + bricks_.x * (by + (size_t)bricks_.y * bz)] = sigma_t_ * max_density;
+            }
+        }
+    }
+}
+
+glm::vec3 Medium_t::Albedo() const {
+    return albedo_;
+}
+
+float Medium_t::SigmaT(glm::vec3 local) const {
+    if (density_.empty()) {
+        return sigma_t_;
+    }
+    // voxel i is centred at i + 0.5 of grid coordinates
+    glm::vec3 g = (local + half_size_) / (2.f * half_size_) * glm::vec3(resolution_) - 0.5f;
+    glm::vec3 base = glm::floor(g);
+    glm::vec3 f = g - base;
+    glm::ivec3 i0 = glm::ivec3(base);
+    glm::ivec3 max_index = glm::ivec3(resolution_) - 1;
+
+    float value = 0.f;
+    for (uint8_t corner = 0; corner < 8; ++corner) {
+        glm::ivec3 offset = {corner & 1, (corner >> 1) & 1, (corner >> 2) & 1};
+        glm::ivec3 v = glm::clamp(i0 + offset, glm::ivec3(0), max_index);
+        float w = (offset.x ? f.x : 1.f - f.x) * (offset.y ? f.y : 1.f - f.y) * (offset.z ? f.z : 1.f - f.z);
+        value += w * density_[v.x + resolution_.x * (v.y + (size_t)resolution_.y * v.z)];
+    }
+    return sigma_t_ * value;
+}
+
+bool Medium_t::Clip(const Ray& ray, float t_max, Ray& local, float& t0, float& t1) const {
+    local = rotate(glm::conjugate(rotator_), (ray + -1.f * pos_));
+    t0 = 0.f;
+    t1 = t_max;
+    for (uint8_t axis = 0; axis < 3; ++axis) {
+        if (local.d[axis] == 0.f) {
+            if (std::abs(local.o[axis]) > half_size_[axis]) {
+                return false;
+            }
+            continue;
+        }
+        float ta = (-half_size_[axis] - local.o[axis]) / local.d[axis];
+        float tb = (half_size_[axis] - local.o[axis]) / local.d[axis];
+        t0 = std::max(t0, std::min(ta, tb));
+        t1 = std::min(t1, std::max(ta, tb));
+    }
+    return t0 < t1;
+}
+
+template <class F>
+void Medium_t::WalkBricks(const Ray& local, float t0, float t1, F visit) const {
+    // brick coordinates of ray, Amanatides-Woo traversal
+    glm::vec3 k = glm::vec3(resolution_) / (2.f * half_size_ * (float)kBrick);
+    glm::vec3 q0 = (local.o + t0 * local.d + half_size_) * k;
+    glm::vec3 dq = local.d * k;
+    glm::ivec3 n_bricks = glm::ivec3(bricks_);
+    glm::ivec3 cell = glm::clamp(glm::ivec3(glm::floor(q0)), glm::ivec3(0), n_bricks - 1);
+
+    glm::ivec3 step;
+    glm::vec3 t_next, t_delta;
+    for (uint8_t axis = 0; axis < 3; ++axis) {
+        step[axis] = (dq[axis] >= 0.f ? 1 : -1);
+        if (dq[axis] == 0.f) {
+            t_next[axis] = t_delta[axis] = INFINITY;
+            continue;
+        }
+        float border = cell[axis] + (step[axis] > 0 ? 1.f : 0.f);
+        t_next[axis] = t0 + (border - q0[axis]) / dq[axis];
+        t_delta[axis] = std::abs(1.f / dq[axis]);
+    }
+
+    float t = t0;
+    while (true) {
+        uint8_t axis = (t_next.x < t_next.y ? (t_next.x < t_next.z ? 0 : 2) : (t_next.y < t_next.z ? 1 : 2));
+        float t_exit = std::min(t_next[axis], t1);
+        float majorant = majorant_[cell.x + n_bricks.x * (cell.y + (size_t)n_bricks.y * cell.z)];
+        if (!visit(t, t_exit, majorant) || t_exit >= t1) {
+            return;
+        }
+        t = t_exit;
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= n_bricks[axis]) {
+            return;
+        }
+        t_next[axis] += t_delta[axis];
+    }
+}
+
+float Medium_t::SampleDistance(Sampler_t& sampler, const Ray& ray, float t_max) const {
+    Ray local;
+    float t0, t1;
+    if (!Clip(ray, t_max, local, t0, t1)) {
+        return t_max;
+    }
+    // sigma_t is per unit length, ray parameter may not be
+    float scale = glm::length(local.d);
+    float collision = t_max;
+    WalkBricks(local, t0, t1, [&](float ta, float tb, float majorant) {
+        float m = majorant * scale;
+        if (m <= 0.f) {
+            return true;
+        }
+        // tentative collisions against majorant, real ones with probability sigma_t / majorant
+        for (float t = ta;;) {
+            t -= std::log(1.f - sampler.Get1D()) / m;
+            if (t >= tb) {
+                return true;
+            }
+            if (sampler.Get1D() * m < SigmaT(local.o + t * local.d) * scale) {
+                collision = t;
+                return false;
+            }
+        }
+    });
+    return collision;
+}
+
+float Medium_t::Transmittance(Sampler_t& sampler, const Ray& ray, float t_max) const {
+    // estimate below which it survives roulette with probability 1/2
+    static constexpr float roulette_threshold = 0.1f;
+
+    Ray local;
+    float t0, t1;
+    if (!Clip(ray, t_max, local, t0, t1)) {
+        return 1.f;
+    }
+    float scale = glm::length(local.d);
+    float transmittance = 1.f;
+    WalkBricks(local, t0, t1, [&](float ta, float tb, float majorant) {
+        float m = majorant * scale;
+        if (m <= 0.f) {
+            return true;
+        }
+        // every tentative collision keeps null share of majorant
+        for (float t = ta;;) {
+            t -= std::log(1.f - sampler.Get1D()) / m;
+            if (t >= tb) {
+                return true;
+            }
+            transmittance *= 1.f - SigmaT(local.o + t * local.d) * scale / m;
+            if (transmittance < roulette_threshold) {
+                if (sampler.Get1D() < 0.5f) {
+                    transmittance = 0.f;
+                    return false;
+                }
+                transmittance *= 2.f;
+            }
+        }
+    });
+    return transmittance;
+}
+
+float Medium_t::Phase(glm::vec3 wo, glm::vec3 wi) const {
+    // angle between propagation directions -wo and wi
+    float cos = -glm::dot(wo, wi);
+    float denom = 1.f + g_ * g_ - 2.f * g_ * cos;
+    return (1.f - g_ * g_) / (4.f * kPI * denom * std::sqrt(denom));
+}
+
+glm::vec3 Medium_t::SamplePhase(glm::vec3 wo, glm::vec2 u) const {
+    float cos;
+    if (std::abs(g_) < 1e-3f) {
+        cos = 1.f - 2.f * u.x;
+    } else {
+        float sqr = (1.f - g_ * g_) / (1.f + g_ - 2.f * g_ * u.x);
+        cos = (1.f + g_ * g_ - sqr * sqr) / (2.f * g_);
+    }
+    cos = std::clamp(cos, -1.f, 1.f);
+    float sin = std::sqrt(std::max(0.f, 1.f - cos * cos));
+    float phi = 2.f * kPI * u.y;
+
+    glm::vec3 w = -1.f * wo, t, b;
+    BuildBasis(w, t, b);
+    return sin * std::cos(phi) * t + sin * std::sin(phi) * b + cos * w;
+}
@@ -0,0 +1,209 @@
+#include "microfacet.h"
+#include "distributions.h"
+
+#include <algorithm>
+#include <cmath>
+
+Microfacet_t::Microfacet_t(const Primitive& prim, glm::vec3 col, glm::vec3 n, bool interior) {
+    // very small alpha makes D overflow, such surface is smooth anyway
+    static constexpr float min_alpha = 1e-3;
+    alpha_ = std::max(prim.roughness, min_alpha);
+    eta_ = prim.ior;
+    dielectric_ = (prim.material == MATERIAL::DIELECTRIC);
+    col_ = col;
+    n_ = (dielectric_ && interior ? -1.f * n : n);
+    BuildBasis(n_, t_, b_);
+}
+
+glm::vec3 Microfacet_t::ToLocal(glm::vec3 w) const {
+    return {glm::dot(w, t_), glm::dot(w, b_), glm::dot(w, n_)};
+}
+
+glm::vec3 Microfacet_t::ToWorld(glm::vec3 w) const {
+    return w.x * t_ + w.y * b_ + w.z * n_;
+}
+
+float Microfacet_t::D(glm::vec3 m) const {
+    if (m.z <= 0.f) {
+        return 0.f;
+    }
+    float cos2 = m.z * m.z;
+    float e = (1.f - cos2) / (cos2 * alpha_ * alpha_);
+    return 1.f / (kPI * alpha_ * alpha_ * cos2 * cos2 * (1.f + e) * (1.f + e));
+}
+
+float Microfacet_t::Lambda(glm::vec3 w) const {
+    float cos2 = w.z * w.z;
+    if (cos2 == 0.f) {
+        return INFINITY;
+    }
+    float alpha2_tan2 = alpha_ * alpha_ * (1.f - cos2) / cos2;
+    return 0.5f * (std::sqrt(1.f + alpha2_tan2) - 1.f);
+}
+
+glm::vec3 Microfacet_t::VisibleNormal(glm::vec3 wo, glm::vec2 u) const {
+    if (wo.z < 0.f) {
+        wo = -1.f * wo;
+    }
+    // stretch to hemisphere configuration, sample projected disk there and stretch back
+    glm::vec3 vh = glm::normalize(glm::vec3(alpha_ * wo.x, alpha_ * wo.y, wo.z));
+    float len2 = vh.x * vh.x + vh.y * vh.y;
+    glm::vec3 t1 = (len2 > 0.f ? glm::vec3(-vh.y, vh.x, 0.f) / std::sqrt(len2) : glm::vec3(1.f, 0.f, 0.f));
+    glm::vec3 t2 = glm::cross(vh, t1);
+
+    float r = std::sqrt(u.x);
+    float phi = 2 * kPI * u.y;
+    float p1 = r * std::cos(phi), p2 = r * std::sin(phi);
+    float s = 0.5f * (1.f + vh.z);
+    p2 = (1.f - s) * std::sqrt(std::max(0.f, 1.f - p1 * p1)) + s * p2;
+
+    glm::vec3 nh = p1 * t1 + p2 * t2 + std::sqrt(std::max(0.f, 1.f - p1 * p1 - p2 * p2)) * vh;
+    return glm::normalize(glm::vec3(alpha_ * nh.x, alpha_ * nh.y, std::max(1e-6f, nh.z)));
+}
+
+float Microfacet_t::PdfNormal(glm::vec3 wo, glm::vec3 m) const {
+    float g1 = 1.f / (1.f + Lambda(wo));
+    return g1 * D(m) * std::abs(glm::dot(wo, m)) / std::abs(wo.z);
+}
+
+float Microfacet_t::Fresnel(float cos_o) const {
+    float eta1 = 1., eta2 = eta_;
+    if (cos_o < 0.f) {
+        std::swap(eta1, eta2);
+        cos_o = -cos_o;
+    }
+    float sin_theta2 = eta1 / eta2 * std::sqrt(std::max(0.f, 1.f - cos_o * cos_o));
+    if (sin_theta2 >= 1.f) {
+        return 1.f;
+    }
+    float r0 = std::pow((eta1 - eta2) / (eta1 + eta2), 2.f);
+    return r0 + (1.f - r0) * std::pow(1.f - cos_o, 5.f);
+}
+
+glm::vec3 Microfacet_t::Eval(glm::vec3 wo, glm::vec3 wi) const {
+    wo = ToLocal(wo);
+    wi = ToLocal(wi);
+    if (wo.z == 0.f || wi.z == 0.f) {
+        return {0.f, 0.f, 0.f};
+    }
+    float g = 1.f / (1.f + Lambda(wo) + Lambda(wi));
+
+    if (!dielectric_) {
+        if (wo.z < 0.f || wi.z < 0.f) {
+            return {0.f, 0.f, 0.f};
+        }
+        glm::vec3 m = glm::normalize(wo + wi);
+        return col_ * (D(m) * g / (4.f * wo.z * wi.z));
+    }
+
+    // generalized half vector, refraction one is eta_i * wi + eta_o * wo up to sign
+    bool reflect = (wo.z * wi.z > 0.f);
+    float etap = (reflect ? 1.f : (wo.z > 0.f ? eta_ : 1.f / eta_));
+    glm::vec3 m = etap * wi + wo;
+    if (glm::dot(m, m) == 0.f) {
+        return {0.f, 0.f, 0.f};
+    }
+    m = glm::normalize(m);
+    if (m.z < 0.f) {
+        m = -1.f * m;
+    }
+    // facets seen from behind by either direction do not scatter
+    float cos_om = glm::dot(wo, m), cos_im = glm::dot(wi, m);
+    if (cos_om * wo.z < 0.f || cos_im * wi.z < 0.f) {
+        return {0.f, 0.f, 0.f};
+    }
+
+    float F = Fresnel(cos_om);
+    if (reflect) {
+        return glm::vec3(D(m) * g * F / std::abs(4.f * wo.z * wi.z));
+    }
+    float denom = cos_im + cos_om / etap;
+    float ft = D(m) * g * (1.f - F) * std::abs(cos_im * cos_om / (denom * denom * wo.z * wi.z));
+    return (wo.z > 0.f ? col_ * ft : glm::vec3(ft));
+}
+
+glm::vec3 Microfacet_t::Sample(glm::vec3 wo, float u_lobe, glm::vec2 u) const {
+    wo = ToLocal(wo);
+    if (wo.z == 0.f || (!dielectric_ && wo.z < 0.f)) {
+        return {0.f, 0.f, 0.f};
+    }
+    glm::vec3 m = VisibleNormal(wo, u);
+    float cos_om = glm::dot(wo, m);
+
+    if (!dielectric_ || u_lobe < Fresnel(cos_om)) {
+        glm::vec3 wi = 2.f * cos_om * m - wo;
+        if (wi.z * wo.z <= 0.f) {
+            return {0.f, 0.f, 0.f};
+        }
+        return ToWorld(wi);
+    }
+
+    float eta = eta_;
+    if (cos_om < 0.f) {
+        eta = 1.f / eta;
+        cos_om = -cos_om;
+        m = -1.f * m;
+    }
+    float sin2_t = std::max(0.f, 1.f - cos_om * cos_om) / (eta * eta);
+    if (sin2_t >= 1.f) {
+        return {0.f, 0.f, 0.f};
+    }
+    float cos_t = std::sqrt(1.f - sin2_t);
+    glm::vec3 wi = -1.f / eta * wo + (cos_om / eta - cos_t) * m;
+    if (wi.z * wo.z >= 0.f) {
+        return {0.f, 0.f, 0.f};
+    }
+    return ToWorld(glm::normalize(wi));
+}
+
+float Microfacet_t::Pdf(glm::vec3 wo, glm::vec3 wi) const {
+    wo = ToLocal(wo);
+    wi = ToLocal(wi);
+    if (wo.z == 0.f || wi.z == 0.f) {
+        return 0.f;
+    }
+
+    if (!dielectric_) {
+        if (wo.z < 0.f || wi.z < 0.f) {
+            return 0.f;
+        }
+        glm::vec3 m = glm::normalize(wo + wi);
+        return PdfNormal(wo, m) / (4.f * glm::dot(wo, m));
+    }
+
+    // same half vector as in Eval
+    bool reflect = (wo.z * wi.z > 0.f);
+    float etap = (reflect ? 1.f : (wo.z > 0.f ? eta_ : 1.f / eta_));
+    glm::vec3 m = etap * wi + wo;
+    if (glm::dot(m, m) == 0.f) {
+        return 0.f;
+    }
+    m = glm::normalize(m);
+    if (m.z < 0.f) {
+        m = -1.f * m;
+    }
+    float cos_om = glm::dot(wo, m), cos_im = glm::dot(wi, m);
+    if (cos_om * wo.z < 0.f || cos_im * wi.z < 0.f) {
+        return 0.f;
+    }
+
+    float F = Fresnel(cos_om);
+    if (reflect) {
+        return PdfNormal(wo, m) / (4.f * std::abs(cos_om)) * F;
+    }
+    // jacobian of refraction: dm / dwi = |wi.m| / (wi.m + wo.m / etap)^2
+    float denom = cos_im + cos_om / etap;
+    return PdfNormal(wo, m) * std::abs(cos_im) / (denom * denom) * (1.f - F);
+}
+
+bool Microfacet_t::Scatter(glm::vec3 w_from, bool adjoint, float u_lobe, glm::vec2 u, glm::vec3& dir,
+        glm::vec3& weight, float& pdf) const {
+    dir = Sample(w_from, u_lobe, u);
+    pdf = (dir == glm::vec3(0.f) ? 0.f : Pdf(w_from, dir));
+    if (pdf <= 0.f) {
+        return false;
+    }
+    glm::vec3 f = (adjoint ? Eval(dir, w_from) : Eval(w_from, dir));
+    weight = f * (std::abs(glm::dot(dir, n_)) / pdf);
+    return weight != glm::vec3(0.f);
+}
@@ -0,0 +1,83 @@
+#include "scene.h"
+
+#include <algorithm>
+#include <numeric>
+
+Color Scene::SampleMLT(RANDOM_t& random, glm::vec2& pixel) {
+    // first two primary coordinates choose image point, the rest drive RayTrace
+    random.sampler.StartPixelSample(0, 0, 0);
+    glm::vec2 u = random.sampler.Get2D();
+    pixel = {u.x * cam.width, u.y * cam.height};
+    PATH_t path;
+    Ray ray = cam.GetToRay(pixel.x, pixel.y, path.cone_spread);
+    return RayTrace(random, ray, ray_depth, path);
+}
+
+float Scene::RenderMLT() {
+    static constexpr float sigma = 0.01f;
+
+    // normalization pass: b = mean luminance over image, starting paths are picked by their luminance
+    std::vector<float> weights(mlt_bootstrap);
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (unsigned int i = 0; i < mlt_bootstrap; ++i) {
+        MLTChain_t chain(0, sigma, mlt_large_step);
+        chain.Seed(i);
+        RANDOM_t random{Sampler_t(&chain)};
+        glm::vec2 pixel;
+        float lum = Luminance(SampleMLT(random, pixel));
+        weights[i] = (std::isfinite(lum) ? lum : 0.f);
+    }
+    double b = std::accumulate(weights.begin(), weights.end(), 0.) / mlt_bootstrap;
+    std::cout << "MLT: bootstrap done, b = " << b << "\n";
+    if (b <= 0.) {
+        return 0.f;
+    }
+    AliasTable_t bootstrap(weights);
+
+    // same number of paths as SAMPLES per pixel would trace
+    uint64_t n_mutations = (uint64_t)samples * cam.width * cam.height;
+    unsigned int n_chains = std::min<uint64_t>(mlt_chains, n_mutations);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (unsigned int k = 0; k < n_chains; ++k) {
+        MLTChain_t chain(k, sigma, mlt_large_step);
+        chain.Seed(bootstrap.Sample(chain.Uniform()).first);
+        RANDOM_t random{Sampler_t(&chain)};
+
+        glm::vec2 pixel;
+        Color current = SampleMLT(random, pixel);
+        float lum = Luminance(current);
+
+        uint64_t chain_mutations = n_mutations / n_chains + (k < n_mutations % n_chains);
+        for (uint64_t i = 0; i < chain_mutations; ++i) {
+            chain.StartIteration();
+            glm::vec2 proposed_pixel;
+            Color proposed = SampleMLT(random, proposed_pixel);
+            float proposed_lum = Luminance(proposed);
+            if (!std::isfinite(proposed_lum)) {
+                proposed_lum = 0.f;
+            }
+
+            // both states get their expected share (Veach 1997, 11.5)
+            float accept = (lum > 0.f ? std::min(1.f, proposed_lum / lum) : 1.f);
+            if (accept > 0.f && proposed_lum > 0.f) {
+                Splat(proposed_pixel, proposed.rgb * (accept / proposed_lum));
+            }
+            if (accept < 1.f && lum > 0.f) {
+                Splat(pixel, current.rgb * ((1.f - accept) / lum));
+            }
+
+            if (chain.Uniform() < accept) {
+                pixel = proposed_pixel;
+                current = proposed;
+                lum = proposed_lum;
+                chain.Accept();
+            } else {
+                chain.Reject();
+            }
+        }
+    }
+
+    // pixel = b * pixels / mutations * sum of f / I
+    return b * cam.width * cam.height / n_mutations;
+}
@@ -0,0 +1,58 @@
+#include "pfm.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+static bool HostLittleEndian() {
+    uint16_t one = 1;
+    return *reinterpret_cast<uint8_t*>(&one) == 1;
+}
+
+bool WritePFM(const std::string& path, const std::vector<float>& data, unsigned int width,
+        unsigned int height, uint8_t channels) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        return false;
+    }
+    out << (channels == 3 ? "PF" : "Pf") << "\n" << width << " " << height << "\n" << (HostLittleEndian() ? "-1.0" : "1.0") << "\n";
+    for (unsigned int y = height; y-- > 0;) {
+        for (unsigned int x = 0; x < width * channels; ++x) {
+            float value = data[y * width * channels + x];
+            char bytes[4];
+            std::memcpy(bytes, &value, 4);
+            out.write(bytes, 4);
+        }
+    }
+    return (bool)out;
+}
+
+bool ReadPFM(const std::string& path, std::vector<float>& data, unsigned int& width,
+        unsigned int& height, uint8_t& channels) {
+    std::ifstream in(path, std::ios::binary);
+    std::string magic;
+    float scale = 0.f;
+    if (!(in >> magic >> width >> height >> scale) || (magic != "PF" && magic != "Pf") || scale == 0.f) {
+        return false;
+    }
+    // single whitespace ends header
+    in.get();
+    channels = (magic == "PF" ? 3 : 1);
+    bool swap = ((scale < 0.f) != HostLittleEndian());
+
+    size_t row = (size_t)width * channels;
+    data.resize(row * height);
+    for (unsigned int y = height; y-- > 0;) {
+        for (size_t x = 0; x < row; ++x) {
+            char bytes[4];
+            if (!in.read(bytes, 4)) {
+                return false;
+            }
+            if (swap) {
+                std::reverse(bytes, bytes + 4);
+            }
+            std::memcpy(&data[y * row + x], bytes, 4);
+        }
+    }
+    return true;
+}
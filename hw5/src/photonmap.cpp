@@ -0,0 +1,97 @@
+#include "photonmap.h"
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/norm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+PhotonMap_t::PhotonMap_t(std::vector<PHOTON_t>&& photons, float radius) : radius_(radius), cell_size_(2.f * radius) {
+    if (photons.empty()) {
+        return;
+    }
+
+    uint32_t table_size = 1;
+    while (table_size < photons.size()) {
+        table_size <<= 1;
+    }
+    table_mask_ = table_size - 1;
+
+    int n = photons.size();
+    std::vector<uint32_t> hashes(n);
+    std::vector<std::atomic<uint32_t>> counts(table_size);
+    for (auto& count : counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+
+    #pragma omp parallel for
+    for (int i = 0; i < n; ++i) {
+        hashes[i] = Hash(Cell(photons[i].pos));
+        counts[hashes[i]].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    cell_start_.assign(table_size + 1, 0);
+    for (uint32_t h = 0; h < table_size; ++h) {
+        cell_start_[h + 1] = cell_start_[h] + counts[h].load(std::memory_order_relaxed);
+        counts[h].store(cell_start_[h], std::memory_order_relaxed);
+    }
+
+    photons_.resize(n);
+    #pragma omp parallel for
+    for (int i = 0; i < n; ++i) {
+        photons_[counts[hashes[i]].fetch_add(1, std::memory_order_relaxed)] = photons[i];
+    }
+}
+
+bool PhotonMap_t::Empty() const {
+    return photons_.empty();
+}
+
+float PhotonMap_t::Radius() const {
+    return radius_;
+}
+
+glm::ivec3 PhotonMap_t::Cell(glm::vec3 x) const {
+    return glm::ivec3(glm::floor(x / cell_size_));
+}
+
+uint32_t PhotonMap_t::Hash(glm::ivec3 cell) const {
+    // Teschner et al. 2003
+    uint32_t h = ((uint32_t)cell.x * 73856093U) ^ ((uint32_t)cell.y * 19349663U) ^ ((uint32_t)cell.z * 83492791U);
+    return h & table_mask_;
+}
+
+glm::vec3 PhotonMap_t::Gather(glm::vec3 x, glm::vec3 n) const {
+    glm::vec3 sum = {0.f, 0.f, 0.f};
+    if (Empty()) {
+        return sum;
+    }
+
+    float radius2 = radius_ * radius_;
+    glm::ivec3 lo = Cell(x - radius_), hi = Cell(x + radius_);
+
+    // different cells may share hash, every bucket is visited once
+    uint32_t buckets[27];
+    uint8_t n_buckets = 0;
+    for (int cx = lo.x; cx <= hi.x; ++cx) {
+        for (int cy = lo.y; cy <= hi.y; ++cy) {
+            for (int cz = lo.z; cz <= hi.z; ++cz) {
+                uint32_t h = Hash({cx, cy, cz});
+                if (std::find(buckets, buckets + n_buckets, h) == buckets + n_buckets) {
+                    buckets[n_buckets++] = h;
+                }
+            }
+        }
+    }
+
+    for (uint8_t b = 0; b < n_buckets; ++b) {
+        for (uint32_t i = cell_start_[buckets[b]]; i < cell_start_[buckets[b] + 1]; ++i) {
+            const PHOTON_t& photon = photons_[i];
+            if (glm::dot(photon.dir, n) < 0.f && glm::distance2(photon.pos, x) < radius2) {
+                sum += photon.power;
+            }
+        }
+    }
+    return sum;
+}
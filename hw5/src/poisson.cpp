@@ -0,0 +1,128 @@
+#include "poisson.h"
+
+#include <glm/common.hpp>
+
+// terms of reconstruction, every one is weighted per channel
+struct POISSON_WEIGHTS_t {
+    std::vector<glm::vec3> primal, dx, dy;
+};
+
+// per channel dot product of two images
+static glm::vec3 Dot(const std::vector<glm::vec3>& a, const std::vector<glm::vec3>& b) {
+    float r = 0.f, g = 0.f, bl = 0.f;
+    int n = a.size();
+    #pragma omp parallel for reduction(+:r, g, bl)
+    for (int i = 0; i < n; ++i) {
+        glm::vec3 prod = a[i] * b[i];
+        r += prod.x;
+        g += prod.y;
+        bl += prod.z;
+    }
+    return {r, g, bl};
+}
+
+// out = alpha^2 W_p u + D^T W_d D u, where D takes forward differences along x and y
+static void Apply(const std::vector<glm::vec3>& u, unsigned int width, unsigned int height, float alpha2,
+        const POISSON_WEIGHTS_t& w, std::vector<glm::vec3>& out) {
+    int n = u.size();
+    #pragma omp parallel for
+    for (int i = 0; i < n; ++i) {
+        unsigned int x = i % width, y = i / width;
+        glm::vec3 sum = alpha2 * w.primal[i] * u[i];
+        if (x > 0) {
+            sum += w.dx[i - 1] * (u[i] - u[i - 1]);
+        }
+        if (x + 1 < width) {
+            sum += w.dx[i] * (u[i] - u[i + 1]);
+        }
+        if (y > 0) {
+            sum += w.dy[i - width] * (u[i] - u[i - width]);
+        }
+        if (y + 1 < height) {
+            sum += w.dy[i] * (u[i] - u[i + width]);
+        }
+        out[i] = sum;
+    }
+}
+
+static void Solve(const std::vector<glm::vec3>& primal, const std::vector<glm::vec3>& dx, const std::vector<glm::vec3>& dy,
+        unsigned int width, unsigned int height, float alpha2, const POISSON_WEIGHTS_t& w, unsigned int iterations,
+        std::vector<glm::vec3>& u) {
+    int n = primal.size();
+
+    // right side: alpha^2 W_p primal + D^T W_d g
+    std::vector<glm::vec3> r(n), p(n), Ap(n);
+    Apply(u, width, height, alpha2, w, Ap);
+    #pragma omp parallel for
+    for (int i = 0; i < n; ++i) {
+        unsigned int x = i % width, y = i / width;
+        glm::vec3 rhs = alpha2 * w.primal[i] * primal[i];
+        if (x > 0) {
+            rhs += w.dx[i - 1] * dx[i - 1];
+        }
+        if (x + 1 < width) {
+            rhs -= w.dx[i] * dx[i];
+        }
+        if (y > 0) {
+            rhs += w.dy[i - width] * dy[i - width];
+        }
+        if (y + 1 < height) {
+            rhs -= w.dy[i] * dy[i];
+        }
+        r[i] = rhs - Ap[i];
+        p[i] = r[i];
+    }
+
+    glm::vec3 rr = Dot(r, r);
+    for (unsigned int it = 0; it < iterations; ++it) {
+        Apply(p, width, height, alpha2, w, Ap);
+        glm::vec3 pAp = Dot(p, Ap);
+        // converged channels keep zero steps
+        glm::vec3 step = glm::vec3(pAp.x > 0.f ? rr.x / pAp.x : 0.f, pAp.y > 0.f ? rr.y / pAp.y : 0.f,
+            pAp.z > 0.f ? rr.z / pAp.z : 0.f);
+        #pragma omp parallel for
+        for (int i = 0; i < n; ++i) {
+            u[i] += step * p[i];
+            r[i] -= step * Ap[i];
+        }
+
+        glm::vec3 rr_next = Dot(r, r);
+        glm::vec3 beta = glm::vec3(rr.x > 0.f ? rr_next.x / rr.x : 0.f, rr.y > 0.f ? rr_next.y / rr.y : 0.f,
+            rr.z > 0.f ? rr_next.z / rr.z : 0.f);
+        rr = rr_next;
+        #pragma omp parallel for
+        for (int i = 0; i < n; ++i) {
+            p[i] = r[i] + beta * p[i];
+        }
+    }
+}
+
+std::vector<glm::vec3> ScreenedPoisson(const std::vector<glm::vec3>& primal, const std::vector<glm::vec3>& dx,
+        const std::vector<glm::vec3>& dy, unsigned int width, unsigned int height, float alpha, unsigned int iterations,
+        unsigned int l1_passes) {
+    // residuals below this are not trusted more than it
+    static constexpr float l1_eps = 1e-3f;
+    int n = primal.size();
+    float alpha2 = alpha * alpha;
+
+    POISSON_WEIGHTS_t w = {std::vector<glm::vec3>(n, glm::vec3(1.f)), std::vector<glm::vec3>(n, glm::vec3(1.f)),
+        std::vector<glm::vec3>(n, glm::vec3(1.f))};
+    std::vector<glm::vec3> u = primal;
+    Solve(primal, dx, dy, width, height, alpha2, w, iterations, u);
+    for (unsigned int pass = 0; pass < l1_passes; ++pass) {
+        // every term is weighted by inverse of its residual, so squared error approximates absolute one
+        #pragma omp parallel for
+        for (int i = 0; i < n; ++i) {
+            unsigned int x = i % width, y = i / width;
+            w.primal[i] = 1.f / glm::max(glm::abs(u[i] - primal[i]), l1_eps);
+            if (x + 1 < width) {
+                w.dx[i] = 1.f / glm::max(glm::abs(u[i + 1] - u[i] - dx[i]), l1_eps);
+            }
+            if (y + 1 < height) {
+                w.dy[i] = 1.f / glm::max(glm::abs(u[i + width] - u[i] - dy[i]), l1_eps);
+            }
+        }
+        Solve(primal, dx, dy, width, height, alpha2, w, iterations, u);
+    }
+    return u;
+}
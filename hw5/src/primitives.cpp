@@ -51,6 +51,160 @@ std::optional<intersection_t> Primitive::Intersect(const Ray &ray) const {
     return {};
 }
 
+float Primitive::Area() const {
+    switch (primitive_type) {
+        case PRIMITIVE_TYPE::BOX: {
+            const glm::vec3& s = dop_data;
+            return 8.f * (s.x * s.y + s.x * s.z + s.y * s.z);
+        }
+        case PRIMITIVE_TYPE::ELLIPSOID: {
+            // Knud Thomsen approximation, relative error < 1.1%
+            static constexpr float p = 1.6075f;
+            const glm::vec3& r = dop_data;
+            float ab = std::pow(r.x * r.y, p);
+            float ac = std::pow(r.x * r.z, p);
+            float bc = std::pow(r.y * r.z, p);
+            return 4.f * kPI * std::pow((ab + ac + bc) / 3.f, 1.f / p);
+        }
+        case PRIMITIVE_TYPE::TRIANGLE: {
+            return 0.5f * glm::length(glm::cross(dop_data1 - dop_data, dop_data2 - dop_data));
+        }
+
+        default: {
+            // planes are infinite
+            return INFINITY;
+        }
+    }
+}
+
+bool Primitive::IsEmitter() const {
+    return emission.r() > 0 || emission.g() > 0 || emission.b() > 0;
+}
+
+surface_sample_t Primitive::SampleSurface(float u_face, glm::vec2 u) const {
+    surface_sample_t res;
+    switch (primitive_type) {
+        case PRIMITIVE_TYPE::BOX: {
+            // face is chosen proportionally to its area
+            const glm::vec3& s = dop_data;
+            glm::vec3 face_area = {s.y * s.z, s.x * s.z, s.x * s.y};
+            float sum = face_area.x + face_area.y + face_area.z;
+            u_face *= sum;
+            uint8_t axis = 0;
+            while (axis < 2 && u_face >= face_area[axis]) {
+                u_face -= face_area[axis];
+                ++axis;
+            }
+            float sign = (u_face < 0.5f * face_area[axis] ? -1.f : 1.f);
+
+            uint8_t a1 = (axis + 1) % 3, a2 = (axis + 2) % 3;
+            res.p[axis] = sign * s[axis];
+            res.p[a1] = (2.f * u.x - 1.f) * s[a1];
+            res.p[a2] = (2.f * u.y - 1.f) * s[a2];
+            res.normal = {0.f, 0.f, 0.f};
+            res.normal[axis] = sign;
+            res.pdf = 1.f / (8.f * sum);
+            break;
+        }
+        case PRIMITIVE_TYPE::ELLIPSOID: {
+            // uniform point of unit sphere stretched, area changes by r.x * r.y * r.z * |s / r|
+            const glm::vec3& r = dop_data;
+            float z = 1.f - 2.f * u.x;
+            float sin_theta = std::sqrt(std::max(0.f, 1.f - z * z));
+            float phi = 2 * kPI * u.y;
+            glm::vec3 s = {sin_theta * cosf(phi), sin_theta * sinf(phi), z};
+            res.p = r * s;
+            res.normal = glm::normalize(s / r);
+            res.pdf = 1.f / (4 * kPI * r.x * r.y * r.z * glm::length(s / r));
+            break;
+        }
+        case PRIMITIVE_TYPE::TRIANGLE: {
+            float su = std::sqrt(u.x);
+            float b1 = 1.f - su, b2 = u.y * su;
+            res.p = dop_data + b1 * (dop_data1 - dop_data) + b2 * (dop_data2 - dop_data);
+            res.normal = glm::normalize(glm::cross(dop_data1 - dop_data, dop_data2 - dop_data));
+            res.pdf = 1.f / Area();
+            break;
+        }
+
+        default: {
+            std::cerr << "unexpected primitive type(" << primitive_type << ") in surface sampling" << std::endl;
+            exit(1);
+            break;
+        }
+    }
+
+    res.p = rotate(rotator, res.p) + pos;
+    res.normal = glm::normalize(rotate(rotator, res.normal));
+    return res;
+}
+
+float Primitive::PdfSurface(glm::vec3 p) const {
+    if (primitive_type != PRIMITIVE_TYPE::ELLIPSOID) {
+        return 1.f / Area();
+    }
+    const glm::vec3& r = dop_data;
+    glm::vec3 s = glm::normalize(rotate(glm::conjugate(rotator), p - pos) / r);
+    return 1.f / (4 * kPI * r.x * r.y * r.z * glm::length(s / r));
+}
+
+glm::vec2 Primitive::SurfaceUV(glm::vec3 p) const {
+    glm::vec3 q = rotate(glm::conjugate(rotator), p - pos);
+    switch (primitive_type) {
+        case PRIMITIVE_TYPE::PLANE: {
+            glm::vec3 n = glm::normalize(dop_data);
+            glm::vec3 t = glm::normalize(std::abs(n.x) > 0.9f ? glm::cross(n, glm::vec3(0.f, 1.f, 0.f)) :
+                                                                glm::cross(n, glm::vec3(1.f, 0.f, 0.f)));
+            return {glm::dot(q, t), glm::dot(q, glm::cross(n, t))};
+        }
+        case PRIMITIVE_TYPE::BOX: {
+            glm::vec3 f = q / dop_data;
+            glm::vec3 a = glm::abs(f);
+            // face axis is the one point lies on, other two span the face
+            uint8_t axis = (a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2));
+            uint8_t u = (axis + 1) % 3, v = (axis + 2) % 3;
+            return {0.5f * (f[u] + 1.f), 0.5f * (f[v] + 1.f)};
+        }
+        case PRIMITIVE_TYPE::ELLIPSOID: {
+            glm::vec3 d = glm::normalize(q / dop_data);
+            return {0.5f + std::atan2(d.z, d.x) / (2 * kPI), std::acos(std::clamp(d.y, -1.f, 1.f)) / kPI};
+        }
+        case PRIMITIVE_TYPE::TRIANGLE: {
+            // barycentrics from areas of sub-triangles
+            glm::vec3 n = glm::cross(dop_data1 - dop_data, dop_data2 - dop_data);
+            float area2 = glm::dot(n, n);
+            if (area2 == 0.f) {
+                return uv_a;
+            }
+            float b = glm::dot(glm::cross(q - dop_data, dop_data2 - dop_data), n) / area2;
+            float c = glm::dot(glm::cross(dop_data1 - dop_data, q - dop_data), n) / area2;
+            return (1.f - b - c) * uv_a + b * uv_b + c * uv_c;
+        }
+    }
+    return {0.f, 0.f};
+}
+
+float Primitive::UVDensity() const {
+    switch (primitive_type) {
+        case PRIMITIVE_TYPE::PLANE: {
+            return 1.f;
+        }
+        case PRIMITIVE_TYPE::BOX: {
+            return 3.f / (2.f * (dop_data.x + dop_data.y + dop_data.z));
+        }
+        case PRIMITIVE_TYPE::ELLIPSOID: {
+            // latitude runs over half of circumference
+            return 3.f / (kPI * (dop_data.x + dop_data.y + dop_data.z));
+        }
+        case PRIMITIVE_TYPE::TRIANGLE: {
+            float uv_area = 0.5f * std::abs((uv_b.x - uv_a.x) * (uv_c.y - uv_a.y) - (uv_c.x - uv_a.x) * (uv_b.y - uv_a.y));
+            float area = Area();
+            return (area > 0.f ? std::sqrt(uv_area / area) : 0.f);
+        }
+    }
+    return 0.f;
+}
+
 // PLANE
 std::optional<intersection_t> Primitive::IntersectPlane(const Ray &ray, const glm::vec3& n) {
     float t = -glm::dot(ray.o, n) / glm::dot(ray.d, n);
@@ -154,7 +308,8 @@ std::optional<intersection_t> Primitive::IntersectEllipsoid(const Ray &ray, cons
 // Triangle
 std::optional<intersection_t> Primitive::IntersectTriangle(const Ray &ray, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
     glm::vec3 n = glm::normalize(glm::cross(b - a, c - a));
-    std::optional<intersection_t> isec = IntersectPlane(ray, n);
+    // plane of triangle goes through a, not through origin
+    std::optional<intersection_t> isec = IntersectPlane(ray + -1.f * a, n);
 
     if (!isec.has_value()) {
         return {};
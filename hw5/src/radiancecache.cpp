@@ -0,0 +1,121 @@
+#include "radiancecache.h"
+#include "guiding.h"
+
+#include <glm/common.hpp>
+#include <glm/ext/vector_int3.hpp>
+
+#include <cmath>
+
+static constexpr uint64_t kNone = -1;
+
+// splitmix64 finalizer
+static uint64_t Mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+uint64_t CellKey(glm::vec3 x, glm::vec3 n, float cell_size) {
+    // 18 bits per coordinate, 2 bits per normal component, top bit keeps key nonzero
+    glm::ivec3 cell = glm::ivec3(glm::floor(x / cell_size));
+    glm::ivec3 dir = glm::ivec3(glm::round(n)) + 1;
+    uint64_t key = 1ULL << 63;
+    for (uint8_t axis = 0; axis < 3; ++axis) {
+        key |= ((uint64_t)cell[axis] & 0x3ffffULL) << (18 * axis);
+        key |= (uint64_t)dir[axis] << (54 + 2 * axis);
+    }
+    return key;
+}
+
+RadianceCache_t::CELL_t::CELL_t() {
+    for (auto& s : sum) {
+        s.store(0.f, std::memory_order_relaxed);
+    }
+}
+
+RadianceCache_t::RadianceCache_t(float cell_size, uint32_t table_bits)
+    : cell_size_(cell_size), table_mask_((1ULL << table_bits) - 1), cells_(1ULL << table_bits) {}
+
+bool RadianceCache_t::Empty() const {
+    return cells_.empty();
+}
+
+uint64_t RadianceCache_t::Find(uint64_t key) const {
+    uint64_t h = Mix64(key);
+    for (uint32_t probe = 0; probe < kMaxProbes; ++probe) {
+        uint64_t cur = cells_[(h + probe) & table_mask_].key.load(std::memory_order_acquire);
+        if (cur == key) {
+            return (h + probe) & table_mask_;
+        }
+        if (cur == 0) {
+            return kNone;
+        }
+    }
+    return kNone;
+}
+
+uint64_t RadianceCache_t::Claim(uint64_t key) {
+    uint64_t h = Mix64(key);
+    for (uint32_t probe = 0; probe < kMaxProbes; ++probe) {
+        CELL_t& cell = cells_[(h + probe) & table_mask_];
+        uint64_t cur = cell.key.load(std::memory_order_acquire);
+        if (cur == 0) {
+            // on failure cur is what other thread has put there, maybe the same key
+            cell.key.compare_exchange_strong(cur, key, std::memory_order_acq_rel);
+            if (cur == 0) {
+                return (h + probe) & table_mask_;
+            }
+        }
+        if (cur == key) {
+            return (h + probe) & table_mask_;
+        }
+    }
+    return kNone;
+}
+
+void RadianceCache_t::Record(glm::vec3 x, glm::vec3 n, glm::vec3 radiance) {
+    if (Empty() || !std::isfinite(radiance.x + radiance.y + radiance.z)) {
+        return;
+    }
+    uint64_t id = Claim(CellKey(x, n, cell_size_));
+    if (id == kNone) {
+        return;
+    }
+    CELL_t& cell = cells_[id];
+    // lookup that sees any of the sums sees started too
+    cell.started.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (uint8_t c = 0; c < 3; ++c) {
+        AtomicAdd(cell.sum[c], radiance[c]);
+    }
+    cell.count.fetch_add(1, std::memory_order_release);
+}
+
+bool RadianceCache_t::Lookup(glm::vec3 x, glm::vec3 n, uint32_t min_samples, glm::vec3& radiance) const {
+    if (Empty()) {
+        return false;
+    }
+    uint64_t id = Find(CellKey(x, n, cell_size_));
+    if (id == kNone) {
+        return false;
+    }
+    // sums hold all count records; when started is past count some other record may be in them too
+    const CELL_t& cell = cells_[id];
+    uint32_t count = cell.count.load(std::memory_order_acquire);
+    if (count < min_samples) {
+        return false;
+    }
+    glm::vec3 sum;
+    for (uint8_t c = 0; c < 3; ++c) {
+        sum[c] = cell.sum[c].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (cell.started.load(std::memory_order_relaxed) != count) {
+        return false;
+    }
+    radiance = sum / float(count);
+    return true;
+}
@@ -0,0 +1,250 @@
+#include "scene.h"
+
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+// subsamples per tile side, tiles are rasterized in parallel with their own part of depth buffer
+static constexpr int kTile = 32;
+// view depth triangles are clipped at
+static constexpr float kNear = 1e-3;
+
+// triangle in raster space: vertices, 1/z and barycentrics over z, interpolated linearly on screen
+struct RASTER_TRIANGLE_t {
+    glm::vec2 v[3];
+    float inv_z[3];
+    glm::vec2 bary_z[3];
+    int id;
+};
+
+// primitive intersected by subsample rays over raster rectangle [x0, x1) x [y0, y1)
+struct RASTER_RECT_t {
+    int x0, y0, x1, y1;
+    int id;
+};
+
+// vertex in camera frame (x right, y up, z forward) with barycentrics of original triangle
+struct VIEW_VERTEX_t {
+    glm::vec3 p;
+    glm::vec2 bary;
+};
+
+// Sutherland-Hodgman against z = kNear, up to 4 vertices are left
+static std::vector<VIEW_VERTEX_t> ClipNear(const VIEW_VERTEX_t (&tri)[3]) {
+    std::vector<VIEW_VERTEX_t> out;
+    for (uint8_t i = 0; i < 3; ++i) {
+        const VIEW_VERTEX_t& a = tri[i];
+        const VIEW_VERTEX_t& b = tri[(i + 1) % 3];
+        bool a_in = (a.p.z >= kNear), b_in = (b.p.z >= kNear);
+        if (a_in) {
+            out.push_back(a);
+        }
+        if (a_in != b_in) {
+            float s = (kNear - a.p.z) / (b.p.z - a.p.z);
+            out.push_back({a.p + s * (b.p - a.p), a.bary + s * (b.bary - a.bary)});
+        }
+    }
+    return out;
+}
+
+void Scene::RasterizeVisibility() {
+    visibility.clear();
+    if (raster_subsamples == 0) {
+        return;
+    }
+    int k = raster_subsamples;
+    int W = cam.width * k, H = cam.height * k;
+    float tan_fov_x = tan(cam.fov_x / 2);
+    float tan_fov_y = tan_fov_x * cam.height / cam.width;
+    auto to_raster = [&](glm::vec3 v) {
+        return glm::vec2((v.x / v.z / tan_fov_x + 1) * W / 2, (1 - v.y / v.z / tan_fov_y) * H / 2);
+    };
+    auto to_view = [&](glm::vec3 q) {
+        glm::vec3 v = q - cam.pos;
+        return glm::vec3(glm::dot(v, cam.right), glm::dot(v, cam.up), glm::dot(v, cam.forward));
+    };
+
+    // triangles are set up once, boxes and ellipsoids are cast against inside their screen bounds,
+    // planes are unbounded and cast against at every subsample
+    std::vector<RASTER_TRIANGLE_t> triangles;
+    std::vector<RASTER_RECT_t> rects;
+    std::vector<uint32_t> planes;
+    for (uint32_t id = 0; id < primitives.size(); ++id) {
+        const Primitive& prim = primitives[id];
+        if (prim.primitive_type == PRIMITIVE_TYPE::PLANE) {
+            planes.push_back(id);
+            continue;
+        }
+        if (prim.primitive_type != PRIMITIVE_TYPE::TRIANGLE) {
+            // corners of bounding box, rectangle is whole raster once one is behind camera
+            glm::vec2 lo = {INF, INF}, hi = {-INF, -INF};
+            bool behind = false;
+            for (uint8_t c = 0; c < 8; ++c) {
+                glm::vec3 corner = {(c & 1) ? 1.f : -1.f, (c & 2) ? 1.f : -1.f, (c & 4) ? 1.f : -1.f};
+                glm::vec3 v = to_view(rotate(prim.rotator, corner * prim.dop_data) + prim.pos);
+                if (v.z < kNear) {
+                    behind = true;
+                    break;
+                }
+                glm::vec2 r = glm::clamp(to_raster(v), glm::vec2(0.f), glm::vec2(W, H));
+                lo = glm::min(lo, r);
+                hi = glm::max(hi, r);
+            }
+            RASTER_RECT_t rect = {0, 0, W, H, (int)id};
+            if (!behind) {
+                rect = {std::max(0, (int)std::floor(lo.x)), std::max(0, (int)std::floor(lo.y)),
+                        std::min(W, (int)std::ceil(hi.x) + 1), std::min(H, (int)std::ceil(hi.y) + 1), (int)id};
+            }
+            if (rect.x0 < rect.x1 && rect.y0 < rect.y1) {
+                rects.push_back(rect);
+            }
+            continue;
+        }
+
+        VIEW_VERTEX_t tri[3] = {
+            {to_view(rotate(prim.rotator, prim.dop_data) + prim.pos), {0.f, 0.f}},
+            {to_view(rotate(prim.rotator, prim.dop_data1) + prim.pos), {1.f, 0.f}},
+            {to_view(rotate(prim.rotator, prim.dop_data2) + prim.pos), {0.f, 1.f}},
+        };
+        std::vector<VIEW_VERTEX_t> poly = ClipNear(tri);
+        // fan of clipped polygon
+        for (size_t i = 1; i + 1 < poly.size(); ++i) {
+            RASTER_TRIANGLE_t r;
+            r.id = id;
+            const VIEW_VERTEX_t* v[3] = {&poly[0], &poly[i], &poly[i + 1]};
+            for (uint8_t j = 0; j < 3; ++j) {
+                r.v[j] = to_raster(v[j]->p);
+                r.inv_z[j] = 1.f / v[j]->p.z;
+                r.bary_z[j] = v[j]->bary * r.inv_z[j];
+            }
+            triangles.push_back(r);
+        }
+    }
+
+    // bin triangles by tiles their bounds overlap
+    int tiles_x = (W + kTile - 1) / kTile, tiles_y = (H + kTile - 1) / kTile;
+    std::vector<std::vector<uint32_t>> bins(tiles_x * tiles_y);
+    for (uint32_t i = 0; i < triangles.size(); ++i) {
+        const RASTER_TRIANGLE_t& r = triangles[i];
+        glm::vec2 lo = glm::min(r.v[0], glm::min(r.v[1], r.v[2]));
+        glm::vec2 hi = glm::max(r.v[0], glm::max(r.v[1], r.v[2]));
+        if (hi.x < 0.f || hi.y < 0.f || lo.x >= W || lo.y >= H) {
+            continue;
+        }
+        // vertices near camera plane land far outside raster
+        lo = glm::max(lo, glm::vec2(0.f));
+        hi = glm::min(hi, glm::vec2(W - 1, H - 1));
+        int tx0 = (int)lo.x / kTile, tx1 = (int)hi.x / kTile;
+        int ty0 = (int)lo.y / kTile, ty1 = (int)hi.y / kTile;
+        for (int ty = ty0; ty <= ty1; ++ty) {
+            for (int tx = tx0; tx <= tx1; ++tx) {
+                bins[tx + ty * tiles_x].push_back(i);
+            }
+        }
+    }
+
+    visibility.assign((size_t)W * H, VISIBILITY_t());
+    #pragma omp parallel for schedule(dynamic)
+    for (int tile = 0; tile < tiles_x * tiles_y; ++tile) {
+        int x0 = (tile % tiles_x) * kTile, y0 = (tile / tiles_x) * kTile;
+        int x1 = std::min(x0 + kTile, W), y1 = std::min(y0 + kTile, H);
+        // view depth, equal to ray parameter of subsample ray (its direction has unit forward part)
+        std::vector<float> depth(kTile * kTile, INF);
+        auto store = [&](int x, int y, float z, int id, glm::vec2 bary) {
+            float& d = depth[(x - x0) + (y - y0) * kTile];
+            if (z < d) {
+                d = z;
+                visibility[(size_t)y * W + x] = {id, bary};
+            }
+        };
+
+        for (uint32_t i : bins[tile]) {
+            const RASTER_TRIANGLE_t& r = triangles[i];
+            auto edge = [](glm::vec2 a, glm::vec2 b, glm::vec2 p) {
+                return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+            };
+            float area = edge(r.v[0], r.v[1], r.v[2]);
+            if (area == 0.f) {
+                continue;
+            }
+            glm::vec2 lo = glm::max(glm::min(r.v[0], glm::min(r.v[1], r.v[2])), glm::vec2(x0, y0));
+            glm::vec2 hi = glm::min(glm::max(r.v[0], glm::max(r.v[1], r.v[2])), glm::vec2(x1, y1));
+            int bx0 = std::max(x0, (int)std::floor(lo.x)), bx1 = std::min(x1, (int)std::ceil(hi.x) + 1);
+            int by0 = std::max(y0, (int)std::floor(lo.y)), by1 = std::min(y1, (int)std::ceil(hi.y) + 1);
+            for (int y = by0; y < by1; ++y) {
+                for (int x = bx0; x < bx1; ++x) {
+                    // both windings are drawn, subsample on shared edge goes to both triangles
+                    glm::vec2 p = {x + 0.5f, y + 0.5f};
+                    float l0 = edge(r.v[1], r.v[2], p) / area;
+                    float l1 = edge(r.v[2], r.v[0], p) / area;
+                    float l2 = edge(r.v[0], r.v[1], p) / area;
+                    if (l0 < 0.f || l1 < 0.f || l2 < 0.f) {
+                        continue;
+                    }
+                    // perspective-correct: 1/z and attributes over z are linear on screen
+                    float inv_z = l0 * r.inv_z[0] + l1 * r.inv_z[1] + l2 * r.inv_z[2];
+                    glm::vec2 bary = (l0 * r.bary_z[0] + l1 * r.bary_z[1] + l2 * r.bary_z[2]) / inv_z;
+                    store(x, y, 1.f / inv_z, r.id, bary);
+                }
+            }
+        }
+
+        for (const RASTER_RECT_t& rect : rects) {
+            for (int y = std::max(y0, rect.y0); y < std::min(y1, rect.y1); ++y) {
+                for (int x = std::max(x0, rect.x0); x < std::min(x1, rect.x1); ++x) {
+                    auto isec = primitives[rect.id].Intersect(cam.GetToRay((x + 0.5f) / k, (y + 0.5f) / k));
+                    if (isec.has_value()) {
+                        store(x, y, isec->t, rect.id, {0.f, 0.f});
+                    }
+                }
+            }
+        }
+        for (uint32_t id : planes) {
+            for (int y = y0; y < y1; ++y) {
+                for (int x = x0; x < x1; ++x) {
+                    auto isec = primitives[id].Intersect(cam.GetToRay((x + 0.5f) / k, (y + 0.5f) / k));
+                    if (isec.has_value()) {
+                        store(x, y, isec->t, id, {0.f, 0.f});
+                    }
+                }
+            }
+        }
+    }
+}
+
+Ray Scene::PrimaryRay(glm::vec2 pixel, PATH_t& path, ray_intersection_t& hit) const {
+    if (visibility.empty()) {
+        return cam.GetToRay(pixel.x, pixel.y, path.cone_spread);
+    }
+    unsigned int k = raster_subsamples;
+    unsigned int sx = std::min<unsigned int>(pixel.x * k, cam.width * k - 1);
+    unsigned int sy = std::min<unsigned int>(pixel.y * k, cam.height * k - 1);
+    Ray ray = cam.GetToRay((sx + 0.5f) / k, (sy + 0.5f) / k, path.cone_spread);
+    const VISIBILITY_t& v = visibility[(size_t)sy * cam.width * k + sx];
+
+    hit.id = v.id;
+    if (v.id == -1) {
+        path.hit = &hit;
+        return ray;
+    }
+    const Primitive& prim = primitives[v.id];
+    if (prim.primitive_type == PRIMITIVE_TYPE::TRIANGLE) {
+        // hit point from barycentrics, normal faces ray as IntersectTriangle has it
+        glm::vec3 a = prim.dop_data, b = prim.dop_data1, c = prim.dop_data2;
+        glm::vec3 p = rotate(prim.rotator, a + v.bary.x * (b - a) + v.bary.y * (c - a)) + prim.pos;
+        glm::vec3 normal = rotate(prim.rotator, glm::normalize(glm::cross(b - a, c - a)));
+        bool interior = (glm::dot(ray.d, normal) >= 0);
+        float t = glm::dot(p - ray.o, ray.d) / glm::dot(ray.d, ray.d);
+        hit.isec = {t, interior ? -1.f * normal : normal, interior};
+        path.hit = &hit;
+        return ray;
+    }
+    auto isec = prim.Intersect(ray);
+    if (isec.has_value()) {
+        hit.isec = isec.value();
+        path.hit = &hit;
+    }
+    // otherwise ray is traced, rounding made rasterizer and intersection disagree
+    return ray;
+}
@@ -0,0 +1,94 @@
+#include "color.h"
+#include "pfm.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// one light buffer of render, image gets buffer * emission
+struct BUFFER_t {
+    std::string name;
+    glm::vec3 emission;
+    std::vector<float> data;
+};
+
+/*
+    Recombines light buffers written by LIGHT_BUFFERS into image without rendering.
+    relight <prefix> <out.ppm> [<k> <r> <g> <b>]...
+    k - buffer index in <prefix>lights.txt or "background", r g b - its new emission
+    (scale of background); buffers not given keep emission of render.
+*/
+int main(int argc, const char *argv[]) {
+    if (argc < 3 || (argc - 3) % 4 != 0) {
+        std::cerr << "usage: " << argv[0] << " <prefix> <out.ppm> [<k> <r> <g> <b>]..." << std::endl;
+        return 1;
+    }
+    std::string prefix = argv[1];
+
+    std::ifstream manifest(prefix + "lights.txt");
+    if (!manifest) {
+        std::cerr << "unexpected light buffers file(" << prefix << "lights.txt)" << std::endl;
+        return 1;
+    }
+    std::vector<BUFFER_t> buffers;
+    std::string line;
+    while (std::getline(manifest, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::stringstream ss(line);
+        BUFFER_t buffer;
+        if (ss >> buffer.name >> buffer.emission.x >> buffer.emission.y >> buffer.emission.z) {
+            buffers.push_back(std::move(buffer));
+        }
+    }
+    if (buffers.empty()) {
+        std::cerr << "unexpected light buffers file(" << prefix << "lights.txt)" << std::endl;
+        return 1;
+    }
+
+    for (int arg = 3; arg < argc; arg += 4) {
+        std::string k = argv[arg];
+        size_t index = (k == "background" ? buffers.size() - 1 : std::stoul(k));
+        if (index >= buffers.size()) {
+            std::cerr << "unexpected light buffer(" << k << ")" << std::endl;
+            return 1;
+        }
+        buffers[index].emission = {std::stof(argv[arg + 1]), std::stof(argv[arg + 2]), std::stof(argv[arg + 3])};
+    }
+
+    unsigned int width = 0, height = 0;
+    for (BUFFER_t& buffer : buffers) {
+        unsigned int w, h;
+        uint8_t channels;
+        if (!ReadPFM(prefix + buffer.name, buffer.data, w, h, channels) || channels != 3 ||
+                (width > 0 && (w != width || h != height))) {
+            std::cerr << "unexpected light buffer(" << prefix + buffer.name << ")" << std::endl;
+            return 1;
+        }
+        width = w;
+        height = h;
+    }
+
+    std::ofstream out(argv[2], std::ios::binary);
+    out << "P6\n";
+    out << width << " " << height << "\n";
+    out << 255 << "\n";
+    for (size_t i = 0; i < (size_t)width * height; ++i) {
+        glm::vec3 sum = {0.f, 0.f, 0.f};
+        for (const BUFFER_t& buffer : buffers) {
+            sum += buffer.emission * glm::vec3(buffer.data[3 * i], buffer.data[3 * i + 1], buffer.data[3 * i + 2]);
+        }
+
+        Color color = {sum};
+        color = AcesTonemap(color);
+        color = GammaCorrected(color);
+
+        uint8_t *rgb = color.toUInts();
+        out.write(reinterpret_cast<char*>(rgb), 3);
+        delete[] rgb;
+    }
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "scene.h"
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/norm.hpp>
+
+#include <algorithm>
+
+bool RESERVOIR_t::Update(const LIGHT_SAMPLE_t& x, float w, float x_target, float u) {
+    w_sum += w;
+    M += 1.f;
+    if (w > 0.f && u * w_sum < w) {
+        y = x;
+        target = x_target;
+        return true;
+    }
+    return false;
+}
+
+void RESERVOIR_t::Finalize() {
+    W = (target > 0.f ? w_sum / (M * target) : 0.f);
+}
+
+// streams of reservoir values are told apart from pixel ones by sample id
+static constexpr unsigned int candidates_stream = 2U << 30;
+static constexpr unsigned int reuse_stream = 3U << 30;
+
+////////////
+// TARGET //
+////////////
+
+// cosines over squared distance between p and y, 0 when either side faces away
+static float Geometry(const Primitive& light, const LIGHT_SAMPLE_t& y, glm::vec3 p, glm::vec3 n) {
+    glm::vec3 d = y.p - p;
+    float dist2 = glm::length2(d);
+    if (dist2 == 0.f) {
+        return 0.f;
+    }
+    d /= std::sqrt(dist2);
+
+    float cos_x = glm::dot(n, d);
+    // triangles shine on both sides
+    float cos_y = -glm::dot(y.n, d);
+    if (light.primitive_type == PRIMITIVE_TYPE::TRIANGLE) {
+        cos_y = std::abs(cos_y);
+    }
+    if (cos_x <= 0.f || cos_y <= 0.f) {
+        return 0.f;
+    }
+    return cos_x * cos_y / dist2;
+}
+
+glm::vec3 Scene::Unshadowed(const LIGHT_SAMPLE_t& y, glm::vec3 p, glm::vec3 n, glm::vec3 albedo) const {
+    const Primitive& light = primitives[y.prim_id];
+    return (albedo / kPI) * light.emission.rgb * Geometry(light, y, p, n);
+}
+
+float Scene::TargetPdf(const LIGHT_SAMPLE_t& y, glm::vec3 p, glm::vec3 n, glm::vec3 albedo) const {
+    return Luminance(Color{Unshadowed(y, p, n, albedo)});
+}
+
+RESERVOIR_t Scene::SampleLights(RANDOM_t& random, glm::vec3 p, glm::vec3 n, glm::vec3 albedo) {
+    RESERVOIR_t r;
+    for (unsigned int i = 0; i < restir_candidates; ++i) {
+        // candidates come from emitter power table, target adds geometry and shading
+        auto [light, pmf] = emitter_table.Sample(random.sampler.Get1D());
+        LIGHT_SAMPLE_t x;
+        x.prim_id = emitters[light];
+        float u_face = random.sampler.Get1D();
+        surface_sample_t point = primitives[x.prim_id].SampleSurface(u_face, random.sampler.Get2D());
+        x.p = point.p;
+        x.n = point.normal;
+
+        float target = TargetPdf(x, p, n, albedo);
+        r.Update(x, target / (pmf * point.pdf), target, random.sampler.Get1D());
+    }
+    r.Finalize();
+    return r;
+}
+
+glm::vec3 Scene::ShadeReservoir(RANDOM_t& random, const RESERVOIR_t& r, glm::vec3 p, glm::vec3 n,
+        glm::vec3 albedo, float lod_spread, unsigned int lod_min, float& weight) const {
+    weight = 0.f;
+    if (r.W <= 0.f) {
+        return {0.f, 0.f, 0.f};
+    }
+    const Primitive& light = primitives[r.y.prim_id];
+    float g = Geometry(light, r.y, p, n);
+    if (g == 0.f) {
+        return {0.f, 0.f, 0.f};
+    }
+    weight = g / kPI * r.W * Transmittance(random, p + eps * n, r.y.p, lod_spread, lod_min);
+    return albedo * light.emission.rgb * weight;
+}
+
+///////////////////
+// SPATIAL REUSE //
+///////////////////
+
+void Scene::PrepareReservoirs(unsigned int pass, const std::vector<unsigned int>& active,
+        const std::vector<PIXEL_STATS_t>& stats) {
+    pixel_reservoirs.resize(cam.width * cam.height);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (unsigned int i = 0; i < active.size(); ++i) {
+        unsigned int x = active[i] % cam.width, y = active[i] / cam.width;
+        PIXEL_RESERVOIR_t& entry = pixel_reservoirs[active[i]];
+
+        // same primary vertex as the pixel sample will shade, visibility buffer's one included
+        RANDOM_t random{Sampler_t(sampler_type)};
+        glm::vec2 pixel = PixelSample(random, x, y, stats[active[i]].n);
+        PATH_t path;
+        ray_intersection_t hit;
+        Ray ray = PrimaryRay(pixel, path, hit);
+        auto raytrace = (path.hit ? *path.hit : RayIntersection(ray));
+        if (raytrace.id == -1 || primitives[raytrace.id].material != MATERIAL::DIFFUSE) {
+            continue;
+        }
+
+        entry.p = ray.o + raytrace.isec.t * ray.d;
+        entry.n = raytrace.isec.normal;
+        entry.albedo = Albedo(raytrace.id, entry.p,
+            ConeFootprint(ray, raytrace.isec.t, entry.n, path.cone_width, path.cone_spread));
+        entry.depth = glm::distance(entry.p, ray.o);
+
+        RANDOM_t lights{Sampler_t(SAMPLER_TYPE::RANDOM)};
+        lights.sampler.StartPixelSample(x, y, candidates_stream | stats[active[i]].n);
+        entry.reservoir = SampleLights(lights, entry.p, entry.n, entry.albedo);
+        entry.pass = pass;
+    }
+}
+
+bool Scene::ReuseReservoirs(unsigned int x, unsigned int y, unsigned int pass, unsigned int sample_id, RESERVOIR_t& r) const {
+    const PIXEL_RESERVOIR_t& center = pixel_reservoirs[y * cam.width + x];
+    if (center.pass != pass) {
+        return false;
+    }
+
+    RANDOM_t random{Sampler_t(SAMPLER_TYPE::RANDOM)};
+    random.sampler.StartPixelSample(x, y, reuse_stream | sample_id);
+
+    // neighbour's sample is reweighted by target at center, its W * M keeps its own candidates' share
+    r = RESERVOIR_t{};
+    auto merge = [&](const RESERVOIR_t& q) {
+        float target = TargetPdf(q.y, center.p, center.n, center.albedo);
+        r.Update(q.y, target * q.W * q.M, target, random.sampler.Get1D());
+        r.M += q.M - 1.f;
+    };
+    if (center.reservoir.M > 0.f) {
+        merge(center.reservoir);
+    }
+
+    for (unsigned int k = 0; k < restir_neighbours; ++k) {
+        glm::vec2 u = random.sampler.Get2D();
+        float radius = restir_radius * std::sqrt(u.x), phi = 2 * kPI * u.y;
+        int nx = x + (int)std::round(radius * cosf(phi));
+        int ny = y + (int)std::round(radius * sinf(phi));
+        if (nx < 0 || ny < 0 || nx >= (int)cam.width || ny >= (int)cam.height || (nx == (int)x && ny == (int)y)) {
+            continue;
+        }
+
+        // only similar surfaces share lights: close normal and depth
+        const PIXEL_RESERVOIR_t& q = pixel_reservoirs[ny * cam.width + nx];
+        if (q.pass != pass || q.reservoir.W <= 0.f || glm::dot(q.n, center.n) < 0.9f ||
+                std::abs(q.depth - center.depth) > 0.1f * center.depth) {
+            continue;
+        }
+        merge(q.reservoir);
+    }
+    r.Finalize();
+    return true;
+}
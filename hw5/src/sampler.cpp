@@ -0,0 +1,411 @@
+#include "sampler.h"
+
+#include <algorithm>
+#include <cmath>
+
+/////////////
+// HASHING //
+/////////////
+
+uint32_t Sampler_t::Hash(uint32_t x) {
+    // lowbias32 by Chris Wellons
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+uint32_t Sampler_t::HashCombine(uint32_t seed, uint32_t v) {
+    return Hash(seed ^ (v + 0x9e3779b9U + (seed << 6) + (seed >> 2)));
+}
+
+glm::uvec4 Philox4x32(glm::uvec4 counter, glm::uvec2 key) {
+    static constexpr uint32_t kMul0 = 0xd2511f53U, kMul1 = 0xcd9e8d57U;
+    static constexpr uint32_t kWeyl0 = 0x9e3779b9U, kWeyl1 = 0xbb67ae85U;
+
+    for (uint8_t round = 0; round < 10; ++round) {
+        uint64_t p0 = (uint64_t)kMul0 * counter.x;
+        uint64_t p1 = (uint64_t)kMul1 * counter.z;
+        counter = {
+            (uint32_t)(p1 >> 32) ^ counter.y ^ key.x,
+            (uint32_t)p1,
+            (uint32_t)(p0 >> 32) ^ counter.w ^ key.y,
+            (uint32_t)p0
+        };
+        key += glm::uvec2{kWeyl0, kWeyl1};
+    }
+    return counter;
+}
+
+static float ToUnitFloat(uint32_t x) {
+    // 24 high bits so result is strictly less than 1
+    return (x >> 8) * (1.f / (1U << 24));
+}
+
+/////////////
+// RANDOM  //
+/////////////
+
+glm::uvec4 Sampler_t::Random(uint32_t dim) const {
+    // random access: value depends only on pixel, sample and dimension
+    return Philox4x32({x_, y_, sample_id_, dim}, {0x5eedU, 0U});
+}
+
+/////////////
+//  SOBOL  //
+/////////////
+
+static uint32_t ReverseBits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555U) | ((x & 0x55555555U) << 1);
+    x = ((x >> 2) & 0x33333333U) | ((x & 0x33333333U) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fU) | ((x & 0x0f0f0f0fU) << 4);
+    x = ((x >> 8) & 0x00ff00ffU) | ((x & 0x00ff00ffU) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Owen scrambling of bit-reversed value by hashing (Laine-Karras, Burley 2020)
+static uint32_t NestedUniformScramble(uint32_t x, uint32_t seed) {
+    x = ReverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cU;
+    x ^= x * 0xb82f1e52U;
+    x ^= x * 0xc7afe638U;
+    x ^= x * 0x8d22f6e6U;
+    return ReverseBits(x);
+}
+
+// second Sobol dimension, first one is plain bit reversal
+static uint32_t Sobol1(uint32_t index) {
+    uint32_t v = 1U << 31;
+    uint32_t result = 0;
+    for (; index; index >>= 1, v ^= v >> 1) {
+        if (index & 1) {
+            result ^= v;
+        }
+    }
+    return result;
+}
+
+float Sampler_t::SobolOwen1D(uint32_t dim, uint32_t seed) const {
+    seed = HashCombine(seed, dim);
+    // shuffling index decorrelates padded dimensions
+    uint32_t index = NestedUniformScramble(sample_id_, seed);
+    uint32_t x = ReverseBits(index);
+    return ToUnitFloat(NestedUniformScramble(x, HashCombine(seed, 1)));
+}
+
+glm::vec2 Sampler_t::SobolOwen2D(uint32_t dim, uint32_t seed) const {
+    seed = HashCombine(seed, dim);
+    uint32_t index = NestedUniformScramble(sample_id_, seed);
+    uint32_t x = ReverseBits(index);
+    uint32_t y = Sobol1(index);
+    return {
+        ToUnitFloat(NestedUniformScramble(x, HashCombine(seed, 1))),
+        ToUnitFloat(NestedUniformScramble(y, HashCombine(seed, 2)))
+    };
+}
+
+/////////////
+// HALTON  //
+/////////////
+
+static const std::vector<uint32_t>& Primes() {
+    static const std::vector<uint32_t> primes = []() {
+        std::vector<uint32_t> res;
+        for (uint32_t p = 2; res.size() < 128; ++p) {
+            bool is_prime = true;
+            for (uint32_t q : res) {
+                if (q * q > p) {
+                    break;
+                }
+                if (p % q == 0) {
+                    is_prime = false;
+                    break;
+                }
+            }
+            if (is_prime) {
+                res.push_back(p);
+            }
+        }
+        return res;
+    }();
+    return primes;
+}
+
+float Sampler_t::Halton(uint32_t dim) const {
+    const std::vector<uint32_t>& primes = Primes();
+    uint32_t seed = HashCombine(pixel_seed_, dim);
+    if (dim >= primes.size()) {
+        // out of bases - independent values
+        return ToUnitFloat(HashCombine(seed, sample_id_));
+    }
+
+    // radical inverse with nested digit scrambling: shift of every digit depends
+    // on the digits before it (Owen-style), trailing zero digits are scrambled too
+    uint32_t base = primes[dim];
+    double inv_base = 1. / base, inv = inv_base;
+    double result = 0.;
+    uint32_t index = sample_id_;
+    uint32_t prefix = seed;
+    for (; inv > 1e-8; inv *= inv_base) {
+        uint32_t digit = index % base;
+        index /= base;
+        result += ((digit + prefix) % base) * inv;
+        prefix = HashCombine(prefix, digit);
+    }
+    return std::min((float)result, 0.99999994f);
+}
+
+////////////////
+// BLUE NOISE //
+////////////////
+
+// ranks of 64x64 tileable blue-noise mask, void-and-cluster (Ulichney 1993)
+const std::vector<uint16_t>& Sampler_t::BlueNoiseMask() {
+    static const std::vector<uint16_t> mask = []() {
+        const int n = kBlueNoiseSize;
+        const int size = n * n;
+        const int radius = 6;
+        const float sigma = 1.9f;
+
+        std::vector<float> kernel((2 * radius + 1) * (2 * radius + 1));
+        for (int dy = -radius; dy <= radius; ++dy) {
+            for (int dx = -radius; dx <= radius; ++dx) {
+                kernel[(dy + radius) * (2 * radius + 1) + dx + radius] = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+            }
+        }
+
+        std::vector<uint8_t> bits(size, 0);
+        std::vector<float> energy(size, 0.f);
+        auto splat = [&](std::vector<float>& field, int id, float sign) {
+            int x = id % n, y = id / n;
+            for (int dy = -radius; dy <= radius; ++dy) {
+                for (int dx = -radius; dx <= radius; ++dx) {
+                    int xx = (x + dx + n) % n, yy = (y + dy + n) % n;
+                    field[yy * n + xx] += sign * kernel[(dy + radius) * (2 * radius + 1) + dx + radius];
+                }
+            }
+        };
+        auto tightest_cluster = [&](const std::vector<uint8_t>& b, const std::vector<float>& field) {
+            int best = -1;
+            for (int i = 0; i < size; ++i) {
+                if (b[i] && (best == -1 || field[i] > field[best])) {
+                    best = i;
+                }
+            }
+            return best;
+        };
+        auto largest_void = [&](const std::vector<uint8_t>& b, const std::vector<float>& field) {
+            int best = -1;
+            for (int i = 0; i < size; ++i) {
+                if (!b[i] && (best == -1 || field[i] < field[best])) {
+                    best = i;
+                }
+            }
+            return best;
+        };
+
+        // initial binary pattern
+        int ones = size / 10;
+        for (uint32_t it = 0, placed = 0; (int)placed < ones; ++it) {
+            int id = Hash(it) % size;
+            if (!bits[id]) {
+                bits[id] = 1;
+                splat(energy, id, 1.f);
+                ++placed;
+            }
+        }
+        for (int it = 0; it < size; ++it) {
+            int cluster = tightest_cluster(bits, energy);
+            bits[cluster] = 0;
+            splat(energy, cluster, -1.f);
+            int hole = largest_void(bits, energy);
+            bits[hole] = 1;
+            splat(energy, hole, 1.f);
+            if (hole == cluster) {
+                break;
+            }
+        }
+
+        std::vector<uint16_t> ranks(size, 0);
+
+        // phase 1 - removing clusters from prototype
+        std::vector<uint8_t> b = bits;
+        std::vector<float> field = energy;
+        for (int rank = ones - 1; rank >= 0; --rank) {
+            int cluster = tightest_cluster(b, field);
+            b[cluster] = 0;
+            splat(field, cluster, -1.f);
+            ranks[cluster] = rank;
+        }
+
+        // phase 2 - filling voids up to full mask
+        for (int rank = ones; rank < size; ++rank) {
+            int hole = largest_void(bits, energy);
+            bits[hole] = 1;
+            splat(energy, hole, 1.f);
+            ranks[hole] = rank;
+        }
+        return ranks;
+    }();
+    return mask;
+}
+
+// global sequence is Cranley-Patterson rotated by mask value, mask is toroidally shifted per dimension
+float Sampler_t::BlueNoise(uint32_t dim) const {
+    const std::vector<uint16_t>& mask = BlueNoiseMask();
+    uint32_t shift = Hash(dim);
+    uint32_t mx = (x_ + (shift & 0xffff)) % kBlueNoiseSize;
+    uint32_t my = (y_ + (shift >> 16)) % kBlueNoiseSize;
+    return (mask[my * kBlueNoiseSize + mx] + 0.5f) / (kBlueNoiseSize * kBlueNoiseSize);
+}
+
+/////////
+// MLT //
+/////////
+
+MLTChain_t::MLTChain_t(uint32_t chain_id, float sigma, float large_step_prob)
+    : chain_id_(chain_id), sigma_(sigma), large_step_prob_(large_step_prob) {}
+
+void MLTChain_t::Seed(uint32_t seed) {
+    seed_ = seed;
+    primary_counter_ = 0;
+    x_.clear();
+    iteration_ = 0;
+    last_large_step_ = 0;
+    large_step_ = true;
+}
+
+float MLTChain_t::PrimaryUniform() {
+    // first point replays bootstrap path of seed, mutations draw from stream of chain's own
+    // (chains started from one seed would walk the same way otherwise)
+    if (iteration_ == 0) {
+        return ToUnitFloat(Philox4x32({primary_counter_++, seed_, 0U, 0U}, {0x4d4cU, 0U}).x);
+    }
+    return ToUnitFloat(Philox4x32({primary_counter_++, seed_, 2U, chain_id_}, {0x4d4cU, 0U}).x);
+}
+
+float MLTChain_t::Uniform() {
+    return ToUnitFloat(Philox4x32({chain_counter_++, chain_id_, 1U, 0U}, {0x4d4cU, 0U}).x);
+}
+
+void MLTChain_t::StartIteration() {
+    ++iteration_;
+    large_step_ = (Uniform() < large_step_prob_);
+}
+
+void MLTChain_t::Accept() {
+    if (large_step_) {
+        last_large_step_ = iteration_;
+    }
+}
+
+void MLTChain_t::Reject() {
+    for (PRIMARY_SAMPLE_t& x : x_) {
+        if (x.modified == iteration_) {
+            x.value = x.value_backup;
+            x.modified = x.modified_backup;
+        }
+    }
+    --iteration_;
+}
+
+float MLTChain_t::Get(uint32_t dim) {
+    if (dim >= x_.size()) {
+        x_.resize(dim + 1);
+    }
+    PRIMARY_SAMPLE_t& x = x_[dim];
+
+    // coordinate untouched since last accepted large step has to catch up with it
+    if (x.modified < last_large_step_) {
+        x.value = PrimaryUniform();
+        x.modified = last_large_step_;
+    }
+    x.value_backup = x.value;
+    x.modified_backup = x.modified;
+
+    if (large_step_) {
+        x.value = PrimaryUniform();
+    } else {
+        // all small steps missed by this coordinate are taken at once
+        float n_small = iteration_ - x.modified;
+        float u1 = std::max(PrimaryUniform(), 1e-7f), u2 = PrimaryUniform();
+        static constexpr float two_pi = 6.28318531f;
+        float normal = std::sqrt(-2.f * std::log(u1)) * std::cos(two_pi * u2);
+        x.value += normal * sigma_ * std::sqrt(n_small);
+        x.value -= std::floor(x.value);
+        x.value = std::min(x.value, 0.99999994f);
+    }
+    x.modified = iteration_;
+    return x.value;
+}
+
+/////////////
+// SAMPLER //
+/////////////
+
+Sampler_t::Sampler_t(SAMPLER_TYPE sampler_type) : sampler_type_(sampler_type) {
+    if (sampler_type == SAMPLER_TYPE::BLUE_NOISE) {
+        BlueNoiseMask();
+    }
+}
+
+Sampler_t::Sampler_t(MLTChain_t* chain) : sampler_type_(SAMPLER_TYPE::MARKOV), chain_(chain) {}
+
+void Sampler_t::StartPixelSample(uint32_t x, uint32_t y, uint32_t sample_id) {
+    x_ = x;
+    y_ = y;
+    pixel_seed_ = HashCombine(Hash(x), y);
+    sample_id_ = sample_id;
+    dim_ = 0;
+}
+
+float Sampler_t::Get1D() {
+    uint32_t dim = dim_++;
+    switch (sampler_type_) {
+        case SAMPLER_TYPE::SOBOL: {
+            return SobolOwen1D(dim, pixel_seed_);
+        }
+        case SAMPLER_TYPE::HALTON: {
+            return Halton(dim);
+        }
+        case SAMPLER_TYPE::BLUE_NOISE: {
+            float u = SobolOwen1D(dim, 0) + BlueNoise(dim);
+            return (u >= 1.f ? u - 1.f : u);
+        }
+        case SAMPLER_TYPE::MARKOV: {
+            return chain_->Get(dim);
+        }
+
+        default: {
+            return ToUnitFloat(Random(dim).x);
+        }
+    }
+}
+
+glm::vec2 Sampler_t::Get2D() {
+    uint32_t dim = dim_;
+    dim_ += 2;
+    switch (sampler_type_) {
+        case SAMPLER_TYPE::SOBOL: {
+            return SobolOwen2D(dim, pixel_seed_);
+        }
+        case SAMPLER_TYPE::HALTON: {
+            return {Halton(dim), Halton(dim + 1)};
+        }
+        case SAMPLER_TYPE::BLUE_NOISE: {
+            glm::vec2 u = SobolOwen2D(dim, 0) + glm::vec2{BlueNoise(dim), BlueNoise(dim + 1)};
+            return {(u.x >= 1.f ? u.x - 1.f : u.x), (u.y >= 1.f ? u.y - 1.f : u.y)};
+        }
+        case SAMPLER_TYPE::MARKOV: {
+            return {chain_->Get(dim), chain_->Get(dim + 1)};
+        }
+
+        default: {
+            glm::uvec4 bits = Random(dim);
+            return {ToUnitFloat(bits.x), ToUnitFloat(bits.y)};
+        }
+    }
+}
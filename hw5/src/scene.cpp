@@ -2,9 +2,15 @@
 
 #include <omp.h>
 
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+
 Camera::Camera(float fov_x) : fov_x(fov_x) {}
 
 void Scene::InitScene() {
+    InitMedia();
+    InitTextures();
     InitBVH();
     InitDistribution();
 }
@@ -17,7 +23,165 @@ void Scene::InitBVH() {
     uint32_t n = std::partition(primitives.begin(), primitives.end(), [](const Primitive &prim) {
         return prim.primitive_type != PRIMITIVE_TYPE::PLANE;
     }) - primitives.begin();
-    scene_bvh = BVH_t(primitives, n);
+    if (lod_levels == 0) {
+        scene_bvh = BVH_t(primitives, n);
+        return;
+    }
+
+    // smaller meshes are traced as they are
+    static constexpr uint32_t lod_min_triangles = 256;
+    // untextured, not emitting Triangles of one material and placement make one mesh
+    auto same_mesh = [](const Primitive& a, const Primitive& b) {
+        return a.material == b.material && a.col.rgb == b.col.rgb && a.ior == b.ior && a.roughness == b.roughness &&
+               a.pos == b.pos && a.rotator == b.rotator;
+    };
+    std::vector<uint32_t> representatives, counts;
+    std::vector<int> mesh_of(n, -1);
+    for (uint32_t id = 0; id < n; ++id) {
+        const Primitive& prim = primitives[id];
+        if (prim.primitive_type != PRIMITIVE_TYPE::TRIANGLE || prim.IsEmitter() || prim.texture_id != -1) {
+            continue;
+        }
+        size_t k = 0;
+        while (k < representatives.size() && !same_mesh(primitives[representatives[k]], prim)) {
+            ++k;
+        }
+        if (k == representatives.size()) {
+            representatives.push_back(id);
+            counts.push_back(0);
+        }
+        mesh_of[id] = k;
+        ++counts[k];
+    }
+
+    // rest of primitives first, then meshes one after another
+    std::vector<uint32_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    auto key = [&](uint32_t id) {
+        return (mesh_of[id] != -1 && counts[mesh_of[id]] >= lod_min_triangles ? mesh_of[id] : -1);
+    };
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return key(a) < key(b);
+    });
+    std::vector<Primitive> sorted;
+    sorted.reserve(primitives.size());
+    for (uint32_t id : order) {
+        sorted.push_back(primitives[id]);
+    }
+    sorted.insert(sorted.end(), primitives.begin() + n, primitives.end());
+    std::vector<int> keys(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        keys[i] = key(order[i]);
+    }
+    primitives.swap(sorted);
+
+    uint32_t n_rest = std::find_if(keys.begin(), keys.end(), [](int k) { return k != -1; }) - keys.begin();
+    scene_bvh = BVH_t(primitives, n_rest);
+    lod_meshes.clear();
+    for (uint32_t first = n_rest; first < n;) {
+        uint32_t last = first;
+        while (last < n && keys[last] == keys[first]) {
+            ++last;
+        }
+        lod_meshes.emplace_back(primitives, first, last, lod_levels);
+        first = last;
+    }
+}
+
+///////////
+// MEDIA //
+///////////
+
+void Scene::InitMedia() {
+    auto is_medium = [](const Primitive& prim) {
+        return prim.sigma_t > 0.f && prim.primitive_type == PRIMITIVE_TYPE::BOX;
+    };
+    for (const Primitive& prim : primitives) {
+        if (prim.sigma_t > 0.f && !is_medium(prim)) {
+            std::cerr << "unexpected medium primitive(" << prim.primitive_type << ")" << std::endl;
+            continue;
+        }
+        if (!is_medium(prim)) {
+            continue;
+        }
+        std::vector<float> density;
+        glm::uvec3 resolution = {1, 1, 1};
+        if (!prim.density_grid.empty() && !LoadDensityGrid(prim.density_grid, density, resolution)) {
+            std::cerr << "unexpected density grid(" << prim.density_grid << ")" << std::endl;
+            continue;
+        }
+        media.emplace_back(prim, std::move(density), resolution);
+    }
+    primitives.erase(std::remove_if(primitives.begin(), primitives.end(), is_medium), primitives.end());
+}
+
+int Scene::SampleMedia(RANDOM_t& random, const Ray& ray, float t_max, float& t) const {
+    // media are independent, nearest of their collisions is collision of their sum
+    int medium = -1;
+    t = t_max;
+    for (size_t k = 0; k < media.size(); ++k) {
+        float t_k = media[k].SampleDistance(random.sampler, ray, t);
+        if (t_k < t) {
+            t = t_k;
+            medium = k;
+        }
+    }
+    return medium;
+}
+
+float Scene::Transmittance(RANDOM_t& random, glm::vec3 a, glm::vec3 b, float lod_spread,
+        unsigned int lod_min) const {
+    if (!Visible(a, b, lod_spread, lod_min)) {
+        return 0.f;
+    }
+    float transmittance = 1.f;
+    for (size_t k = 0; k < media.size() && transmittance > 0.f; ++k) {
+        transmittance *= media[k].Transmittance(random.sampler, Ray(a, b - a), 1.f);
+    }
+    return transmittance;
+}
+
+//////////////
+// TEXTURES //
+//////////////
+
+void Scene::InitTextures() {
+    texture_cache = std::make_unique<TextureCache_t>((size_t)(texture_cache_mb * (1 << 20)));
+    std::unordered_map<std::string, int> id_of;
+    for (Primitive& prim : primitives) {
+        if (prim.texture.empty()) {
+            continue;
+        }
+        auto it = id_of.find(prim.texture);
+        if (it == id_of.end()) {
+            auto texture = std::make_unique<Texture_t>();
+            int id = -1;
+            if (texture->Open(prim.texture, textures.size())) {
+                id = textures.size();
+                textures.push_back(std::move(texture));
+            } else {
+                std::cerr << "unexpected texture(" << prim.texture << ")" << std::endl;
+            }
+            it = id_of.emplace(prim.texture, id).first;
+        }
+        prim.texture_id = it->second;
+    }
+}
+
+glm::vec3 Scene::Albedo(size_t id, glm::vec3 p, float footprint) const {
+    const Primitive& prim = primitives[id];
+    if (prim.texture_id < 0) {
+        return prim.col.rgb;
+    }
+    return textures[prim.texture_id]->Sample(*texture_cache, prim.SurfaceUV(p), footprint * prim.UVDensity());
+}
+
+float Scene::ConeFootprint(const Ray& ray, float t, glm::vec3 normal, float cone_width, float cone_spread) const {
+    // grazing hits stretch cone along surface, bounded to keep lookups from blurring out
+    static constexpr float min_cos = 0.1f;
+    float dist = t * glm::length(ray.d);
+    float cos = std::abs(glm::dot(glm::normalize(ray.d), normal));
+    return (cone_width + cone_spread * dist) / std::max(cos, min_cos);
 }
 
 ///////////////////
@@ -26,24 +190,271 @@ void Scene::InitBVH() {
 
 void Scene::InitDistribution() {
     std::vector<Distribution> prim_distribs;
-    for (const Primitive& prim: primitives) {
-        if (!(prim.emission.r() > 0 || prim.emission.g() > 0 || prim.emission.b() > 0)) {
+    std::vector<float> powers;
+    emitter_of.assign(primitives.size(), -1);
+    for (uint32_t id = 0; id < primitives.size(); ++id) {
+        const Primitive& prim = primitives[id];
+        if (!prim.IsEmitter() || prim.primitive_type == PRIMITIVE_TYPE::PLANE) {
             continue;
         }
+        emitter_of[id] = emitters.size();
+        emitters.push_back(id);
+        powers.push_back(prim.Area() * Luminance(prim.emission));
+
         if (prim.primitive_type == PRIMITIVE_TYPE::BOX) {
             prim_distribs.emplace_back(std::move(Distribution(DISTRIB_TYPE::BOX, &prim)));
         } else if (prim.primitive_type == PRIMITIVE_TYPE::ELLIPSOID) {
             prim_distribs.emplace_back(std::move(Distribution(DISTRIB_TYPE::ELLIPSOID, &prim)));
+        } else if (prim.primitive_type == PRIMITIVE_TYPE::TRIANGLE) {
+            prim_distribs.emplace_back(std::move(Distribution(DISTRIB_TYPE::TRIANGLE, &prim)));
+        }
+    }
+    mix_distrib = Distribution(DISTRIB_TYPE::MIX, std::move(prim_distribs), light_sampling);
+    if (!envmap.Empty()) {
+        mix_distrib.SetEnvMap(&envmap);
+    }
+    emitter_table = AliasTable_t(powers);
+}
+
+///////////////
+// PRE-PASS  //
+///////////////
+
+void Scene::PrePass(unsigned int sample_offset, unsigned int spp,
+        const std::function<void(RANDOM_t&, unsigned int, unsigned int, unsigned int)>& per_sample) {
+    #pragma omp parallel for schedule(dynamic)
+    for (unsigned int i = 0; i < cam.height * cam.width; i++) {
+        RANDOM_t random{Sampler_t(sampler_type)};
+        for (unsigned int s = 0; s < spp; ++s) {
+            per_sample(random, i % cam.width, i / cam.width, sample_offset + s);
         }
     }
-    mix_distrib = Distribution(DISTRIB_TYPE::MIX, std::move(prim_distribs));
+}
+
+/////////////////
+// LIGHT CACHE //
+/////////////////
+
+void Scene::TrainLightCache() {
+    if (light_cache_cell <= 0.f || light_cache_samples == 0 || light_cache_probes == 0 ||
+            emitters.empty() || integrator == INTEGRATOR::BDPT) {
+        return;
+    }
+
+    // cell needs a few probes of every emitter before its table means anything
+    static constexpr uint32_t min_probes_per_light = 2;
+    static constexpr unsigned int sample_offset = 1U << 26;
+
+    light_cache = LightCache_t(light_cache_cell, emitters.size());
+    light_cache_training = true;
+    PrePass(sample_offset, light_cache_samples,
+        [this](RANDOM_t& random, unsigned int x, unsigned int y, unsigned int sample_id) {
+            Sample(random, x, y, sample_id);
+        });
+    light_cache_training = false;
+
+    light_cache.Build(min_probes_per_light * emitters.size());
+    mix_distrib.SetLightCache(&light_cache);
+    std::cout << "Light cache: pre-pass done\n";
+}
+
+void Scene::ProbeLights(RANDOM_t& random, glm::vec3 x, glm::vec3 n, float lod_spread, unsigned int lod_min) {
+    // uniform choice explores every emitter, contribution is luminance white diffuse surface at x reflects
+    for (unsigned int k = 0; k < light_cache_probes; ++k) {
+        uint32_t light = std::min<uint32_t>(random.sampler.Get1D() * emitters.size(), emitters.size() - 1);
+        LIGHT_SAMPLE_t y;
+        y.prim_id = emitters[light];
+        float u_face = random.sampler.Get1D();
+        surface_sample_t point = primitives[y.prim_id].SampleSurface(u_face, random.sampler.Get2D());
+        y.p = point.p;
+        y.n = point.normal;
+
+        float contribution = Luminance(Color{Unshadowed(y, x, n, glm::vec3(1.f))});
+        if (contribution > 0.f) {
+            contribution *= Transmittance(random, x, y.p, lod_spread, lod_min) / point.pdf;
+        }
+        light_cache.Record(x, n, light, contribution);
+    }
+}
+
+///////////////////
+// PATH GUIDING  //
+///////////////////
+
+void Scene::TrainGuide() {
+    if (guiding_passes == 0) {
+        return;
+    }
+
+    // planes are infinite: only their anchor points extend bounds, the rest is clamped
+    AABB_t bounds;
+    for (const Primitive& prim : primitives) {
+        if (prim.primitive_type != PRIMITIVE_TYPE::PLANE) {
+            bounds.Extend(AABB_t(prim));
+        } else {
+            bounds.Extend(prim.pos);
+        }
+    }
+    if (primitives.empty()) {
+        bounds.Extend(cam.pos);
+    }
+    guide = SDTree_t(bounds);
+    mix_distrib.SetGuide(&guide);
+
+    static constexpr unsigned int sample_offset = 1U << 24;
+
+    guide_training = true;
+    for (unsigned int pass = 0; pass < guiding_passes; ++pass) {
+        // pass takes ids right after those of previous ones
+        unsigned int spp = 1U << pass;
+        PrePass(sample_offset + spp - 1, spp,
+            [this](RANDOM_t& random, unsigned int x, unsigned int y, unsigned int sample_id) {
+                Sample(random, x, y, sample_id);
+            });
+        guide.Refine(pass);
+        std::cout << "Guiding: pass " << pass + 1 << "/" << guiding_passes << " done\n";
+    }
+    guide_training = false;
+}
+
+/////////////
+// PHOTONS //
+/////////////
+
+static Point GetReflection(const Point& normal, const Point& dir);
+
+void Scene::TracePhoton(RANDOM_t& random, std::vector<PHOTON_t>& photons) {
+    auto [light, pmf] = emitter_table.Sample(random.sampler.Get1D());
+    const Primitive& prim = primitives[emitters[light]];
+    float u_face = random.sampler.Get1D();
+    surface_sample_t point = prim.SampleSurface(u_face, random.sampler.Get2D());
+
+    // triangles shine on both sides
+    glm::vec3 n = point.normal;
+    float sides = 1.f;
+    if (prim.primitive_type == PRIMITIVE_TYPE::TRIANGLE) {
+        sides = 2.f;
+        if (random.sampler.Get1D() < 0.5f) {
+            n = -1.f * n;
+        }
+    }
+
+    // cosine-distributed emission: Le * cos / (pdf_area * pmf * cos / PI)
+    glm::vec3 dir = CosineDirection(random.sampler.Get2D(), n);
+    glm::vec3 power = prim.emission.rgb * (kPI * sides / (point.pdf * pmf * caustic_photons));
+    Ray ray(point.p + eps * dir, dir);
+
+    bool specular = false;
+    for (unsigned int depth = 0; depth < ray_depth; ++depth) {
+        auto raytrace = RayIntersection(ray);
+        if (raytrace.id == -1) {
+            return;
+        }
+        auto [t, normal, interior] = raytrace.isec;
+        const Primitive& hit = primitives[raytrace.id];
+        Point p = ray.o + t * ray.d;
+        glm::vec3 d = glm::normalize(ray.d);
+
+        if (hit.material != MATERIAL::DIFFUSE && hit.roughness > 0.f) {
+            // glossy vertex continues caustic chain, photon goes to camera side of bsdf
+            float u_lobe = random.sampler.Get1D();
+            glm::vec3 dir, weight;
+            float pdf;
+            if (!Microfacet_t(hit, Albedo(raytrace.id, p, 0.f), normal, interior).Scatter(-1.f * d, true, u_lobe,
+                    random.sampler.Get2D(), dir, weight, pdf)) {
+                return;
+            }
+            power *= weight;
+            ray = Ray(p + eps * dir, dir);
+            specular = true;
+            continue;
+        }
+
+        switch (hit.material) {
+            case MATERIAL::DIFFUSE: {
+                // only light that went through specular chain is a caustic
+                if (specular) {
+                    photons.push_back({p, d, power});
+                }
+                return;
+            }
+            case MATERIAL::METALLIC: {
+                glm::vec3 reflect_dir = GetReflection(normal, d);
+                power *= Albedo(raytrace.id, p, 0.f);
+                ray = Ray(p + eps * reflect_dir, reflect_dir);
+                break;
+            }
+            case MATERIAL::DIELECTRIC: {
+                // same choice as in RayTrace
+                float eta1 = 1., eta2 = hit.ior;
+                if (interior) {
+                    std::swap(eta1, eta2);
+                }
+                float dot_normal_dir = glm::dot(normal, -1.f * d);
+                float sin_theta2 = eta1 / eta2 * sqrt(std::max(0.f, 1 - dot_normal_dir * dot_normal_dir));
+
+                float r0 = pow((eta1 - eta2) / (eta1 + eta2), 2.);
+                float r = r0 + (1 - r0) * pow(1 - dot_normal_dir, 5.);
+                if (fabs(sin_theta2) > 1. || random.sampler.Get1D() < r) {
+                    glm::vec3 reflect_dir = GetReflection(normal, d);
+                    ray = Ray(p + eps * reflect_dir, reflect_dir);
+                    break;
+                }
+
+                float cos_theta2 = sqrt(1 - sin_theta2 * sin_theta2);
+                glm::vec3 refracted_dir = eta1 / eta2 * d + (eta1 / eta2 * dot_normal_dir - cos_theta2) * normal;
+                if (!interior) {
+                    power *= Albedo(raytrace.id, p, 0.f);
+                }
+                ray = Ray(p + eps * refracted_dir, refracted_dir);
+                break;
+            }
+        }
+        specular = true;
+    }
+}
+
+void Scene::EmitPhotons(unsigned int pass) {
+    if (caustic_photons == 0 || emitter_table.Empty()) {
+        return;
+    }
+
+    // radius shrinks as in probabilistic progressive photon mapping (Knaus, Zwicker 2011)
+    static constexpr float alpha = 2.f / 3;
+    if (pass == 0) {
+        photon_radius2 = caustic_radius * caustic_radius;
+    } else {
+        photon_radius2 *= (pass + alpha) / (pass + 1);
+    }
+
+    // photon streams are told apart from pixel ones by sample id
+    static constexpr unsigned int photon_stream = -1;
+
+    std::vector<PHOTON_t> photons;
+    #pragma omp parallel
+    {
+        std::vector<PHOTON_t> local;
+        RANDOM_t random{Sampler_t(SAMPLER_TYPE::RANDOM)};
+
+        #pragma omp for schedule(dynamic, 1024)
+        for (unsigned int i = 0; i < caustic_photons; ++i) {
+            random.sampler.StartPixelSample(i, pass, photon_stream);
+            TracePhoton(random, local);
+        }
+
+        #pragma omp critical
+        photons.insert(photons.end(), local.begin(), local.end());
+    }
+
+    caustic_map = PhotonMap_t(std::move(photons), std::sqrt(photon_radius2));
+    use_caustic_map = true;
 }
 
 /////////////////////
 // SCENE RENDERING //
 /////////////////////
 
-ray_intersection_t Scene::RayIntersection(const Ray &ray) const {
+ray_intersection_t Scene::RayIntersection(const Ray &ray, float lod_spread, unsigned int lod_min) const {
     ray_intersection_t ret;
     ret.id = -1;
 
@@ -69,6 +480,18 @@ ray_intersection_t Scene::RayIntersection(const Ray &ray) const {
     if (ray_isec.id != -1) {
         auto [t, _, __] = ray_isec.isec;
         if (t < closest_dist) {
+            closest_dist = t;
+            ret = ray_isec;
+        }
+    }
+
+    for (const LodMesh_t& mesh : lod_meshes) {
+        // cone width where ray reaches mesh bounds, 0 from inside them
+        unsigned int level = (lod_spread > 0.f ? mesh.Level(lod_spread * mesh.Distance(ray.o)) : 0);
+        level = std::min(std::max(level, lod_min), mesh.Levels() - 1);
+        ray_isec = mesh.Intersect(primitives, ray, closest_dist, level);
+        if (ray_isec.id != -1 && ray_isec.isec.t < closest_dist) {
+            closest_dist = ray_isec.isec.t;
             ret = ray_isec;
         }
     }
@@ -76,60 +499,260 @@ ray_intersection_t Scene::RayIntersection(const Ray &ray) const {
     return ret;
 }
 
+glm::vec3 Scene::Background(glm::vec3 d) const {
+    return (envmap.Empty() ? background.rgb : envmap.Radiance(d));
+}
+
 static Point GetReflection(const Point& normal, const Point& dir) {
     return dir - 2.0 * normal * glm::dot(normal, dir);
 }
 
-Color Scene::RayTrace(RANDOM_t& random, const Ray& ray, size_t ost_raydepth) {
-    std::uniform_real_distribution<float>& uniform01 = random.uniform01.get();
-    auto& rnd = random.rnd;
+glm::vec3 Scene::RoughBounce(RANDOM_t& random, const Ray& ray, glm::vec3 p, glm::vec3 normal, bool interior, size_t id,
+        glm::vec3 col, size_t ost_raydepth, const PATH_t& path) {
+    // L = E + f*L_in(w)*|dot(w,n)| / (c*pdf_light(w) + (1-c)*pdf_bsdf(w))
+    // alpha from which emitters get full share c = 0.5, nearly smooth lobes gain nothing from them
+    static constexpr float light_alpha = 0.2;
+
+    Microfacet_t bsdf(primitives[id], col, normal, interior);
+    glm::vec3 wo = -1.f * glm::normalize(ray.d);
+    glm::vec3 p_outer = p + eps * normal;
+    float light_prob = 0.f;
+    if (mix_distrib.HasLights() && !(use_caustic_map && path.caustic)) {
+        // caustic paths are taken from photon map, emitters they hit add nothing
+        light_prob = 0.5f * std::min(1.f, primitives[id].roughness / light_alpha);
+    }
+
+    glm::vec3 dir;
+    if (random.sampler.Get1D() < light_prob) {
+        dir = mix_distrib.SampleLight(random, p_outer, normal);
+    } else {
+        float u_lobe = random.sampler.Get1D();
+        dir = bsdf.Sample(wo, u_lobe, random.sampler.Get2D());
+    }
+    if (dir == glm::vec3(0.f)) {
+        return {0.f, 0.f, 0.f};
+    }
+
+    float pdf = (1.f - light_prob) * bsdf.Pdf(wo, dir);
+    if (light_prob > 0.f) {
+        pdf += light_prob * mix_distrib.PdfLight(p_outer, normal, dir);
+    }
+    if (pdf <= 0.f) {
+        return {0.f, 0.f, 0.f};
+    }
+    glm::vec3 weight = bsdf.Eval(wo, dir) * (std::abs(glm::dot(dir, normal)) / pdf);
+    if (weight == glm::vec3(0.f)) {
+        return weight;
+    }
+
+    // glossy vertex keeps path state as specular one, photons go through it as well
+    PATH_t next_path = path;
+    next_path.throughput *= weight;
+    return weight * RayTrace(random, Ray(p + eps * dir, dir), ost_raydepth - 1, next_path).rgb;
+}
+
+glm::vec3 Scene::MediumBounce(RANDOM_t& random, const Ray& ray, glm::vec3 x, size_t medium, size_t ost_raydepth,
+        const PATH_t& path) {
+    // L = albedo * phase(w)*L_in(w) / (c*pdf_light(w) + (1-c)*phase(w)), c = 0.5;
+    // there is no surface, so emitters are sampled for whole sphere
+    static constexpr glm::vec3 no_normal = {0.f, 0.f, 0.f};
+
+    const Medium_t& m = media[medium];
+    glm::vec3 wo = -1.f * glm::normalize(ray.d);
+    float light_prob = (mix_distrib.HasLights() ? 0.5f : 0.f);
 
+    glm::vec3 dir;
+    if (random.sampler.Get1D() < light_prob) {
+        dir = mix_distrib.SampleLight(random, x, no_normal);
+    } else {
+        dir = m.SamplePhase(wo, random.sampler.Get2D());
+    }
+    if (dir == glm::vec3(0.f)) {
+        return {0.f, 0.f, 0.f};
+    }
+
+    float phase = m.Phase(wo, dir);
+    float pdf = (1.f - light_prob) * phase;
+    if (light_prob > 0.f) {
+        pdf += light_prob * mix_distrib.PdfLight(x, no_normal, dir);
+    }
+    if (pdf <= 0.f) {
+        return {0.f, 0.f, 0.f};
+    }
+    glm::vec3 weight = m.Albedo() * (phase / pdf);
+
+    // scattering vertex starts new chain as diffuse one does, photon map does not know media
+    PATH_t next_path = {true, false, path.fills_cache};
+    next_path.throughput = path.throughput * weight;
+    next_path.pixel_estimate = path.pixel_estimate;
+    next_path.light_sums = path.light_sums;
+    next_path.cone_width = path.cone_width;
+    next_path.cone_spread = path.cone_spread;
+    return weight * RayTrace(random, Ray(x, dir), ost_raydepth - 1, next_path).rgb;
+}
+
+Color Scene::RayTrace(RANDOM_t& random, const Ray& ray, size_t ost_raydepth, PATH_t path) {
     if (ost_raydepth == 0) {
         return {0., 0., 0.};
     }
 
-    auto raytrace = RayIntersection(ray);
+    auto raytrace = (path.hit ? *path.hit : RayIntersection(ray, path.lod_spread, path.lod_min));
+    if (!media.empty()) {
+        float t_surface = (raytrace.id == -1 ? INF : raytrace.isec.t);
+        float t_medium;
+        int medium = SampleMedia(random, ray, t_surface, t_medium);
+        if (medium != -1) {
+            if (path.indirect_only && !path.after_diffuse) {
+                // scattering before first diffuse vertex belongs to direct pass as a whole
+                return {0.f, 0.f, 0.f};
+            }
+            return {MediumBounce(random, ray, ray.o + t_medium * ray.d, medium, ost_raydepth, path)};
+        }
+    }
     if (raytrace.id == -1) {
-        return background;
+        if (path.indirect_only) {
+            return {0.f, 0.f, 0.f};
+        }
+        glm::vec3 radiance = Background(ray.d);
+        if (path.light_sums) {
+            path.light_sums[separated.size()] += path.throughput * radiance;
+        }
+        return {radiance};
     }
 
     auto [t, normal, interior] = raytrace.isec;
     size_t id = raytrace.id;
     Point p = ray.o + t * ray.d;
+
+    // specular vertices keep path state, diffuse one starts new chain
+    PATH_t specular_path = {path.after_diffuse, path.after_diffuse, path.fills_cache};
+    specular_path.throughput = path.throughput;
+    specular_path.pixel_estimate = path.pixel_estimate;
+    specular_path.light_sums = path.light_sums;
+    specular_path.direct_only = path.direct_only;
+    specular_path.indirect_only = path.indirect_only && !path.after_diffuse;
+    specular_path.lod_min = raytrace.lod;
+    // texture lookups of this hit and cone of rays leaving it
+    float footprint = ConeFootprint(ray, t, normal, path.cone_width, path.cone_spread);
+    glm::vec3 col = Albedo(id, p, footprint);
+    specular_path.cone_width = path.cone_width + path.cone_spread * t * glm::length(ray.d);
+    specular_path.cone_spread = path.cone_spread;
+    // emitter reached from here would be one vertex deeper
+    bool use_ris = (restir_candidates > 0 && !emitter_table.Empty() && ost_raydepth > 1);
     
     Color other_color(0.f, 0.f, 0.f);
+    bool record_cache = false;
+    bool record_adjoint = false;
     switch (primitives[id].material)
     {
     case MATERIAL::DIFFUSE: {
         // L = E + 2*C*L_in(w)*dot(w,n)
+
+        // filling paths store full tails from the same bounce where other paths read them
+        unsigned int bounce = ray_depth - ost_raydepth;
+        if (!radiance_cache.Empty() && !guide_training) {
+            if (path.fills_cache) {
+                record_cache = (bounce == cache_bounces);
+            } else if (bounce == cache_bounces && radiance_cache.Lookup(p, normal, cache_min_samples, other_color.rgb)) {
+                break;
+            }
+        }
+
+        // rays leaving this vertex, shadow ones included, see meshes at the same proxies
+        float lod_spread = (lod_meshes.empty() ? 0.f : path.lod_spread + lod_angle);
+
+        if (use_caustic_map) {
+            // density estimation: L_caustic = C / PI * sum(power) / (PI * r^2)
+            glm::vec3 flux = caustic_map.Gather(p, normal);
+            other_color = {(col / kPI) * flux / (kPI * photon_radius2)};
+        }
+
+        if (use_ris && !(path.indirect_only && !path.after_diffuse)) {
+            // emitters are sampled here, continuation below skips their emission
+            glm::vec3 albedo = col;
+            RESERVOIR_t reservoir = (path.reservoir ? *path.reservoir : SampleLights(random, p, normal, albedo));
+            float weight;
+            glm::vec3 direct = ShadeReservoir(random, reservoir, p, normal, albedo, lod_spread, raytrace.lod, weight);
+            other_color = {other_color.rgb + direct};
+            if (path.light_sums && weight > 0.f) {
+                // per unit emission direct light is albedo * weight
+                path.light_sums[separated_of[reservoir.y.prim_id]] += path.throughput * albedo * weight;
+            }
+        }
         
+        if (light_cache_training) {
+            ProbeLights(random, p + eps * normal, normal, lod_spread, raytrace.lod);
+        }
+
+        record_adjoint = adjoint_training;
+        // roulette or splitting by expected contribution, split paths share weight
+        float split_scale = 1.f;
+        float pixel_estimate = path.pixel_estimate;
+        unsigned int n_continuations = Continuations(random, path, p, normal, primitives[id].emission.rgb,
+            pixel_estimate, split_scale);
+        if (split_indirect && ost_raydepth == 1) {
+            // continuation of last vertex finds nothing, direct pass of split preview ends most paths here
+            n_continuations = 0;
+        }
+
+        // direct pass of split preview sees one vertex past the first diffuse one
+        size_t next_raydepth = ost_raydepth - 1;
+        if (path.direct_only && !path.after_diffuse) {
+            next_raydepth = std::min<size_t>(next_raydepth, 1);
+        }
+
         // moving from surface a lil bit
         glm::vec3 p_outer = p + eps * normal;
-        // генерируем случайное направление при помощи mix_distribution
-        glm::vec3 rand_dir = mix_distrib.Sample(random, p_outer, normal);
+        glm::vec3 C = col;
+        for (unsigned int k = 0; k < n_continuations; ++k) {
+            // генерируем случайное направление при помощи mix_distribution
+            glm::vec3 rand_dir = mix_distrib.Sample(random, p_outer, normal);
 
-        // если не в той полусфере, то не учитываем дополнительный свет
-        if (glm::dot(rand_dir,normal) <= 0) {
-            break;
-        }
+            // если не в той полусфере, то не учитываем дополнительный свет
+            if (glm::dot(rand_dir,normal) <= 0) {
+                continue;
+            }
 
-        float pw = mix_distrib.Pdf(p_outer, normal, rand_dir);
-        glm::vec3 L_in = RayTrace(random, Ray({p + eps * rand_dir, rand_dir}), ost_raydepth-1).rgb;
-        glm::vec3 C = primitives[id].col.rgb;
-        other_color = {(C / kPI) * L_in * glm::dot(rand_dir, normal) * (1 / pw)};
+            float pw = mix_distrib.Pdf(p_outer, normal, rand_dir);
+            glm::vec3 weight = (C / kPI) * glm::dot(rand_dir, normal) * (split_scale / pw);
+            PATH_t next_path = {true, false, path.fills_cache, use_ris};
+            next_path.throughput = path.throughput * weight;
+            next_path.pixel_estimate = pixel_estimate;
+            next_path.light_sums = path.light_sums;
+            next_path.cone_width = specular_path.cone_width;
+            next_path.cone_spread = path.cone_spread;
+            next_path.indirect_only = path.indirect_only && !path.after_diffuse;
+            next_path.lod_spread = lod_spread;
+            next_path.lod_min = raytrace.lod;
+            glm::vec3 L_in = RayTrace(random, Ray({p + eps * rand_dir, rand_dir}), next_raydepth, next_path).rgb;
+            if (guide_training) {
+                // guide learns incident light weighted by cosine, i.e. what diffuse integrand needs
+                guide.Record(p_outer, rand_dir, Luminance(Color{L_in}) * glm::dot(rand_dir, normal) / pw);
+            }
+            other_color = {other_color.rgb + weight * L_in};
+        }
         break;
     }
     case MATERIAL::METALLIC: {   
         // L = E + C*L_in(R_n(w))
+        if (primitives[id].roughness > 0.f) {
+            other_color = {RoughBounce(random, ray, p, normal, interior, id, col, ost_raydepth, specular_path)};
+            break;
+        }
 
         glm::vec3 reflect_dir = GetReflection(normal, glm::normalize(ray.d));
-        Color reflected_color = RayTrace(random, {p + eps * reflect_dir, reflect_dir}, ost_raydepth-1);     
-        other_color = {primitives[id].col.rgb * reflected_color.rgb};
+        specular_path.throughput *= col;
+        Color reflected_color = RayTrace(random, {p + eps * reflect_dir, reflect_dir}, ost_raydepth-1, specular_path);     
+        other_color = {col * reflected_color.rgb};
         break;
     }
     case MATERIAL::DIELECTRIC: {
         // sin(theta2) > 1 or coin flip < r => reflected
         // otherwise => refracted
+        if (primitives[id].roughness > 0.f) {
+            other_color = {RoughBounce(random, ray, p, normal, interior, id, col, ost_raydepth, specular_path)};
+            break;
+        }
 
         float eta1 = 1., eta2 = primitives[id].ior;
         if (interior) {
@@ -142,7 +765,7 @@ Color Scene::RayTrace(RANDOM_t& random, const Ray& ray, size_t ost_raydepth) {
 
         if (fabs(sin_theta2) > 1.) { // полное внутреннее отражение = вернуть отражённый
             glm::vec3 reflect_dir = GetReflection(normal, glm::normalize(ray.d));
-            Color reflected_color = RayTrace(random, {p + eps * reflect_dir, reflect_dir}, ost_raydepth-1);
+            Color reflected_color = RayTrace(random, {p + eps * reflect_dir, reflect_dir}, ost_raydepth-1, specular_path);
             other_color = reflected_color;
             break;
         }
@@ -151,9 +774,9 @@ Color Scene::RayTrace(RANDOM_t& random, const Ray& ray, size_t ost_raydepth) {
         float r = r0 + (1 - r0) * pow(1 - dot_normal_dir, 5.);
 
         // с шансом r вернем отражённый / 1-r соответственно преломлённый
-        if (uniform01(rnd) < r) {
+        if (random.sampler.Get1D() < r) {
             glm::vec3 reflect_dir = GetReflection(normal, glm::normalize(ray.d));
-            Color reflected_color = RayTrace(random, {p + eps * reflect_dir, reflect_dir}, ost_raydepth-1);
+            Color reflected_color = RayTrace(random, {p + eps * reflect_dir, reflect_dir}, ost_raydepth-1, specular_path);
             other_color = reflected_color;
             break;
         }
@@ -161,9 +784,12 @@ Color Scene::RayTrace(RANDOM_t& random, const Ray& ray, size_t ost_raydepth) {
         float cos_theta2 = sqrt(1 - sin_theta2 * sin_theta2);
         glm::vec3 refracted_dir = eta1 / eta2 * (-1. * dir) + (eta1 / eta2 * dot_normal_dir - cos_theta2) * normal;
         Ray refracted = Ray(p + eps * refracted_dir, refracted_dir);
-        Color refracted_color = RayTrace(random, refracted, ost_raydepth - 1);
         if (!interior) {
-            refracted_color = { primitives[id].col.rgb * refracted_color.rgb };
+            specular_path.throughput *= col;
+        }
+        Color refracted_color = RayTrace(random, refracted, ost_raydepth - 1, specular_path);
+        if (!interior) {
+            refracted_color = { col * refracted_color.rgb };
         }
         other_color = refracted_color;
         break;
@@ -173,6 +799,25 @@ Color Scene::RayTrace(RANDOM_t& random, const Ray& ray, size_t ost_raydepth) {
         break;
     }
 
+    if (record_cache) {
+        radiance_cache.Record(p, normal, other_color.rgb);
+    }
+    if (record_adjoint) {
+        adjoint_cache.Record(p, normal, other_color.rgb);
+    }
+
+    if (emitter_of[id] != -1 && ((use_caustic_map && path.caustic) || path.after_direct)) {
+        // this light is already counted at last diffuse vertex, by caustic map or by resampled lights
+        // (planes emit no photons and are not sampled, their light is counted here)
+        return other_color;
+    }
+    if (path.indirect_only) {
+        // emission up to the vertex after first diffuse one is counted by direct pass
+        return other_color;
+    }
+    if (path.light_sums && separated_of[id] != -1) {
+        path.light_sums[separated_of[id]] += path.throughput;
+    }
     Color summary_color = {primitives[id].emission.rgb + other_color.rgb};
     return summary_color;
 }
@@ -186,20 +831,108 @@ Ray Camera::GetToRay(float x, float y) const {
     return {pos, nx*right + ny*up + 1.f*forward};
 }
 
-Color Scene::Sample(RANDOM_t& random, unsigned int x, unsigned int y) {
-    std::uniform_real_distribution<float>& uniform01 = random.uniform01.get();
-    auto& rnd = random.rnd;
+Ray Camera::GetToRay(float x, float y, float& spread) const {
+    Ray ray = GetToRay(x, y);
+    float tan_fov_x = tan(fov_x / 2);
+    float tan_fov_y = tan_fov_x * height / width;
+
+    // d(direction)/dx and d(direction)/dy over one pixel, angle of unit-length difference
+    glm::vec3 dd_dx = (2 * tan_fov_x / width) * right;
+    glm::vec3 dd_dy = (-2 * tan_fov_y / height) * up;
+    glm::vec3 d = glm::normalize(ray.d);
+    float spread_x = glm::length(glm::normalize(ray.d + dd_dx) - d);
+    float spread_y = glm::length(glm::normalize(ray.d + dd_dy) - d);
+    spread = std::max(spread_x, spread_y);
+    return ray;
+}
+
+bool Camera::Project(glm::vec3 q, glm::vec2& pixel) const {
+    float tan_fov_x = tan(fov_x / 2);
+    float tan_fov_y = tan_fov_x * height / width;
+
+    glm::vec3 v = q - pos;
+    float z = glm::dot(v, forward);
+    if (z <= 0.f) {
+        return false;
+    }
+    float nx = glm::dot(v, right) / z;
+    float ny = glm::dot(v, up) / z;
+    pixel = {(nx / tan_fov_x + 1) * width / 2, (1 - ny / tan_fov_y) * height / 2};
+    return pixel.x >= 0.f && pixel.x < width && pixel.y >= 0.f && pixel.y < height;
+}
+
+float Camera::ImagePlaneArea() const {
+    float tan_fov_x = tan(fov_x / 2);
+    float tan_fov_y = tan_fov_x * height / width;
+    return 4 * tan_fov_x * tan_fov_y;
+}
+
+///////////////////////
+// ADAPTIVE SAMPLING //
+///////////////////////
+
+void PIXEL_STATS_t::Add(const Color& color) {
+    float radiance = Luminance(color);
+    float radiance_delta = radiance - Luminance(Color{mean});
+    ++n;
+    mean += (color.rgb - mean) / (float)n;
+    radiance_m2 += radiance_delta * (radiance - Luminance(Color{mean}));
+
+    // error is measured on displayed values, so bright pixels do not dominate
+    float lum = Luminance(GammaCorrected(AcesTonemap(color)));
+    float delta = lum - lum_mean;
+    lum_mean += delta / n;
+    lum_m2 += delta * (lum - lum_mean);
+}
+
+float PIXEL_STATS_t::RelativeError() const {
+    if (n < 2) {
+        return INF;
+    }
+    // absolute floor keeps almost black pixels from being refined forever
+    static constexpr float min_lum = 5e-2;
+    float variance = lum_m2 / (n - 1);
+    return std::sqrt(variance / n) / std::max(lum_mean, min_lum);
+}
+
+float PIXEL_STATS_t::MeanVariance() const {
+    if (n < 2) {
+        return INF;
+    }
+    return radiance_m2 / ((n - 1) * n);
+}
+
+glm::vec2 Scene::PixelSample(RANDOM_t& random, unsigned int x, unsigned int y, unsigned int sample_id) {
+    random.sampler.StartPixelSample(x, y, frame_sample_offset + sample_id);
 
-    Color summary(0.f, 0.f, 0.f);
+    // сглаживаем
+    glm::vec2 jitter = random.sampler.Get2D();
+    return {x + jitter.x, y + jitter.y};
+}
 
-    for(unsigned int i = 0; i < samples; ++i) {
-        // сглаживаем
-        float fx = x + uniform01(rnd);
-        float fy = y + uniform01(rnd);
-        summary = {summary.rgb + RayTrace(random, cam.GetToRay(fx, fy), ray_depth).rgb};
+Color Scene::Sample(RANDOM_t& random, unsigned int x, unsigned int y, unsigned int sample_id,
+        const RESERVOIR_t* reservoir) {
+    glm::vec2 pixel = PixelSample(random, x, y, sample_id);
+    if (integrator == INTEGRATOR::BDPT) {
+        return SampleBDPT(random, pixel.x, pixel.y);
+    }
+    PATH_t path;
+    path.fills_cache = (sample_id % cache_fill_period == 0);
+    path.reservoir = reservoir;
+    path.direct_only = split_indirect;
+    if (!light_buffers.empty()) {
+        path.light_sums = &light_buffers[(x + y * cam.width) * (separated.size() + 1)];
+    }
+    ray_intersection_t hit;
+    Ray ray = PrimaryRay(pixel, path, hit);
+    return RayTrace(random, ray, ray_depth, path);
+}
+
+void Scene::Splat(glm::vec2 pixel, glm::vec3 value) {
+    unsigned int id = (unsigned int)pixel.x + (unsigned int)pixel.y * cam.width;
+    for (uint8_t c = 0; c < 3; ++c) {
+        AtomicAdd(splats[3 * id + c], value[c]);
     }
-    Color mean = {1.f / samples * summary.rgb };
-    return mean;
 }
 
 void Scene::Render(std::ostream &out) {
@@ -207,46 +940,218 @@ void Scene::Render(std::ostream &out) {
     out << cam.width << " " << cam.height << "\n";
     out << 255 << "\n";
 
-    std::vector<std::vector<glm::vec3>> pixels(cam.height, std::vector<glm::vec3>(cam.width));
+    unsigned int n_pixels = cam.height * cam.width;
+    std::vector<PIXEL_STATS_t> stats(n_pixels);
 
     omp_set_num_threads(std::thread::hardware_concurrency());
-    unsigned int percent10 = cam.height * cam.width / 10;
-    #pragma omp parallel for schedule(dynamic)
-    for (unsigned int i = 0; i < cam.height * cam.width; i++) {
-        std::minstd_rand rnd(i);
-        std::uniform_real_distribution<float> uniform01{0.f, 1.f};
-        std::normal_distribution<float> normal01{0.f, 1.f};
-        RANDOM_t random{
-            rnd, 
-            uniform01, 
-            normal01
-        };
-        unsigned int x = i % cam.width;
-        unsigned int y = i / cam.width;
-        Color color = Sample(random, x, y);
-        color = AcesTonemap(color);
-        color = GammaCorrected(color);
+    if (integrator != INTEGRATOR::PATH) {
+        // guiding and photon map serve pixel passes of RayTrace only
+        guiding_passes = 0;
+        caustic_photons = 0;
+        // light buffers, split preview and visibility buffer serve RayTrace of pixel samples only
+        light_buffer_prefix.clear();
+        indirect_res = INDIRECT_RES::FULL;
+        raster_subsamples = 0;
+    }
+    if (!light_buffer_prefix.empty()) {
+        // photon map and radiance cache give light that can not be told apart by emitter
+        caustic_photons = 0;
+        cache_cell = 0.f;
+        // every path has to be summed into buffers of its own pixel
+        indirect_res = INDIRECT_RES::FULL;
+    }
+    if (indirect_res != INDIRECT_RES::FULL) {
+        // light of photon map and radiance cache is not split at first diffuse vertex
+        caustic_photons = 0;
+        cache_cell = 0.f;
+    }
+    if (integrator == INTEGRATOR::BDPT || integrator == INTEGRATOR::MLT) {
+        splats = std::vector<std::atomic<float>>(3 * n_pixels);
+        for (auto& splat : splats) {
+            splat.store(0.f, std::memory_order_relaxed);
+        }
+    }
+    // camera of this frame is in place, pre-passes start from buffer as well
+    RasterizeVisibility();
+    TrainLightCache();
+    TrainGuide();
+    TrainAdjoint();
+    // pre-passes trace pixel samples as well, they must not be summed
+    InitLightBuffers();
+    if (cache_cell > 0.f && integrator == INTEGRATOR::PATH) {
+        static constexpr uint32_t cache_table_bits = 20;
+        radiance_cache = RadianceCache_t(cache_cell, cache_table_bits);
+    }
+
+    bool adaptive = (adaptive_threshold > 0.f && min_samples > 0 && min_samples < samples);
+    unsigned int batch = (adaptive ? min_samples : samples);
+    if (caustic_photons > 0) {
+        // every photon pass serves its share of samples
+        batch = std::min(batch, (samples + caustic_passes - 1) / caustic_passes);
+    }
+    // neighbours' reservoirs have to exist before pixel samples, so pass makes one sample
+    bool reuse_lights = (restir_candidates > 0 && restir_neighbours > 0 && integrator == INTEGRATOR::PATH);
+    if (reuse_lights) {
+        batch = 1;
+    }
+
+    // pre-passes need whole paths
+    split_indirect = (indirect_res != INDIRECT_RES::FULL);
 
-        pixels[y][x] = color.rgb;
+    std::vector<unsigned int> active(n_pixels);
+    std::iota(active.begin(), active.end(), 0);
 
-        if (i && i % percent10 == 0) {
-            std::string loading_bar = "Loading: [ ";
-            unsigned int ct = i / percent10;
-            loading_bar += std::string(ct, '#');
-            loading_bar += std::string(11-ct, ' ');
-            loading_bar += std::to_string(ct * 10);
-            loading_bar += "% ]\n";
-            std::cout << loading_bar;
+    float splat_scale = 0.f;
+    if (integrator == INTEGRATOR::MLT) {
+        // chains wander over whole image, there are no pixel passes
+        splat_scale = RenderMLT();
+        active.clear();
+    }
+    if (integrator == INTEGRATOR::GDPT) {
+        // gradients need shifted paths of all neighbours, image is reconstructed at once
+        RenderGDPT(stats);
+        active.clear();
+    }
+
+    for (unsigned int pass = 0; !active.empty(); ++pass) {
+        unsigned int n_active = active.size();
+        unsigned int percent10 = std::max(n_active / 10, 1U);
+        if (pass > 0) {
+            std::cout << "Pass " << pass + 1 << ": " << n_active << " pixels\n";
+        }
+        EmitPhotons(pass);
+        if (reuse_lights) {
+            PrepareReservoirs(pass, active, stats);
         }
+
+        #pragma omp parallel for schedule(dynamic)
+        for (unsigned int i = 0; i < n_active; i++) {
+            RANDOM_t random{Sampler_t(sampler_type)};
+            unsigned int x = active[i] % cam.width;
+            unsigned int y = active[i] / cam.width;
+            PIXEL_STATS_t& pixel = stats[active[i]];
+
+            unsigned int last = std::min(pixel.n + batch, samples);
+            while (pixel.n < last) {
+                RESERVOIR_t reservoir;
+                bool reused = reuse_lights && ReuseReservoirs(x, y, pass, pixel.n, reservoir);
+                pixel.Add(Sample(random, x, y, pixel.n, reused ? &reservoir : nullptr));
+            }
+
+            if (pass == 0 && i && i % percent10 == 0) {
+                std::string loading_bar = "Loading: [ ";
+                unsigned int ct = std::min(i / percent10, 10U);
+                loading_bar += std::string(ct, '#');
+                loading_bar += std::string(11-ct, ' ');
+                loading_bar += std::to_string(ct * 10);
+                loading_bar += "% ]\n";
+                std::cout << loading_bar;
+            }
+        }
+
+        if (!adaptive) {
+            active.erase(std::remove_if(active.begin(), active.end(), [&](unsigned int id) {
+                return stats[id].n >= samples;
+            }), active.end());
+            continue;
+        }
+
+        // small batches can miss rare paths entirely and report zero variance,
+        // so converged pixels next to noisy ones are refined as well
+        std::vector<uint8_t> noisy(n_pixels, 0);
+        for (unsigned int id : active) {
+            noisy[id] = (stats[id].RelativeError() > adaptive_threshold);
+        }
+        auto is_active = [&](unsigned int id) {
+            if (stats[id].n >= samples) {
+                return false;
+            }
+            unsigned int x = id % cam.width, y = id / cam.width;
+            return noisy[id] ||
+                (x > 0 && noisy[id - 1]) || (x + 1 < cam.width && noisy[id + 1]) ||
+                (y > 0 && noisy[id - cam.width]) || (y + 1 < cam.height && noisy[id + cam.width]);
+        };
+        active.erase(std::remove_if(active.begin(), active.end(), [&](unsigned int id) {
+            return !is_active(id);
+        }), active.end());
     }
 
-    for (unsigned int y = 0; y < cam.height; ++y) {
-        for (unsigned int x = 0; x < cam.width; ++x) {
-            Color color = pixels[y][x];
+    // every light subpath could splat anywhere on image
+    if (integrator == INTEGRATOR::BDPT) {
+        uint64_t total = 0;
+        for (const PIXEL_STATS_t& pixel : stats) {
+            total += pixel.n;
+        }
+        splat_scale = (float)n_pixels / std::max<uint64_t>(total, 1);
+    }
 
-            uint8_t *rgb = color.toUInts();
-            out.write(reinterpret_cast<char*>(rgb), 3);
-            delete[] rgb;
+    if (!light_buffers.empty()) {
+        WriteLightBuffers(stats);
+    }
+    if (!textures.empty()) {
+        std::cout << "Texture cache: " << texture_cache->Lookups() << " lookups, " << texture_cache->Misses() << " misses\n";
+    }
+
+    std::vector<glm::vec3> image(n_pixels);
+    for (unsigned int i = 0; i < n_pixels; ++i) {
+        image[i] = stats[i].mean;
+        if (!splats.empty()) {
+            for (uint8_t c = 0; c < 3; ++c) {
+                image[i][c] += splat_scale * splats[3 * i + c].load(std::memory_order_relaxed);
+            }
         }
     }
-}
\ No newline at end of file
+
+    std::vector<AOV_t> aovs;
+    if (denoise_iterations > 0 || !aov_prefix.empty() || animation_frames > 0 || split_indirect) {
+        aovs = RenderAOVs();
+    }
+    if (split_indirect) {
+        RenderIndirect(image, aovs);
+        split_indirect = false;
+    }
+    if (!aov_prefix.empty()) {
+        WriteAOVs(aovs);
+    }
+    // share of this frame's samples in pixel, history takes the rest
+    std::vector<float> fresh(n_pixels, 1.f);
+    if (animation_frames > 0) {
+        fresh = AccumulateHistory(image, stats, aovs);
+    }
+    if (denoise_iterations > 0) {
+        // samples tell variance only where they make whole pixel value
+        bool own_variance = (integrator == INTEGRATOR::PATH);
+        std::vector<float> variance(n_pixels, -1.f);
+        for (unsigned int i = 0; own_variance && i < n_pixels; ++i) {
+            if (stats[i].n >= 2) {
+                variance[i] = stats[i].MeanVariance() * fresh[i];
+            }
+        }
+        image = DenoiseATrous(image, variance, aovs, cam.width, cam.height, denoise_iterations, denoise_sigma);
+    }
+
+    samples_used.resize(n_pixels);
+    for (unsigned int i = 0; i < n_pixels; ++i) {
+        samples_used[i] = stats[i].n;
+
+        Color color = {image[i]};
+        color = AcesTonemap(color);
+        color = GammaCorrected(color);
+
+        uint8_t *rgb = color.toUInts();
+        out.write(reinterpret_cast<char*>(rgb), 3);
+        delete[] rgb;
+    }
+}
+
+void Scene::WriteSamplesMap(std::ostream &out) const {
+    out << "P6\n";
+    out << cam.width << " " << cam.height << "\n";
+    out << 255 << "\n";
+
+    for (uint32_t n : samples_used) {
+        uint8_t value = std::min(255U, 255U * n / std::max(samples, 1U));
+        uint8_t rgb[3] = {value, value, value};
+        out.write(reinterpret_cast<char*>(rgb), 3);
+    }
+}
@@ -28,6 +28,32 @@ unsigned int get_command(const std::string& command) {
     if (command == "SAMPLES")               return COMMAND_SAMPLES;
     if (command == "EMISSION")              return COMMAND_EMISSION;
     if (command == "TRIANGLE")              return COMMAND_TRIANGLE;
+    if (command == "LIGHT_SAMPLING")        return COMMAND_LIGHT_SAMPLING;
+    if (command == "SAMPLER")               return COMMAND_SAMPLER;
+    if (command == "ADAPTIVE_SAMPLING")     return COMMAND_ADAPTIVE_SAMPLING;
+    if (command == "PATH_GUIDING")          return COMMAND_PATH_GUIDING;
+    if (command == "CAUSTICS")              return COMMAND_CAUSTICS;
+    if (command == "INTEGRATOR")            return COMMAND_INTEGRATOR;
+    if (command == "RADIANCE_CACHE")        return COMMAND_RADIANCE_CACHE;
+    if (command == "MLT")                   return COMMAND_MLT;
+    if (command == "RESTIR")                return COMMAND_RESTIR;
+    if (command == "ADRRS")                 return COMMAND_ADRRS;
+    if (command == "GDPT")                  return COMMAND_GDPT;
+    if (command == "ENVMAP")                return COMMAND_ENVMAP;
+    if (command == "ROUGHNESS")             return COMMAND_ROUGHNESS;
+    if (command == "LIGHT_CACHE")           return COMMAND_LIGHT_CACHE;
+    if (command == "DENOISE")               return COMMAND_DENOISE;
+    if (command == "AOV")                   return COMMAND_AOV;
+    if (command == "LIGHT_BUFFERS")         return COMMAND_LIGHT_BUFFERS;
+    if (command == "MEDIUM")                return COMMAND_MEDIUM;
+    if (command == "TEXTURE")               return COMMAND_TEXTURE;
+    if (command == "UV")                    return COMMAND_UV;
+    if (command == "TEXTURE_CACHE")         return COMMAND_TEXTURE_CACHE;
+    if (command == "ANIMATION")             return COMMAND_ANIMATION;
+    if (command == "CAMERA_KEY")            return COMMAND_CAMERA_KEY;
+    if (command == "INDIRECT_RES")          return COMMAND_INDIRECT_RES;
+    if (command == "RASTER")                return COMMAND_RASTER;
+    if (command == "LOD")                   return COMMAND_LOD;
 
     return -1;
 }
@@ -98,6 +124,25 @@ std::pair<Primitive, std::string> LoadPrimitive(std::istream &in) {
                 ss >> primitive.emission;
                 break;
             }            
+            case COMMAND_ROUGHNESS: {
+                ss >> primitive.roughness;
+                primitive.roughness = std::max(primitive.roughness, 0.f);
+                break;
+            }
+            case COMMAND_MEDIUM: {
+                ss >> primitive.sigma_t >> primitive.phase_g >> primitive.density_grid;
+                primitive.sigma_t = std::max(primitive.sigma_t, 0.f);
+                break;
+            }
+            case COMMAND_TEXTURE: {
+                ss >> primitive.texture;
+                break;
+            }
+            case COMMAND_UV: {
+                ss >> primitive.uv_a.x >> primitive.uv_a.y >> primitive.uv_b.x >> primitive.uv_b.y
+                   >> primitive.uv_c.x >> primitive.uv_c.y;
+                break;
+            }
             
             default: {
                 // std::cerr << "unexpected primitive(" << cmd_name << ")" << std::endl;
@@ -167,6 +212,149 @@ void Scene::Load(std::istream &in) {
                 ss >> samples;
                 break;
             }
+            case COMMAND_LIGHT_SAMPLING: {
+                std::string mode;
+                ss >> mode;
+                if (mode == "BVH") {
+                    light_sampling = LIGHT_SAMPLING::BVH;
+                } else if (mode == "POWER") {
+                    light_sampling = LIGHT_SAMPLING::POWER;
+                } else {
+                    std::cerr << "unexpected light sampling(" << mode << ")" << std::endl;
+                }
+                break;
+            }
+            case COMMAND_SAMPLER: {
+                std::string type;
+                ss >> type;
+                if (type == "RANDOM") {
+                    sampler_type = SAMPLER_TYPE::RANDOM;
+                } else if (type == "SOBOL") {
+                    sampler_type = SAMPLER_TYPE::SOBOL;
+                } else if (type == "HALTON") {
+                    sampler_type = SAMPLER_TYPE::HALTON;
+                } else if (type == "BLUE_NOISE") {
+                    sampler_type = SAMPLER_TYPE::BLUE_NOISE;
+                } else {
+                    std::cerr << "unexpected sampler(" << type << ")" << std::endl;
+                }
+                break;
+            }
+            case COMMAND_ADAPTIVE_SAMPLING: {
+                ss >> min_samples >> adaptive_threshold;
+                break;
+            }
+            case COMMAND_PATH_GUIDING: {
+                ss >> guiding_passes;
+                break;
+            }
+            case COMMAND_CAUSTICS: {
+                ss >> caustic_photons >> caustic_radius >> caustic_passes;
+                caustic_passes = std::max(caustic_passes, 1U);
+                break;
+            }
+            case COMMAND_INTEGRATOR: {
+                std::string type;
+                ss >> type;
+                if (type == "PATH") {
+                    integrator = INTEGRATOR::PATH;
+                } else if (type == "BDPT") {
+                    integrator = INTEGRATOR::BDPT;
+                } else if (type == "MLT") {
+                    integrator = INTEGRATOR::MLT;
+                } else if (type == "GDPT") {
+                    integrator = INTEGRATOR::GDPT;
+                } else {
+                    std::cerr << "unexpected integrator(" << type << ")" << std::endl;
+                }
+                break;
+            }
+            case COMMAND_RADIANCE_CACHE: {
+                ss >> cache_cell >> cache_bounces;
+                break;
+            }
+            case COMMAND_MLT: {
+                ss >> mlt_bootstrap >> mlt_chains >> mlt_large_step;
+                mlt_bootstrap = std::max(mlt_bootstrap, 1U);
+                mlt_chains = std::max(mlt_chains, 1U);
+                break;
+            }
+            case COMMAND_RESTIR: {
+                ss >> restir_candidates >> restir_neighbours >> restir_radius;
+                break;
+            }
+            case COMMAND_ADRRS: {
+                ss >> adrrs_samples >> adrrs_cell >> adrrs_max_split;
+                adrrs_max_split = std::max(adrrs_max_split, 1U);
+                break;
+            }
+            case COMMAND_GDPT: {
+                ss >> gdpt_alpha >> gdpt_iterations >> gdpt_l1_passes;
+                break;
+            }
+            case COMMAND_ENVMAP: {
+                std::string path;
+                float scale = 1.f;
+                ss >> path >> scale;
+                if (!envmap.Load(path, scale)) {
+                    std::cerr << "unexpected environment map(" << path << ")" << std::endl;
+                }
+                break;
+            }
+            case COMMAND_LIGHT_CACHE: {
+                ss >> light_cache_cell >> light_cache_samples >> light_cache_probes;
+                break;
+            }
+            case COMMAND_DENOISE: {
+                ss >> denoise_iterations >> denoise_sigma;
+                break;
+            }
+            case COMMAND_AOV: {
+                ss >> aov_prefix;
+                break;
+            }
+            case COMMAND_LIGHT_BUFFERS: {
+                ss >> light_buffer_prefix;
+                break;
+            }
+            case COMMAND_TEXTURE_CACHE: {
+                ss >> texture_cache_mb;
+                break;
+            }
+            case COMMAND_ANIMATION: {
+                ss >> animation_frames >> history_max;
+                break;
+            }
+            case COMMAND_CAMERA_KEY: {
+                Point pos, forward;
+                ss >> pos >> forward;
+                camera_keys.emplace_back(pos, forward);
+                break;
+            }
+            case COMMAND_INDIRECT_RES: {
+                std::string type;
+                ss >> type;
+                if (type == "FULL") {
+                    indirect_res = INDIRECT_RES::FULL;
+                } else if (type == "HALF") {
+                    indirect_res = INDIRECT_RES::HALF;
+                } else if (type == "QUARTER") {
+                    indirect_res = INDIRECT_RES::QUARTER;
+                } else if (type == "CHECKERBOARD") {
+                    indirect_res = INDIRECT_RES::CHECKERBOARD;
+                } else {
+                    std::cerr << "unexpected indirect resolution(" << type << ")" << std::endl;
+                }
+                break;
+            }
+            case COMMAND_RASTER: {
+                ss >> raster_subsamples;
+                break;
+            }
+            case COMMAND_LOD: {
+                ss >> lod_levels >> lod_angle;
+                break;
+            }
             default: {
                 std::cerr << "unexpected command(" << cmd_name << ")" << std::endl;
                 break;
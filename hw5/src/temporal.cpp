@@ -0,0 +1,119 @@
+#include "scene.h"
+
+#include <glm/geometric.hpp>
+
+#include <cmath>
+#include <cstdio>
+
+void Scene::SetFrameCamera(unsigned int frame) {
+    if (frame == 0) {
+        first_cam = cam;
+    }
+    if (camera_keys.empty() || animation_frames < 2) {
+        return;
+    }
+    // keys are spread evenly over frames, first one is camera of scene
+    float s = (float)frame / (animation_frames - 1) * camera_keys.size();
+    unsigned int k = std::min<unsigned int>(s, camera_keys.size() - 1);
+    float f = s - k;
+    glm::vec3 pos0 = (k == 0 ? first_cam.pos : camera_keys[k - 1].first);
+    glm::vec3 fwd0 = (k == 0 ? first_cam.forward : camera_keys[k - 1].second);
+    auto [pos1, fwd1] = camera_keys[k];
+
+    cam.pos = (1.f - f) * pos0 + f * pos1;
+    cam.forward = glm::normalize((1.f - f) * glm::normalize(fwd0) + f * glm::normalize(fwd1));
+    cam.right = glm::normalize(glm::cross(cam.forward, first_cam.up));
+    cam.up = glm::cross(cam.right, cam.forward);
+}
+
+void Scene::RenderAnimation(const std::string& prefix) {
+    for (unsigned int frame = 0; frame < animation_frames; ++frame) {
+        SetFrameCamera(frame);
+        // samples of every frame continue sequences of previous ones
+        frame_sample_offset = frame * samples;
+
+        char name[16];
+        std::snprintf(name, sizeof(name), "%04u.ppm", frame);
+        std::ofstream out(prefix + name);
+        std::cout << "Frame " << frame + 1 << " of " << animation_frames << "\n";
+        Render(out);
+        history_cam = cam;
+    }
+}
+
+std::vector<float> Scene::AccumulateHistory(std::vector<glm::vec3>& image, const std::vector<PIXEL_STATS_t>& stats,
+        const std::vector<AOV_t>& aovs) {
+    // history tap is kept when it saw the same surface: depth within tolerance, normals close
+    static constexpr float depth_tolerance = 0.05f;
+    static constexpr float min_normal_cos = 0.9f;
+    static constexpr float min_weight = 1e-3f;
+
+    unsigned int n_pixels = cam.width * cam.height;
+    unsigned int max_history = (history_max > 0 ? history_max : 8 * samples);
+    std::vector<float> fresh(n_pixels, 1.f);
+    std::vector<glm::vec3> next(image);
+    std::vector<float> next_n(n_pixels);
+
+    bool has_history = (history.size() == n_pixels && history_cam.width == cam.width && history_cam.height == cam.height);
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (unsigned int i = 0; i < n_pixels; ++i) {
+        unsigned int x = i % cam.width, y = i / cam.width;
+        float n = stats[i].n;
+        next_n[i] = n;
+        if (!has_history || n == 0.f) {
+            continue;
+        }
+
+        // first hit seen by previous camera, escaped rays are reprojected as directions
+        const AOV_t& aov = aovs[i];
+        glm::vec3 d = cam.GetToRay(x + 0.5f, y + 0.5f).d;
+        bool hit = (aov.depth > 0.f);
+        glm::vec3 target = (hit ? cam.pos + aov.depth * d : history_cam.pos + d);
+        glm::vec2 q;
+        if (!history_cam.Project(target, q)) {
+            continue;
+        }
+        float expected_depth = (hit ? glm::dot(target - history_cam.pos, history_cam.forward) : 0.f);
+
+        // bilinear taps of previous frame, rejected ones drop out
+        glm::vec2 g = q - 0.5f;
+        int x0 = (int)std::floor(g.x), y0 = (int)std::floor(g.y);
+        glm::vec2 f = g - glm::vec2(x0, y0);
+        glm::vec3 mean = {0.f, 0.f, 0.f};
+        float count = 0.f, w_sum = 0.f;
+        for (uint8_t tap = 0; tap < 4; ++tap) {
+            int px = x0 + (tap & 1), py = y0 + (tap >> 1);
+            if (px < 0 || px >= (int)cam.width || py < 0 || py >= (int)cam.height) {
+                continue;
+            }
+            unsigned int j = px + py * cam.width;
+            const AOV_t& prev = history_aovs[j];
+            bool same = (hit ? prev.depth > 0.f && std::abs(prev.depth - expected_depth) < depth_tolerance * expected_depth &&
+                               glm::dot(prev.normal, aov.normal) > min_normal_cos
+                             : prev.depth == 0.f);
+            if (!same) {
+                continue;
+            }
+            float w = ((tap & 1) ? f.x : 1.f - f.x) * ((tap >> 1) ? f.y : 1.f - f.y);
+            mean += w * history[j];
+            count += w * history_n[j];
+            w_sum += w;
+        }
+        if (w_sum < min_weight) {
+            // disocclusion, pixel starts over
+            continue;
+        }
+        mean /= w_sum;
+        count /= w_sum;
+
+        next[i] = (count * mean + n * image[i]) / (count + n);
+        next_n[i] = std::min(count + n, (float)max_history);
+        fresh[i] = n / (count + n);
+    }
+
+    image = next;
+    history.swap(next);
+    history_n.swap(next_n);
+    history_aovs = aovs;
+    return fresh;
+}
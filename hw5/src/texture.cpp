@@ -0,0 +1,164 @@
+#include "texture.h"
+
+#include <glm/common.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+///////////////////
+// TEXTURE CACHE //
+///////////////////
+
+TextureCache_t::TextureCache_t(size_t max_bytes) : shard_bytes_(max_bytes / kShards) {}
+
+std::shared_ptr<const TILE_t> TextureCache_t::Tile(uint64_t key, const std::function<TILE_t()>& load) {
+    // neighbouring tiles differ in low bits of key, multiplicative hash spreads them over shards
+    SHARD_t& shard = shards_[(key * 0x9E3779B97F4A7C15ULL) >> 60];
+    static_assert(kShards == 16, "shard index takes top 4 bits of hash");
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        ++shard.lookups;
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+            return it->second.tile;
+        }
+        ++shard.misses;
+    }
+
+    auto tile = std::make_shared<const TILE_t>(load());
+    size_t tile_bytes = tile->size() * sizeof(glm::vec3);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end()) {
+        return it->second.tile;
+    }
+    shard.lru.push_front(key);
+    shard.entries[key] = {tile, shard.lru.begin()};
+    shard.bytes += tile_bytes;
+    // newest tile stays even when it alone is over budget
+    while (shard.bytes > shard_bytes_ && shard.lru.size() > 1) {
+        auto last = shard.entries.find(shard.lru.back());
+        shard.bytes -= last->second.tile->size() * sizeof(glm::vec3);
+        shard.entries.erase(last);
+        shard.lru.pop_back();
+    }
+    return tile;
+}
+
+uint64_t TextureCache_t::Misses() const {
+    uint64_t misses = 0;
+    for (const SHARD_t& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        misses += shard.misses;
+    }
+    return misses;
+}
+
+uint64_t TextureCache_t::Lookups() const {
+    uint64_t lookups = 0;
+    for (const SHARD_t& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        lookups += shard.lookups;
+    }
+    return lookups;
+}
+
+/////////////
+// TEXTURE //
+/////////////
+
+bool Texture_t::Open(const std::string& path, uint16_t id) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    char header[128] = {};
+    ssize_t n = pread(fd, header, sizeof(header) - 1, 0);
+    close(fd);
+    int header_size = 0;
+    if (n <= 0 || std::sscanf(header, "TX %u %u %u %u%*1[\n]%n", &width_, &height_, &tile_, &levels_, &header_size) != 4 ||
+            header_size == 0 || width_ == 0 || height_ == 0 || tile_ == 0 || levels_ == 0 || levels_ > 24) {
+        return false;
+    }
+    path_ = path;
+    id_ = id;
+
+    uint64_t offset = header_size;
+    uint64_t tile_bytes = (uint64_t)tile_ * tile_ * 3 * sizeof(float);
+    for (uint32_t level = 0; level < levels_; ++level) {
+        uint32_t w = std::max(1U, width_ >> level), h = std::max(1U, height_ >> level);
+        uint32_t tiles_x = (w + tile_ - 1) / tile_, tiles_y = (h + tile_ - 1) / tile_;
+        offset_.push_back(offset);
+        level_width_.push_back(w);
+        level_height_.push_back(h);
+        tiles_x_.push_back(tiles_x);
+        offset += tiles_x * tiles_y * tile_bytes;
+    }
+    return true;
+}
+
+TILE_t Texture_t::LoadTile(uint32_t level, uint32_t tx, uint32_t ty) const {
+    size_t n_texels = (size_t)tile_ * tile_;
+    std::vector<float> data(3 * n_texels, 0.f);
+    uint64_t offset = offset_[level] + ((uint64_t)ty * tiles_x_[level] + tx) * data.size() * sizeof(float);
+    int fd = open(path_.c_str(), O_RDONLY);
+    if (fd < 0 || pread(fd, data.data(), data.size() * sizeof(float), offset) != (ssize_t)(data.size() * sizeof(float))) {
+        // damaged or vanished file reads as black rather than stopping render
+        std::fill(data.begin(), data.end(), 0.f);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    TILE_t tile(n_texels);
+    std::memcpy(tile.data(), data.data(), data.size() * sizeof(float));
+    return tile;
+}
+
+glm::vec3 Texture_t::Bilinear(TextureCache_t& cache, uint32_t level, glm::vec2 uv) const {
+    int w = level_width_[level], h = level_height_[level];
+    // texel i is centred at (i + 0.5) / w
+    glm::vec2 g = uv * glm::vec2(w, h) - 0.5f;
+    glm::vec2 base = glm::floor(g);
+    glm::vec2 f = g - base;
+
+    // neighbouring texels mostly share tile, last one is kept
+    uint64_t last_key = 0;
+    std::shared_ptr<const TILE_t> tile;
+    auto texel = [&](int x, int y) {
+        x = ((x % w) + w) % w;
+        y = ((y % h) + h) % h;
+        uint32_t tx = x / tile_, ty = y / tile_;
+        // 16 bits of texture, 5 of level, 21 per tile coordinate, top bit keeps key nonzero
+        uint64_t key = (1ULL << 63) | ((uint64_t)id_ << 47) | ((uint64_t)level << 42) | ((uint64_t)ty << 21) | tx;
+        if (key != last_key) {
+            tile = cache.Tile(key, [&]() { return LoadTile(level, tx, ty); });
+            last_key = key;
+        }
+        return (*tile)[(y % tile_) * tile_ + x % tile_];
+    };
+
+    int x0 = (int)base.x, y0 = (int)base.y;
+    return (1.f - f.y) * ((1.f - f.x) * texel(x0, y0) + f.x * texel(x0 + 1, y0)) +
+                  f.y  * ((1.f - f.x) * texel(x0, y0 + 1) + f.x * texel(x0 + 1, y0 + 1));
+}
+
+glm::vec3 Texture_t::Sample(TextureCache_t& cache, glm::vec2 uv, float footprint) const {
+    uv -= glm::floor(uv);
+    // level where footprint covers one texel
+    float lod = std::log2(std::max(footprint * std::max(width_, height_), 1.f));
+    lod = std::min(lod, (float)(levels_ - 1));
+    uint32_t level = (uint32_t)lod;
+    float t = lod - level;
+    glm::vec3 value = Bilinear(cache, level, uv);
+    if (t > 0.f && level + 1 < levels_) {
+        value = (1.f - t) * value + t * Bilinear(cache, level + 1, uv);
+    }
+    return value;
+}